@@ -8,6 +8,32 @@
  * Licesnse TBD
  */
 
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Constant tables are placed in flash on the AVR.  Other
+   targets just use normal memory. */
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#endif
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+
+/* The type used to access the hardware registers.  A host
+   backend (see stedos_host.h) can replace this with a class
+   that simulates the registers. */
+#ifndef STEDOS_REGISTER
+#define STEDOS_REGISTER volatile uint8_t
+#endif
+
+namespace stedos { namespace _internal { struct placement; } }
+
+/* Constructs an object in existing storage */
+inline void* operator new(size_t, const stedos::_internal::placement&, void* p) { return p; }
+
  namespace stedos
  {
     /**********************************************************
@@ -15,17 +41,77 @@
      * Atomic
      *
      * This class is used to disable and enable interrupts
-     * It disables them on creation and enables them on destruction
+     * It disables them on creation and restores them on destruction.
+     * The previous state is restored, so an Atomic used inside an
+     * ISR (or inside another Atomic) does not enable interrupts.
      *
      **********************************************************/
 
     struct Atomic
     {
-        Atomic()  { cli(); }
-        ~Atomic() { sei(); asm volatile ("" ::: "memory"); }
+        Atomic() : sreg(SREG) { cli(); }
+        ~Atomic() { SREG = sreg; asm volatile ("" ::: "memory"); }
+
+    private:
+        uint8_t sreg;   /* status register, including the interrupt flag */
     };
 
 
+    /**********************************************************
+     *
+     * Utilities
+     *
+     * avr-libc doesn't supply the C++ standard library, so the
+     * few pieces of it that stedos needs are defined here.
+     *
+     **********************************************************/
+
+    namespace _internal
+    {
+        template <typename T> struct remove_reference      { typedef T type; };
+        template <typename T> struct remove_reference<T&>  { typedef T type; };
+        template <typename T> struct remove_reference<T&&> { typedef T type; };
+
+        template <typename T>
+        T&& forward(typename remove_reference<T>::type& v) { return static_cast<T&&>(v); }
+
+        template <typename T>
+        typename remove_reference<T>::type&& move(T&& v)
+        {
+            return static_cast<typename remove_reference<T>::type&&>(v);
+        }
+
+        /* Reads an object that may be stored in flash (PROGMEM) */
+        template <typename T>
+        T flash_read(const T* p)
+        {
+            T v;
+            #ifdef __AVR__
+                memcpy_P(&v, p, sizeof(T));
+            #else
+                memcpy(&v, p, sizeof(T));
+            #endif
+            return v;
+        }
+
+        /* log2 of a power of 2 */
+        constexpr uint8_t ilog2(const uint32_t& n) { return (n <= 1) ? 0 : 1 + ilog2(n >> 1); }
+
+        /* A list of indices 0..N-1, used to build tables at compile time */
+        template <int... I> struct indices {};
+
+        template <int N, int... I>
+        struct make_indices : make_indices<N - 1, N - 1, I...> {};
+
+        template <int... I>
+        struct make_indices<0, I...> { typedef indices<I...> type; };
+
+        /* Tag for the stedos placement new below.  A tag is used
+           so that it can't clash with the one from <new> */
+        struct placement {};
+    }
+
+
     /**********************************************************
      *
      * Port Access
@@ -57,9 +143,9 @@
 
         struct io_registers
         {
-            volatile uint8_t* const port;
-            volatile uint8_t* const pin;
-            volatile uint8_t* const ddr;
+            STEDOS_REGISTER* const port;
+            STEDOS_REGISTER* const pin;
+            STEDOS_REGISTER* const ddr;
         };
 
         const io_registers register_table[] = 
@@ -115,6 +201,7 @@
             uint8_t operator |= (uint8_t v) { return *registers.port |= v; }
             uint8_t operator &= (uint8_t v) { return *registers.port &= v; }
             uint8_t read() const { return *registers.pin; }
+            uint8_t readOutput() const { return *registers.port; }
             void toggle(const uint8_t& v) { *registers.pin = v; }
             void write(const uint8_t& v) { *registers.port = v; }
 
@@ -201,10 +288,10 @@
             }
             else
             {
-                uint8_t temp = port.read();     /* read the port value              */
-                temp &= ~MASK;                  /* clear out the bits we care about */
-                temp |= (v << OFFSET);          /* mask in v shifted by OFFSET      */
-                port.write(temp);               /* finally write back the value     */
+                uint8_t temp = port.readOutput(); /* read the output latch            */
+                temp &= ~MASK;                    /* clear out the bits we care about */
+                temp |= (v << OFFSET);            /* mask in v shifted by OFFSET      */
+                port.write(temp);                 /* finally write back the value     */
             }
         }
 
@@ -218,13 +305,23 @@
         void toggle(const uint8_t& m)  {  port.toggle(m << OFFSET);   }
 
         /* returns the value of the IO pins */
-        const uint8_t& read()
+        uint8_t read()
+        {
+            return extract(port.read());
+        }
+
+        /* extracts the value of the IO pins from a whole port value */
+        static uint8_t extract(const uint8_t& v)
         {
-            return (port.read() & MASK) >> OFFSET; 
+            return (v & MASK) >> OFFSET;
         }
 
     };
 
+    /* MASK is passed by reference, so it needs a definition */
+    template <typename PORT, int OFFSET, int LENGTH>
+    const uint8_t IO<PORT, OFFSET, LENGTH>::MASK;
+
     /**********************************************************
      *
      * Useful storage classes
@@ -284,6 +381,48 @@
             return head == tail;
         }
 
+        /** Checks to see if another push would overwrite an item.
+            The buffer holds at most SIZE - 1 items */
+        uint8_t     isFull()
+        {
+            auto a = Atomic();
+            uint8_t temp = head;
+            inc(temp);
+            return temp == tail;
+        }
+
+        /** Returns the number of items in the buffer */
+        uint8_t     count()
+        {
+            auto a = Atomic();
+            int16_t c = (int16_t) head - tail;
+            if (c < 0) c += SIZE;
+            return c;
+        }
+
+        /** Finds the items that can be read in place, without
+            wrapping.  first points at the next item to be popped.
+            Returns the number of items, which are left in the buffer */
+        uint8_t     contiguous(const T*& first)
+        {
+            auto a = Atomic();
+            uint8_t start = tail;
+            inc(start);
+            first = &array[start];
+            if (head == tail) return 0;
+            if (head >= start) return head - start + 1;
+            return SIZE - start;
+        }
+
+        /** Removes n items from the front of the queue */
+        void        drop(const uint8_t& n)
+        {
+            auto a = Atomic();
+            uint16_t t = tail + n;
+            if (t >= SIZE) t -= SIZE;
+            tail = t;
+        }
+
         FIFO() : head(0), tail(0) {};
 
 
@@ -304,263 +443,4889 @@
             //asm ( "lds %0, %1" : "=r" (v) : "" (&v));
             /* Force the compiler to put v into a local register
                generates lds r30, 0x0100 instead of ldi r26, 01, ldi r27, 00, ld r30, X */
-            asm volatile("" : "=b" (v) : "0" (v));
+            #ifdef __AVR__
+                asm volatile("" : "=b" (v) : "0" (v));
+            #endif
             v += 1;
 
             if (SIZE == 256)
             {
                 /* Nothing to do */
             }
-            else if ((SIZE == 2)  || (SIZE == 4)  || (SIZE == 8)   || (SIZE == 16)   ||
-                     (SIZE == 32) || (SIZE == 64) || (SIZE == 128))
+            else if ((SIZE == 2)  || (SIZE == 4)  || (SIZE == 8)   || (SIZE == 16)   ||
+                     (SIZE == 32) || (SIZE == 64) || (SIZE == 128))
+            {
+                v &= MASK; /* use MASK to limit index (optimisation if SIZE is a power of 2) */
+            }
+            else
+            {
+                if(v == SIZE)
+                {
+                    v = 0;  // use SIZE to limit index
+                }
+            }
+        }
+
+    };
+
+
+    /**
+     * Array - a fixed capacity vector of items
+     *
+     * The items are stored in place, so no memory is allocated.
+     * Items are constructed when they are added and destroyed
+     * when they are removed.  Items that are trivially copyable
+     * are shifted with memmove.
+     *
+     * Template Parameters:
+     *      T - class of the data that needs to be stored
+     *   SIZE - max items (limited to 255 as the length is a uint8_t)
+     */
+    template<typename T, int SIZE>
+    class Array
+    {
+        static_assert(SIZE > 0, "");
+        static_assert(SIZE <= 255, "");
+
+    public:
+        typedef T*       iterator;
+        typedef const T* const_iterator;
+
+        Array() : length(0) {};
+        ~Array() { clear(); }
+
+        /* Arrays are not copied by accident */
+        Array(const Array&) = delete;
+        Array& operator = (const Array&) = delete;
+
+        /* Size queries */
+        uint8_t  size()     const { return length; }
+        uint8_t  capacity() const { return SIZE; }
+        bool     isEmpty()  const { return length == 0; }
+        bool     isFull()   const { return length == SIZE; }
+
+        /* Iterators */
+        iterator       begin()       { return data(); }
+        iterator       end()         { return data() + length; }
+        const_iterator begin() const { return data(); }
+        const_iterator end()   const { return data() + length; }
+
+        T&       operator[] (uint8_t idx)       { return data()[idx]; }
+        const T& operator[] (uint8_t idx) const { return data()[idx]; }
+
+        /* Adds an item to the back of the array.
+           Returns false if the array is full */
+        bool     append(const T& v) { return emplace(v) != 0; }
+
+        /* Constructs an item in place at the back of the array.
+           Returns the new item, or 0 if the array is full */
+        template <typename... ARGS>
+        T*       emplace(ARGS&&... args)
+        {
+            if (isFull()) return 0;
+
+            T* item = new (_internal::placement(), data() + length) T(_internal::forward<ARGS>(args)...);
+            length += 1;
+            return item;
+        }
+
+        /* Adds an item at the specified index, moving the later items up.
+           v must not refer to an item in the array.
+           Returns false if the array is full or idx is past the end */
+        bool     insert(const T& v, uint8_t idx=0)
+        {
+            if (isFull() || (idx > length)) return false;
+
+            T* items = data();
+            if (__is_trivially_copyable(T))
+            {
+                memmove((void*) (items + idx + 1), (void*) (items + idx), (length - idx) * sizeof(T));
+            }
+            else
+            {
+                for (uint8_t i=length; i>idx; i-=1)
+                {
+                    relocate(items + i, items + i - 1);
+                }
+            }
+            new (_internal::placement(), items + idx) T(v);
+            length += 1;
+            return true;
+        }
+
+        /* Removes the item at the specified index, keeping the order
+           of the remaining items.  idx must be less than size() */
+        T        remove(uint8_t idx)
+        {
+            T* items = data();
+            T  v(_internal::move(items[idx]));
+            items[idx].~T();
+            length -= 1;
+
+            if (__is_trivially_copyable(T))
+            {
+                memmove((void*) (items + idx), (void*) (items + idx + 1), (length - idx) * sizeof(T));
+            }
+            else
+            {
+                for (uint8_t i=idx; i<length; i+=1)
+                {
+                    relocate(items + i, items + i + 1);
+                }
+            }
+            return v;
+        }
+
+        /* Removes the item at the specified index in O(1) by moving
+           the last item into its place.  The order is not kept.
+           idx must be less than size() */
+        T        swapRemove(uint8_t idx)
+        {
+            T* items = data();
+            T  v(_internal::move(items[idx]));
+            items[idx].~T();
+            length -= 1;
+
+            if (idx != length)
+            {
+                relocate(items + idx, items + length);
+            }
+            return v;
+        }
+
+        /* Removes an item at the back of the array.
+           The array must not be empty */
+        T        pop()
+        {
+            T* items = data();
+            length -= 1;
+            T  v(_internal::move(items[length]));
+            items[length].~T();
+            return v;
+        }
+
+        /* Removes all of the items */
+        void     clear()
+        {
+            while (length > 0)
+            {
+                length -= 1;
+                data()[length].~T();
+            }
+        }
+
+    private:
+        alignas(T) uint8_t storage[SIZE * sizeof(T)];
+        uint8_t length;
+
+        T*       data()       { return reinterpret_cast<T*>(storage); }
+        const T* data() const { return reinterpret_cast<const T*>(storage); }
+
+        /* Moves an item into an empty slot, leaving from empty */
+        static void relocate(T* to, T* from)
+        {
+            new (_internal::placement(), to) T(_internal::move(*from));
+            from->~T();
+        }
+    };
+
+
+
+    /**
+     * StaticMap - a constant sorted map, built at compile time
+     *
+     * The entries are given in any order and are sorted by the
+     * compiler.  The map must be placed in flash (PROGMEM), where
+     * it costs no RAM, because find() reads the entries with
+     * flash reads.  A map in RAM, e.g. a local variable, would
+     * return garbage on the AVR.  find() is a binary search that
+     * always takes log2(N) steps.  Duplicate keys are a compile
+     * error.
+     *
+     * Example:
+     *
+     *   constexpr auto commands PROGMEM =
+     *       stedos::makeStaticMap<char, stedos::event_func_t>({
+     *           { 's', status },
+     *           { 'r', reset  },
+     *       });
+     *
+     *   stedos::event_func_t f;
+     *   if (commands.find(c, f)) queue.queueEvent(f);
+     *
+     * Template Parameters:
+     *      K - key type, compared with <
+     *      V - value type
+     *      N - number of entries
+     */
+    template <typename K, typename V>
+    struct MapEntry
+    {
+        K key;
+        V value;
+    };
+
+    template <typename K, typename V, int N>
+    struct StaticMap
+    {
+        static_assert(N > 0, "");
+        static_assert(N <= 255, "");
+
+        typedef MapEntry<K, V> entry_t;
+
+        entry_t entries[N];
+
+        constexpr uint8_t size() const { return N; }
+
+        /* Looks up key in the map, which is in flash.  If it is
+           found, value is set and true is returned */
+        bool find(const K& key, V& value) const
+        {
+            const entry_t* base = entries;
+            uint8_t n = N;
+
+            /* Narrow the range down to one entry.  The loop count
+               only depends on N, not on the key */
+            while (n > 1)
+            {
+                uint8_t half = n / 2;
+                if (!(key < _internal::flash_read(&base[half].key))) base += half;
+                n -= half;
+            }
+
+            if (_internal::flash_read(&base->key) == key)
+            {
+                value = _internal::flash_read(&base->value);
+                return true;
+            }
+            return false;
+        }
+    };
+
+    namespace _internal
+    {
+        /* Not constexpr, so calling it while building a StaticMap
+           stops the compile */
+        inline uint8_t duplicate_key_in_StaticMap() { return 0; }
+
+        /* A constexpr sort, for tables built at compile time.
+           KEY::get(entry) gives the key that entries are sorted
+           by.  Entries with equal keys keep their order, unless
+           UNIQUE is set, when they are a compile error.  It is
+           O(N^2) per entry, which is fine for small tables.
+
+           sort_rank is the number of entries that sort before
+           entry j */
+        template <typename KEY, bool UNIQUE, typename T, int N>
+        constexpr uint8_t sort_rank(const T (&e)[N], int j, int k=0)
+        {
+            return (k == N) ? 0 :
+                   ((!(KEY::get(e[k]) < KEY::get(e[j])) && !(KEY::get(e[j]) < KEY::get(e[k])))
+                       ? ((k == j) ? 0 : UNIQUE ? duplicate_key_in_StaticMap() : (k < j) ? 1 : 0)
+                       : ((KEY::get(e[k]) < KEY::get(e[j])) ? 1 : 0)) +
+                   sort_rank<KEY, UNIQUE>(e, j, k + 1);
+        }
+
+        /* The entry that sorts into position r */
+        template <typename KEY, bool UNIQUE, typename T, int N>
+        constexpr T sort_select(const T (&e)[N], int r, int j=0)
+        {
+            return ((j == N - 1) || (sort_rank<KEY, UNIQUE>(e, j) == r)) ? e[j] : sort_select<KEY, UNIQUE>(e, r, j + 1);
+        }
+
+        struct map_key
+        {
+            template <typename K, typename V>
+            static constexpr K get(const MapEntry<K, V>& e) { return e.key; }
+        };
+
+        template <typename K, typename V, int N, int... I>
+        constexpr StaticMap<K, V, N> make_static_map(const MapEntry<K, V> (&e)[N], indices<I...>)
+        {
+            return StaticMap<K, V, N> { { sort_select<map_key, true>(e, I)... } };
+        }
+    }
+
+    /* Builds a sorted StaticMap from a list of { key, value } entries */
+    template <typename K, typename V, int N>
+    constexpr StaticMap<K, V, N> makeStaticMap(const MapEntry<K, V> (&entries)[N])
+    {
+        return _internal::make_static_map(entries, typename _internal::make_indices<N>::type());
+    }
+
+
+
+    /**
+     * Pool - fixed block allocator
+     *
+     * Pool replaces malloc() / free() for objects of a single
+     * type.  The free blocks are kept in a list that is stored
+     * inside the blocks themselves, so alloc() and free() are
+     * O(1) and can be called from main or ISR context.
+     *
+     * Objects are constructed in place by alloc() and destroyed
+     * by free().  A pointer to an object can be passed through
+     * Event::data, e.g.
+     *
+     *   Packet* p = packets.alloc();
+     *   if (p) queue.queueEvent(packet_received, (uintptr_t) p);
+     *
+     * Template Parameters:
+     *      T - class of the objects that are allocated
+     *   SIZE - number of blocks
+     *  STATS - policy class that is told about every allocation.
+     *          PoolNoStats costs nothing, PoolStats records the
+     *          usage, high water mark and failed allocations.
+     */
+    struct PoolNoStats
+    {
+        void allocated() {}
+        void freed()     {}
+        void exhausted() {}
+    };
+
+    struct PoolStats
+    {
+        uint8_t used;       /* blocks currently allocated       */
+        uint8_t highWater;  /* most blocks ever allocated       */
+        uint8_t failures;   /* alloc() calls that found no block */
+
+        void allocated() { used += 1; if (used > highWater) highWater = used; }
+        void freed()     { used -= 1; }
+        void exhausted() { if (failures < 0xff) failures += 1; }
+
+        PoolStats() : used(0), highWater(0), failures(0) {};
+    };
+
+    template <typename T, int SIZE, typename STATS=PoolNoStats>
+    class Pool
+    {
+        static_assert(SIZE > 0, "");
+        static_assert(SIZE <= 255, "");
+
+        /* A block either holds an object or is on the free list */
+        union block
+        {
+            block* next;
+            alignas(T) uint8_t item[sizeof(T)];
+        };
+
+    public:
+        Pool() : freeList(blocks)
+        {
+            for (uint8_t idx=0; idx<SIZE-1; idx+=1)
+            {
+                blocks[idx].next = &blocks[idx + 1];
+            }
+            blocks[SIZE - 1].next = 0;
+        }
+
+        Pool(const Pool&) = delete;
+        Pool& operator = (const Pool&) = delete;
+
+        /* Takes a block and constructs an object in it.
+           Returns 0 if there are no free blocks */
+        template <typename... ARGS>
+        T*   alloc(ARGS&&... args)
+        {
+            block* b;
+            {
+                auto a = Atomic();
+                b = freeList;
+                if (b == 0)
+                {
+                    stats.exhausted();
+                    return 0;
+                }
+                freeList = b->next;
+                stats.allocated();
+            }
+            return new (_internal::placement(), b->item) T(_internal::forward<ARGS>(args)...);
+        }
+
+        /* Destroys an object and returns its block to the pool.
+           p must have come from alloc() on this pool, or be 0 */
+        void free(T* p)
+        {
+            if (p == 0) return;
+
+            p->~T();
+            block* b = reinterpret_cast<block*>(p);
+
+            auto a = Atomic();
+            b->next  = freeList;
+            freeList = b;
+            stats.freed();
+        }
+
+        /* Checks to see if the pool has run out of blocks */
+        bool isEmpty()
+        {
+            auto a = Atomic();
+            return freeList == 0;
+        }
+
+        STATS stats;
+
+    private:
+        block  blocks[SIZE];
+        block* freeList;    /* first free block, or 0 */
+    };
+
+
+
+    /**
+     * List - intrusive doubly linked list
+     *
+     * The links are stored inside the objects themselves, by
+     * deriving them from ListHook, so the list needs no storage
+     * of its own and never copies anything.  Every operation is
+     * O(1) and only a handful of pointer writes.
+     *
+     * The list does not disable interrupts itself.  If it is
+     * shared with an ISR, wrap each operation in an Atomic.
+     *
+     * An object can be on more than one list at a time by
+     * deriving from more than one hook, each with its own TAG:
+     *
+     *   struct Sensor : stedos::ListHook<Active>, stedos::ListHook<Dirty> {};
+     *
+     *   stedos::List<Sensor, Active> active;
+     *   stedos::List<Sensor, Dirty>  dirty;
+     */
+    template <typename TAG=void>
+    struct ListHook
+    {
+        ListHook* next;
+        ListHook* prev;
+
+        ListHook() : next(0), prev(0) {};
+
+        /* Checks to see if the object is on a list */
+        bool isLinked() const { return next != 0; }
+    };
+
+    template <typename T, typename TAG=void>
+    class List
+    {
+        typedef ListHook<TAG> hook_t;
+
+    public:
+        class iterator
+        {
+        public:
+            iterator(hook_t* h) : hook(h) {};
+            T&        operator *  () const { return *item(hook); }
+            T*        operator -> () const { return item(hook); }
+            iterator& operator ++ ()       { hook = hook->next; return *this; }
+            bool      operator != (const iterator& o) const { return hook != o.hook; }
+            bool      operator == (const iterator& o) const { return hook == o.hook; }
+
+        private:
+            hook_t* hook;
+        };
+
+        /* The list head is a hook that points to itself when
+           the list is empty.  This removes all the special cases
+           for the first and last items */
+        List() { head.next = &head; head.prev = &head; }
+
+        List(const List&) = delete;
+        List& operator = (const List&) = delete;
+
+        bool isEmpty() const { return head.next == &head; }
+
+        /* Iterators.  Don't remove the current item while iterating */
+        iterator begin() { return iterator(head.next); }
+        iterator end()   { return iterator(&head); }
+
+        /* Returns the first / last item, or 0 if the list is empty */
+        T*   front() { return isEmpty() ? 0 : item(head.next); }
+        T*   back()  { return isEmpty() ? 0 : item(head.prev); }
+
+        /* Adds an item.  It must not already be on this list */
+        void pushBack(T& v)  { link(&head, hook(v)); }
+        void pushFront(T& v) { link(head.next, hook(v)); }
+
+        /* Adds an item in front of pos, which must be on this list */
+        void insertBefore(T& pos, T& v) { link(hook(pos), hook(v)); }
+
+        /* Removes and returns the first / last item, or 0 if the list is empty */
+        T*   popFront() { if (isEmpty()) return 0; hook_t* h = head.next; unlink(h); return item(h); }
+        T*   popBack()  { if (isEmpty()) return 0; hook_t* h = head.prev; unlink(h); return item(h); }
+
+        /* Removes an item from the list.  It must be on this list */
+        void remove(T& v) { unlink(hook(v)); }
+
+        /* Checks to see if an item is on a list of this type */
+        static bool isLinked(T& v) { return hook(v)->isLinked(); }
+
+    private:
+        hook_t head;
+
+        static hook_t* hook(T& v)    { return static_cast<hook_t*>(&v); }
+        static T*      item(hook_t* h) { return static_cast<T*>(h); }
+
+        /* Links h in front of pos */
+        static void link(hook_t* pos, hook_t* h)
+        {
+            h->next = pos;
+            h->prev = pos->prev;
+            pos->prev->next = h;
+            pos->prev = h;
+        }
+
+        static void unlink(hook_t* h)
+        {
+            h->prev->next = h->next;
+            h->next->prev = h->prev;
+            h->next = 0;
+            h->prev = 0;
+        }
+    };
+
+
+
+    /**********************************************************
+     *
+     * Event processing
+     *
+     **********************************************************/
+
+
+    /* Define a function prototype to use for structures */
+    typedef void (*event_func_t) (uintptr_t data);
+
+    /* Define a struct used to store a function pointer
+       and the user data associated with it
+    */
+
+    struct Event
+    {
+        event_func_t func;
+        uintptr_t    data;
+
+        Event() {};
+        Event(event_func_t f) : func(f), data(0) {};
+        Event(event_func_t f, uintptr_t d) : func(f), data(d) {};
+
+    };
+
+    class EventProcessorInterface
+    {
+    public:
+        virtual void queueEvent(event_func_t func) =0;
+        virtual void queueEvent(event_func_t func, uintptr_t data) =0;
+        virtual void queueEvent(const Event& event) =0;
+        virtual void process() = 0;
+    };
+
+    /* The EventProcessor can be profiled by supplying a profiler
+       policy class.  NoProfiler is the default and costs nothing.
+
+       A profiler is told:
+           poll()       - at the start of each process() call
+           enter(event) - before each event is dispatched
+           leave(func)  - after each event is dispatched
+    */
+    struct NoProfiler
+    {
+        void poll()                         {}
+        void enter(const Event& e)          {}
+        void leave(const event_func_t& f)   {}
+    };
+
+    /* Profiler measures the time taken by each event function
+       using a free running hardware timer.  The statistics are
+       kept in a small open addressed table keyed by the function
+       pointer.  If the table is full, the time is added to the
+       entry with a null function.
+
+       The time between events is counted as idle, so the CPU
+       utilisation is busyCycles() / (busyCycles() + idleCycles()).
+
+       Times are measured as differences of CLOCK::now(), so they
+       are only right if they are shorter than the clock's range.
+       A 16 bit clock such as Timer1Clock wraps after 65536 cycles
+       (about 4 ms at 16 MHz), and longer handlers or idle periods
+       are under counted.  Timer1Clock32 extends timer 1 to 32
+       bits, by counting its overflows.  max saturates at 0xffff.
+
+       Template Parameters:
+           CLOCK - class with a static now() returning a uint16_t or
+                   a uint32_t, e.g. Timer1Clock or Timer1Clock32
+            SIZE - number of table entries (a power of 2)
+
+       Example:
+
+           stedos::EventProcessor<16, stedos::Profiler<stedos::Timer1Clock> > queue;
+    */
+    struct ProfileEntry
+    {
+        event_func_t func;
+        uint16_t     count;     /* times called (saturates)     */
+        uint16_t     max;       /* longest call in clock ticks (saturates) */
+        uint32_t     total;     /* total clock ticks            */
+    };
+
+    template <typename CLOCK, int SIZE=16>
+    class Profiler
+    {
+        static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+        static_assert(SIZE <= 128, "");
+
+        static const uint8_t MASK = (SIZE - 1);
+
+        typedef decltype(CLOCK::now()) time_type;
+
+    public:
+        class iterator
+        {
+        public:
+            iterator(const ProfileEntry* e, const ProfileEntry* l) : entry(e), last(l) { skip(); };
+            const ProfileEntry& operator *  () const { return *entry; }
+            const ProfileEntry* operator -> () const { return entry; }
+            iterator& operator ++ () { entry += 1; skip(); return *this; }
+            bool      operator != (const iterator& o) const { return entry != o.entry; }
+
+        private:
+            const ProfileEntry* entry;
+            const ProfileEntry* last;
+
+            void skip() { while ((entry != last) && (entry->count == 0)) entry += 1; }
+        };
+
+        Profiler() { reset(); }
+
+        /* Clears all of the statistics */
+        void reset()
+        {
+            memset(table, 0, sizeof(table));
+            busy = 0;
+            idle = 0;
+            last = CLOCK::now();
+        }
+
+        /* Iterates over the functions that have been called */
+        iterator begin() const { return iterator(table, table + SIZE); }
+        iterator end()   const { return iterator(table + SIZE, table + SIZE); }
+
+        uint32_t busyCycles() const { return busy; }
+        uint32_t idleCycles() const { return idle; }
+
+        /* CPU utilisation in percent */
+        uint8_t utilisation() const
+        {
+            uint32_t b   = busy;
+            uint32_t all = busy + idle;
+            while (all > 0x028f5c28)   /* keep b * 100 within 32 bits */
+            {
+                b   >>= 1;
+                all >>= 1;
+            }
+            return all ? (uint8_t) (b * 100 / all) : 0;
+        }
+
+        /* Writes the table as text, one line per function:
+           "func count max total\n", all in hex */
+        void dump(void (*put)(char)) const
+        {
+            for (const ProfileEntry& e : *this)
+            {
+                hex(put, (uintptr_t) e.func); put(' ');
+                hex(put, e.count);            put(' ');
+                hex(put, e.max);              put(' ');
+                hex(put, e.total);            put('\n');
+            }
+            put('b'); put(' '); hex(put, busy); put('\n');
+            put('i'); put(' '); hex(put, idle); put('\n');
+        }
+
+        /* The policy functions, called by EventProcessor */
+        void poll()
+        {
+            time_type now = CLOCK::now();
+            idle += (time_type) (now - last);
+            last = now;
+        }
+
+        void enter(const Event& e) { poll(); }
+
+        void leave(const event_func_t& f)
+        {
+            time_type now = CLOCK::now();
+            time_type ticks = now - last;
+            last = now;
+            busy += ticks;
+
+            ProfileEntry& e = find(f);
+            if (e.count < 0xffff) e.count += 1;
+            if (ticks > e.max) e.max = (ticks < 0xffff) ? ticks : 0xffff;
+            e.total += ticks;
+        }
+
+    private:
+        ProfileEntry table[SIZE];
+        uint32_t busy;      /* ticks spent in event functions */
+        uint32_t idle;      /* ticks spent waiting for events */
+        time_type last;     /* clock at the last poll / end   */
+
+        /* Finds the entry for f, adding it if necessary */
+        ProfileEntry& find(const event_func_t& f)
+        {
+            uint8_t idx = ((uintptr_t) f >> 1) & MASK;
+            for (uint8_t probe=0; probe<SIZE; probe+=1)
+            {
+                ProfileEntry& e = table[idx];
+                if (e.func == f) return e;
+                if (e.count == 0)
+                {
+                    e.func = f;
+                    return e;
+                }
+                idx = (idx + 1) & MASK;
+            }
+            return overflow(f);
+        }
+
+        /* The table is full.  Use the entry for the null function,
+           taking over the smallest entry if there isn't one */
+        ProfileEntry& overflow(const event_func_t& f)
+        {
+            ProfileEntry* smallest = table;
+            for (uint8_t idx=0; idx<SIZE; idx+=1)
+            {
+                if (table[idx].func == 0) return table[idx];
+                if (table[idx].total < smallest->total) smallest = &table[idx];
+            }
+            smallest->func = 0;
+            return *smallest;
+        }
+
+        template <typename T>
+        static void hex(void (*put)(char), const T& v)
+        {
+            for (int8_t shift=sizeof(T)*8-4; shift>=0; shift-=4)
+            {
+                put("0123456789abcdef"[(v >> shift) & 0xf]);
+            }
+        }
+    };
+
+    /* A clock for the Profiler using timer 1.  start() sets the
+       timer to run freely at the CPU clock, so times are in cycles */
+    #ifdef TCNT1
+        struct Timer1Clock
+        {
+            static void     start() { TCCR1A = 0; TCCR1B = _BV(CS10); }
+            static uint16_t now()   { return TCNT1; }
+        };
+
+        /* Timer 1 extended to 32 bits by counting its overflows,
+           which wraps after 268 s at 16 MHz.  The overflow
+           interrupt must call overflow():
+
+             ISR(TIMER1_OVF_vect) { stedos::Timer1Clock32::overflow(); }
+        */
+        struct Timer1Clock32
+        {
+            static void start()
+            {
+                TCCR1A = 0;
+                TCCR1B = _BV(CS10);
+                TIFR1  = _BV(TOV1);
+                TIMSK1 |= _BV(TOIE1);
+            }
+
+            static void overflow() { overflows() += 1; }
+
+            static uint32_t now()
+            {
+                auto a = Atomic();
+                uint16_t low  = TCNT1;
+                uint16_t high = overflows();
+
+                /* The timer overflowed before low was read, but the
+                   interrupt hasn't run yet */
+                if ((TIFR1 & _BV(TOV1)) && (low < 0x8000)) high += 1;
+                return ((uint32_t) high << 16) | low;
+            }
+
+        private:
+            static volatile uint16_t& overflows()
+            {
+                static volatile uint16_t n = 0;
+                return n;
+            }
+        };
+    #endif
+
+    template <int SIZE, typename PROFILER=NoProfiler>
+    class EventProcessor : public EventProcessorInterface
+    {
+    public:
+        /** Adds an event to the queue */
+        void queueEvent(event_func_t func)                 { events.push(Event(func));   }
+        void queueEvent(event_func_t func, uintptr_t data) { events.push({ func, data}); }
+        void queueEvent(const Event& event)                { events.push(event);         }
+        void process()
+        {
+            profiler.poll();
+            while(events.isEmpty() == false)
+            {
+                Event event = events.pop();
+                profiler.enter(event);
+                event.func(event.data);
+                profiler.leave(event.func);
+            }
+        }
+
+        /** Checks the queue, e.g. before sleeping */
+        bool isEmpty()  { return events.isEmpty(); }
+
+        /** Checks to see if another event would overwrite one */
+        bool isFull()   { return events.isFull(); }
+
+        PROFILER profiler;
+
+    private:
+        FIFO<Event, SIZE> events;
+    };
+
+    extern "C" void __cxa_pure_virtual() { while (1); }
+
+    /**********************************************************
+     *
+     * Channel
+     *
+     * A FIFO that queues its consumer event when it goes from
+     * empty to not empty.  A burst of pushes, e.g. from an ISR,
+     * queues the event once, and each push is one critical
+     * section (the push that queues the event adds the queue's
+     * own).
+     *
+     * The consumer drains the channel in batches.  drain() calls
+     * a function for each item, in place, and only re-arms the
+     * event once it has found the channel empty, so an item
+     * pushed while the consumer runs is never missed and never
+     * queues a second event.
+     *
+     * Unlike FIFO, a full channel rejects the item (and counts
+     * it) rather than overwriting the oldest one.
+     *
+     * Example:
+     *
+     *   stedos::Channel<uint8_t, 32> bytes(&queue, received);
+     *
+     *   ISR(USART_RX_vect) { bytes.push(UDR0); }
+     *
+     *   void received(uintptr_t data)
+     *   {
+     *       bytes.drain([](const uint8_t& c) { parse(c); });
+     *   }
+     *
+     * Template Parameters:
+     *      T - class of the items
+     *   SIZE - max items (up to 255)
+     *
+     **********************************************************/
+
+    template <typename T, int SIZE>
+    class Channel
+    {
+        static_assert(SIZE > 0, "");
+        static_assert(SIZE < 256, "");
+
+    public:
+        /* Constructor.  func is queued with data when an item
+           arrives in the empty channel */
+        Channel(EventProcessorInterface* p, event_func_t func, uintptr_t data=0)
+            : processor(p), consumer(func, data), head(0), tail(0), used(0), armed(true), dropped(0) {};
+
+        /** Adds an item.  Returns false if the channel is full */
+        bool push(const T& v)
+        {
+            bool edge;
+            {
+                auto a = Atomic();
+                if (used == SIZE)
+                {
+                    if (dropped < 0xffff) dropped += 1;
+                    return false;
+                }
+                array[head] = v;
+                head = next(head);
+                used += 1;
+
+                edge  = armed;
+                armed = false;
+            }
+
+            if (edge) processor->queueEvent(consumer);
+            return true;
+        }
+
+        /** Adds n items in one critical section.  Returns the
+            number added */
+        uint8_t push(const T* p, const uint8_t& n)
+        {
+            uint8_t added = 0;
+            bool edge;
+            {
+                auto a = Atomic();
+                while ((added < n) && (used < SIZE))
+                {
+                    array[head] = p[added++];
+                    head = next(head);
+                    used += 1;
+                }
+                if ((added < n) && (dropped < 0xffff)) dropped += 1;
+
+                edge  = armed && (added > 0);
+                armed = armed && (added == 0);
+            }
+
+            if (edge) processor->queueEvent(consumer);
+            return added;
+        }
+
+        /** Removes the oldest item.  Returns false, and re-arms the
+            consumer event, if there are none */
+        bool pop(T& v)
+        {
+            auto a = Atomic();
+            if (used == 0)
+            {
+                armed = true;
+                return false;
+            }
+            v = array[tail];
+            tail = next(tail);
+            used -= 1;
+            return true;
+        }
+
+        /** Calls f(item) for every item, oldest first, until the
+            channel is empty, and re-arms the consumer event.  The
+            items are passed in place.  Returns the number of items */
+        template <typename FUNC>
+        uint16_t drain(FUNC f)
+        {
+            uint16_t total = 0;
+            uint8_t  n     = 0;
+            while (true)
+            {
+                uint8_t first;
+                {
+                    /* Release the last batch and take the next */
+                    auto a = Atomic();
+                    tail  = advance(tail, n);
+                    used -= n;
+                    if (used == 0)
+                    {
+                        armed = true;
+                        return total;
+                    }
+                    first = tail;
+                    n = (tail < head) ? head - tail : SIZE - tail;
+                }
+
+                for (uint8_t idx=0; idx<n; idx+=1) f(array[first + idx]);
+                total += n;
+            }
+        }
+
+        uint8_t  count()                { auto a = Atomic(); return used; }
+        bool     isEmpty()              { return count() == 0; }
+        uint16_t droppedCount() const   { auto a = Atomic(); return dropped; }
+
+    private:
+        EventProcessorInterface* processor;
+        Event    consumer;
+        T        array[SIZE];
+        uint8_t  head;          /* next slot to write */
+        uint8_t  tail;          /* oldest item        */
+        uint8_t  used;
+        bool     armed;         /* queue the consumer on the next push */
+        uint16_t dropped;
+
+        static uint8_t next(const uint8_t& idx) { return (idx == SIZE - 1) ? 0 : idx + 1; }
+
+        static uint8_t advance(const uint8_t& idx, const uint8_t& n)
+        {
+            uint16_t v = idx + n;
+            return (v >= SIZE) ? v - SIZE : v;
+        }
+    };
+
+    /**********************************************************
+     *
+     * Delayed Event processing (Timer Module)
+     *
+     **********************************************************/
+
+    /* The Timer Module uses policy based class design to implement
+       the actual details of the timer.  This is so that the timer code
+       can be optimised for the application required.
+
+       Timer Implementations should inherit from this base class
+    */
+    class TimerImplementationInterface
+    {
+    public:
+        /* tick() is called on every timer tick */
+        virtual void    tick(void) = 0;
+
+        /* add() is called to add a new timer */
+        virtual uint8_t add(uint16_t timeout, Event event) = 0;
+
+        /* remove() is called to remove a timer, using the handle returned by add */
+        virtual void    remove(uint8_t handle) = 0;
+        
+    };
+
+    /* 
+       Simple Timer Implmentation.  This maintains a list of
+       timers, which are decremented on each tick.  When the count is 0,
+       the callback is executed.
+    */
+
+    /* Struct to keep information on each timer */
+    struct TimerQueue_t
+    {
+        uint16_t ticks;     /* Ticks remaining             */
+        Event    event;     /* Event to activate on expiry */
+    };
+
+    template<int SIZE>
+    class SimpleTimerImplementation : public TimerImplementationInterface
+    {
+    public:
+        /* Constructor */
+        SimpleTimerImplementation(EventProcessorInterface* p) : queue(), processor(p), ticks(0) {};
+
+        /* tick() adds a timer event to the queue */
+        void tick(void)
+        {
+            auto a = Atomic();
+            ticks += 1;
+
+            /* Go through all of the queue items.
+               Decrement them and call the callback if necessary.  */
+            for (uint8_t idx=0; idx<SIZE; idx+=1)
+            {
+                if (queue[idx].ticks > 0)
+                {
+                    queue[idx].ticks -= 1;
+
+                    if (queue[idx].ticks == 0)
+                    {
+                        processor->queueEvent(queue[idx].event);
+                    }
+                }
+            }
+        }
+
+        /* add an event to be timed */
+        uint8_t add(uint16_t timeout, Event event)
+        {
+            auto a = Atomic();
+            for (uint8_t idx=0; idx<SIZE; idx+=1)
+            {
+                if (queue[idx].ticks == 0)
+                {
+                    queue[idx].ticks = timeout;
+                    queue[idx].event = event;
+                    return idx;
+                }
+            }
+
+            return 0xff; /* Invalid Handle */
+        }
+
+        /* Remove handle from the list */
+        void    remove(uint8_t handle)
+        {
+            auto a = Atomic();
+            queue[handle].ticks = 0;
+        }
+
+        /* The number of ticks so far.  It wraps, so compare two
+           times by their difference */
+        uint16_t now() const
+        {
+            auto a = Atomic();
+            return ticks;
+        }
+
+    private:
+        TimerQueue_t queue[SIZE];
+        EventProcessorInterface* processor;
+        uint16_t ticks;
+    };
+
+    template<class T>
+    class Timer : public T
+    {
+        //virtual void callback(callbackFunction f, void* userData) { f(userData); };
+    };
+
+    /**********************************************************
+     *
+     * Pin change interrupts
+     *
+     * PinChangeDispatcher works out which pins of a port have
+     * changed since the last pin change interrupt and queues
+     * the event registered for each of them.  The handlers are
+     * supplied as template arguments, so the dispatch table is
+     * resolved at compile time and the ISR only tests the bits
+     * that actually have a handler.
+     *
+     * Example:
+     *
+     *   void button(uintptr_t level);
+     *   void dial(uintptr_t value);
+     *
+     *   stedos::PinChangeDispatcher<stedos::port_b,
+     *       stedos::PinChange<stedos::IO<stedos::port_b, 0>,    button>,
+     *       stedos::PinChange<stedos::IO<stedos::port_b, 4, 2>, dial>
+     *   > pins(&queue);
+     *
+     *   PCMSK0 = pins.MASK;
+     *   pins.begin();
+     *
+     *   ISR(PCINT0_vect) { pins.changed(); }
+     *
+     **********************************************************/
+
+    /* PinChange binds an IO group to the event that is queued
+       when any of its pins change.  The event data is the new
+       value of the group, in the same form as IO::read() */
+    template <typename IO_T, event_func_t FUNC>
+    struct PinChange
+    {
+        static const uint8_t MASK = IO_T::MASK;
+
+        static void dispatch(EventProcessorInterface* p, const uint8_t& current)
+        {
+            p->queueEvent(FUNC, IO_T::extract(current));
+        }
+    };
+
+    namespace _internal
+    {
+        /* Unrolls the list of PinChange handlers at compile time */
+        template <typename... HANDLERS>
+        struct pin_change_table;
+
+        template <>
+        struct pin_change_table<>
+        {
+            static const uint8_t MASK = 0;
+
+            static void dispatch(EventProcessorInterface* p, const uint8_t& current, const uint8_t& changed) {}
+        };
+
+        template <typename H, typename... REST>
+        struct pin_change_table<H, REST...>
+        {
+            static_assert((H::MASK & pin_change_table<REST...>::MASK) == 0, "a pin can only have one handler");
+
+            static const uint8_t MASK = H::MASK | pin_change_table<REST...>::MASK;
+
+            static void dispatch(EventProcessorInterface* p, const uint8_t& current, const uint8_t& changed)
+            {
+                if (changed & H::MASK)
+                {
+                    H::dispatch(p, current);
+                }
+                pin_change_table<REST...>::dispatch(p, current, changed);
+            }
+        };
+    }
+
+    template <typename PORT, typename... HANDLERS>
+    class PinChangeDispatcher
+    {
+        typedef _internal::pin_change_table<HANDLERS...> table;
+
+    public:
+        /* The pins that have a handler.  This is the value
+           that should be written to the PCMSK register */
+        static const uint8_t MASK = table::MASK;
+
+        /* Constructor */
+        PinChangeDispatcher(EventProcessorInterface* p) : processor(p), previous(0) {};
+
+        /* Takes a snapshot of the port.  This should be called
+           before the pin change interrupt is enabled */
+        void begin() { previous = port.read(); }
+
+        /* changed() should be called from the pin change ISR */
+        void changed()
+        {
+            uint8_t current = port.read();
+            uint8_t diff    = (current ^ previous) & MASK;
+            previous = current;
+
+            if (diff)
+            {
+                table::dispatch(processor, current, diff);
+            }
+        }
+
+    private:
+        PORT port;
+        EventProcessorInterface* processor;
+        uint8_t previous;   /* port value at the last interrupt */
+    };
+
+    /**********************************************************
+     *
+     * State machines
+     *
+     * StateMachine runs a hierarchical state machine that is
+     * described by two constant tables, which are placed in
+     * flash.  The only RAM it uses is the current state byte.
+     *
+     * The state table is indexed by state id.  Each state has a
+     * parent (SM_NONE at the top level), an initial child that
+     * is entered after it (SM_NONE for a leaf), and entry and
+     * exit actions (0 for none).
+     *
+     * The transition table is sorted by (state, event) at
+     * compile time, so an event is dispatched by a binary search
+     * for the current state and then for each of its ancestors,
+     * until a transition is found whose guard (0 for none)
+     * passes.  Transitions with the same state and event are
+     * tried in the order that they are declared.
+     *
+     * A transition exits up to the common ancestor of the state
+     * that handled the event and the target, runs its action,
+     * and enters down to the target and then its initial
+     * children.  A transition to the handling state itself exits
+     * and enters it again.  A target of SM_INTERNAL runs the
+     * action without leaving the state.
+     *
+     * The actions and guards are passed the event's argument.
+     * Events can be dispatched directly, queued on an
+     * EventProcessor with deliver() and smEvent(), or drained
+     * from a Channel by its consumer.
+     *
+     * Example:
+     *
+     *   struct Link
+     *   {
+     *       enum { IDLE, ONLINE, AUTH, READY };
+     *       enum { CONNECT, LOGIN, DROP };
+     *
+     *       static const uint8_t initial = IDLE;
+     *
+     *       static constexpr stedos::SmState states[] PROGMEM =
+     *       {
+     *           { stedos::SM_NONE, stedos::SM_NONE, 0,       0 },   // IDLE
+     *           { stedos::SM_NONE, AUTH,            online,  0 },   // ONLINE
+     *           { ONLINE,          stedos::SM_NONE, 0,       0 },   // AUTH
+     *           { ONLINE,          stedos::SM_NONE, 0,       0 },   // READY
+     *       };
+     *
+     *       static constexpr auto transitions PROGMEM = stedos::makeTransitions({
+     *           { IDLE,   CONNECT, 0,       0, ONLINE },
+     *           { AUTH,   LOGIN,   loginOk, 0, READY  },
+     *           { ONLINE, DROP,    0,       0, IDLE   },
+     *       });
+     *   };
+     *
+     *   constexpr stedos::SmState Link::states[];
+     *   constexpr decltype(Link::transitions) Link::transitions;
+     *
+     *   stedos::StateMachine<Link> link;
+     *
+     *   link.start();
+     *   queue.queueEvent(stedos::deliver<decltype(link), link>, stedos::smEvent(Link::CONNECT));
+     *
+     * Template Parameters:
+     *     DEF - class with the states, transitions and initial state
+     *   TRACE - class with static transition(from, event, to) and
+     *           unhandled(state, event) functions, e.g. for tests
+     *
+     **********************************************************/
+
+    enum sm_special
+    {
+        SM_NONE     = 0xff,     /* no parent, no initial child  */
+        SM_INTERNAL = 0xfe,     /* target: stay in the state    */
+    };
+
+    typedef bool (*sm_guard_t)(uintptr_t arg);
+
+    struct SmState
+    {
+        uint8_t      parent;
+        uint8_t      initial;
+        event_func_t entry;
+        event_func_t exit;
+    };
+
+    struct SmTransition
+    {
+        uint8_t      state;
+        uint8_t      event;
+        sm_guard_t   guard;
+        event_func_t action;
+        uint8_t      target;
+
+        constexpr uint16_t key() const { return ((uint16_t) state << 8) | event; }
+    };
+
+    template <int N>
+    struct SmTransitions
+    {
+        static_assert(N > 0, "");
+        static_assert(N <= 255, "");
+
+        SmTransition entries[N];
+
+        constexpr uint8_t size() const { return N; }
+
+        /* The key of entry idx */
+        uint16_t key(const uint8_t& idx) const
+        {
+            return ((uint16_t) _internal::flash_read(&entries[idx].state) << 8) |
+                   _internal::flash_read(&entries[idx].event);
+        }
+
+        /* The first entry with a key that isn't less than k */
+        uint8_t lowerBound(const uint16_t& k) const
+        {
+            uint8_t low = 0;
+            uint8_t n   = N;
+            while (n > 0)
+            {
+                uint8_t half = n / 2;
+                if (key(low + half) < k)
+                {
+                    low += half + 1;
+                    n   -= half + 1;
+                }
+                else
+                {
+                    n = half;
+                }
+            }
+            return low;
+        }
+    };
+
+    namespace _internal
+    {
+        struct transition_key
+        {
+            static constexpr uint16_t get(const SmTransition& t) { return t.key(); }
+        };
+
+        template <int N, int... I>
+        constexpr SmTransitions<N> make_transitions(const SmTransition (&t)[N], indices<I...>)
+        {
+            return SmTransitions<N> { { sort_select<transition_key, false>(t, I)... } };
+        }
+    }
+
+    /* Builds the sorted transition table */
+    template <int N>
+    constexpr SmTransitions<N> makeTransitions(const SmTransition (&transitions)[N])
+    {
+        return _internal::make_transitions(transitions, typename _internal::make_indices<N>::type());
+    }
+
+    struct SmNoTrace
+    {
+        static void transition(const uint8_t& from, const uint8_t& event, const uint8_t& to) {}
+        static void unhandled(const uint8_t& state, const uint8_t& event)                    {}
+    };
+
+    template <typename DEF, typename TRACE=SmNoTrace>
+    class StateMachine
+    {
+    public:
+        StateMachine() : current(SM_NONE) {};
+
+        /* Enters the initial state */
+        void start(const uintptr_t& arg=0)
+        {
+            current = enter(DEF::initial, SM_NONE, arg);
+            TRACE::transition(SM_NONE, SM_NONE, current);
+        }
+
+        uint8_t state() const { return current; }
+
+        /* Checks if s is the current state or one of its ancestors */
+        bool isIn(const uint8_t& s) const
+        {
+            for (uint8_t p = current; p != SM_NONE; p = parent(p))
+            {
+                if (p == s) return true;
+            }
+            return false;
+        }
+
+        /* Delivers an event.  Returns false if no state handled it */
+        bool dispatch(const uint8_t& event, const uintptr_t& arg=0)
+        {
+            for (uint8_t s = current; s != SM_NONE; s = parent(s))
+            {
+                uint16_t key = ((uint16_t) s << 8) | event;
+                for (uint8_t idx = DEF::transitions.lowerBound(key);
+                     (idx < DEF::transitions.size()) && (DEF::transitions.key(idx) == key);
+                     idx += 1)
+                {
+                    SmTransition t = _internal::flash_read(&DEF::transitions.entries[idx]);
+                    if (t.guard && !t.guard(arg)) continue;
+
+                    uint8_t from = current;
+                    if (t.target == SM_INTERNAL)
+                    {
+                        if (t.action) t.action(arg);
+                    }
+                    else
+                    {
+                        uint8_t top = (t.target == s) ? parent(s) : common(s, t.target);
+                        while (current != top)
+                        {
+                            event_func_t f = _internal::flash_read(&DEF::states[current].exit);
+                            if (f) f(arg);
+                            current = parent(current);
+                        }
+
+                        if (t.action) t.action(arg);
+                        current = enter(t.target, top, arg);
+                    }
+
+                    TRACE::transition(from, event, current);
+                    return true;
+                }
+            }
+
+            TRACE::unhandled(current, event);
+            return false;
+        }
+
+    private:
+        uint8_t current;
+
+        static uint8_t parent(const uint8_t& s) { return _internal::flash_read(&DEF::states[s].parent); }
+
+        static uint8_t depth(uint8_t s)
+        {
+            uint8_t d = 0;
+            for (; s != SM_NONE; s = parent(s)) d += 1;
+            return d;
+        }
+
+        /* The lowest common ancestor of a and b (one may be the other) */
+        static uint8_t common(uint8_t a, uint8_t b)
+        {
+            uint8_t da = depth(a);
+            uint8_t db = depth(b);
+            for (; da > db; da -= 1) a = parent(a);
+            for (; db > da; db -= 1) b = parent(b);
+            while (a != b)
+            {
+                a = parent(a);
+                b = parent(b);
+            }
+            return a;
+        }
+
+        /* Runs the entry actions from below top down to s */
+        static void enterFrom(const uint8_t& s, const uint8_t& top, const uintptr_t& arg)
+        {
+            if (s == top) return;
+            enterFrom(parent(s), top, arg);
+
+            event_func_t f = _internal::flash_read(&DEF::states[s].entry);
+            if (f) f(arg);
+        }
+
+        /* Enters s and then its initial children.  Returns the leaf */
+        static uint8_t enter(uint8_t s, const uint8_t& top, const uintptr_t& arg)
+        {
+            enterFrom(s, top, arg);
+            for (uint8_t child = _internal::flash_read(&DEF::states[s].initial);
+                 child != SM_NONE;
+                 child = _internal::flash_read(&DEF::states[s].initial))
+            {
+                s = child;
+                event_func_t f = _internal::flash_read(&DEF::states[s].entry);
+                if (f) f(arg);
+            }
+            return s;
+        }
+    };
+
+    /* Packs an event and its argument into Event data for deliver().
+       The argument keeps the bits above the event, 8 on the AVR */
+    constexpr uintptr_t smEvent(const uint8_t& event, const uintptr_t& arg=0)
+    {
+        return (arg << 8) | event;
+    }
+
+    /* An event function that dispatches the packed event to MACHINE */
+    template <typename SM, SM& MACHINE>
+    void deliver(uintptr_t data)
+    {
+        MACHINE.dispatch(data & 0xff, data >> 8);
+    }
+
+    /**********************************************************
+     *
+     * Formatted output
+     *
+     * print() writes text straight into a FIFO, such as a UART
+     * transmit buffer, without printf, a format string or a
+     * buffer on the stack.  The arguments are written in order
+     * and the conversion for each is picked from its type at
+     * compile time, so there is no format string to parse and
+     * only the conversions that are used get linked:
+     *
+     *   char, const char*      - the character or string
+     *   integers               - decimal
+     *   bool                   - 0 or 1
+     *   hex(v)                 - hex, 2 digits per byte of v
+     *   fixed<FRAC, DIGITS>(v) - v has FRAC fraction bits, shown
+     *                            rounded to DIGITS decimal places
+     *   flash(s)               - a string stored in PROGMEM
+     *
+     * Decimal conversion subtracts powers of 10, so no division
+     * is needed (the AVR has no divide instruction).
+     *
+     * Example:
+     *
+     *   stedos::FIFO<char, 64> out;
+     *   stedos::print(out, "t=", ticks, " v=", stedos::fixed<8, 2>(volts), '\n');
+     *
+     * Output stops at the first character that doesn't fit and
+     * print() returns false.
+     *
+     **********************************************************/
+
+    namespace _internal
+    {
+        template <bool B, typename T, typename F> struct select              { typedef T type; };
+        template <typename T, typename F>         struct select<false, T, F> { typedef F type; };
+
+        /* The unsigned type used to convert each integer type */
+        template <typename T> struct int_format;
+        template <> struct int_format<signed char>        { typedef unsigned char      type; static const bool SIGNED = true;  };
+        template <> struct int_format<unsigned char>      { typedef unsigned char      type; static const bool SIGNED = false; };
+        template <> struct int_format<short>              { typedef unsigned short     type; static const bool SIGNED = true;  };
+        template <> struct int_format<unsigned short>     { typedef unsigned short     type; static const bool SIGNED = false; };
+        template <> struct int_format<int>                { typedef unsigned int       type; static const bool SIGNED = true;  };
+        template <> struct int_format<unsigned int>       { typedef unsigned int       type; static const bool SIGNED = false; };
+        template <> struct int_format<long>               { typedef unsigned long      type; static const bool SIGNED = true;  };
+        template <> struct int_format<unsigned long>      { typedef unsigned long      type; static const bool SIGNED = false; };
+        template <> struct int_format<long long>          { typedef unsigned long long type; static const bool SIGNED = true;  };
+        template <> struct int_format<unsigned long long> { typedef unsigned long long type; static const bool SIGNED = false; };
+
+        /* The powers of 10 from the largest that fits in BYTES down
+           to 10.  The table is only in flash if that size is printed */
+        template <int BYTES> struct pow10;
+
+        template <> struct pow10<1>
+        {
+            static const uint8_t COUNT = 2;
+            static uint8_t at(const uint8_t& idx)
+            {
+                static const uint8_t table[COUNT] PROGMEM = { 100, 10 };
+                return flash_read(&table[idx]);
+            }
+        };
+
+        template <> struct pow10<2>
+        {
+            static const uint8_t COUNT = 4;
+            static uint16_t at(const uint8_t& idx)
+            {
+                static const uint16_t table[COUNT] PROGMEM = { 10000, 1000, 100, 10 };
+                return flash_read(&table[idx]);
+            }
+        };
+
+        template <> struct pow10<4>
+        {
+            static const uint8_t COUNT = 9;
+            static uint32_t at(const uint8_t& idx)
+            {
+                static const uint32_t table[COUNT] PROGMEM =
+                {
+                    1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+                    10000UL, 1000UL, 100UL, 10UL
+                };
+                return flash_read(&table[idx]);
+            }
+        };
+
+        template <> struct pow10<8>
+        {
+            static const uint8_t COUNT = 19;
+            static uint64_t at(const uint8_t& idx)
+            {
+                static const uint64_t table[COUNT] PROGMEM =
+                {
+                    10000000000000000000ULL, 1000000000000000000ULL, 100000000000000000ULL,
+                    10000000000000000ULL, 1000000000000000ULL, 100000000000000ULL,
+                    10000000000000ULL, 1000000000000ULL, 100000000000ULL, 10000000000ULL,
+                    1000000000ULL, 100000000ULL, 10000000ULL, 1000000ULL, 100000ULL,
+                    10000ULL, 1000ULL, 100ULL, 10ULL
+                };
+                return flash_read(&table[idx]);
+            }
+        };
+
+        template <typename OUT>
+        bool put_char(OUT& out, const char& c)
+        {
+            if (out.isFull()) return false;
+            out.push(c);
+            return true;
+        }
+
+        /* Writes v in decimal, without leading zeros */
+        template <typename OUT, typename U>
+        bool put_unsigned(OUT& out, U v)
+        {
+            typedef pow10<sizeof(U)> powers;
+            bool started = false;
+            for (uint8_t idx=0; idx<powers::COUNT; idx+=1)
+            {
+                U p = powers::at(idx);
+                char digit = '0';
+                while (v >= p)
+                {
+                    v -= p;
+                    digit += 1;
+                }
+                if (started || (digit != '0'))
+                {
+                    if (!put_char(out, digit)) return false;
+                    started = true;
+                }
+            }
+            return put_char(out, '0' + (char) v);
+        }
+
+        /* Writes the magnitude of v, with a '-' if it is negative.
+           The magnitude is found in the unsigned type, so the most
+           negative value is written correctly */
+        template <typename OUT, typename T>
+        bool put_signed(OUT& out, const T& v, typename int_format<T>::type& magnitude)
+        {
+            typedef typename int_format<T>::type U;
+            magnitude = (U) v;
+            if (int_format<T>::SIGNED && (v < 0))
+            {
+                magnitude = (U) 0 - magnitude;
+                return put_char(out, '-');
+            }
+            return true;
+        }
+
+        /* Converts one argument of print().  The conversion is
+           chosen by specialising on the argument type */
+        template <typename T>
+        struct formatter
+        {
+            template <typename OUT>
+            static bool put(OUT& out, const T& v)
+            {
+                typename int_format<T>::type magnitude;
+                return put_signed(out, v, magnitude) && put_unsigned(out, magnitude);
+            }
+        };
+
+        template <>
+        struct formatter<char>
+        {
+            template <typename OUT>
+            static bool put(OUT& out, const char& c) { return put_char(out, c); }
+        };
+
+        /* bool is printed as 0 or 1 */
+        template <>
+        struct formatter<bool>
+        {
+            template <typename OUT>
+            static bool put(OUT& out, const bool& b) { return put_char(out, b ? '1' : '0'); }
+        };
+
+        template <>
+        struct formatter<const char*>
+        {
+            template <typename OUT>
+            static bool put(OUT& out, const char* s)
+            {
+                while (*s)
+                {
+                    if (!put_char(out, *s++)) return false;
+                }
+                return true;
+            }
+        };
+
+        template <>
+        struct formatter<char*> : formatter<const char*> {};
+
+        template <typename OUT>
+        bool format(OUT&) { return true; }
+
+        template <typename OUT, typename T, typename... REST>
+        bool format(OUT& out, const T& v, const REST&... rest)
+        {
+            return formatter<T>::put(out, v) && format(out, rest...);
+        }
+    }
+
+    /* The value of hex(v) */
+    template <typename T>
+    struct HexFormat
+    {
+        T value;
+    };
+
+    /* Prints v in hex, with 2 digits per byte */
+    template <typename T>
+    HexFormat<T> hex(const T& v) { HexFormat<T> h = { v }; return h; }
+
+    /* The value of fixed<FRAC, DIGITS>(v) */
+    template <int FRAC, int DIGITS, typename T>
+    struct FixedFormat
+    {
+        T value;
+    };
+
+    /* Prints v, which has FRAC fraction bits, rounded to DIGITS decimal places */
+    template <int FRAC, int DIGITS, typename T>
+    FixedFormat<FRAC, DIGITS, T> fixed(const T& v) { FixedFormat<FRAC, DIGITS, T> f = { v }; return f; }
+
+    /* The value of flash(s) */
+    struct FlashString
+    {
+        const char* s;
+    };
+
+    /* Prints a string that is stored in PROGMEM */
+    inline FlashString flash(const char* s) { FlashString f = { s }; return f; }
+
+    namespace _internal
+    {
+        template <typename T>
+        struct formatter< HexFormat<T> >
+        {
+            template <typename OUT>
+            static bool put(OUT& out, const HexFormat<T>& h)
+            {
+                typedef typename int_format<T>::type U;
+                U v = (U) h.value;
+                for (int8_t shift=sizeof(T)*8-4; shift>=0; shift-=4)
+                {
+                    uint8_t n = (v >> shift) & 0xf;
+                    if (!put_char(out, (char) ((n < 10) ? ('0' + n) : ('a' - 10 + n)))) return false;
+                }
+                return true;
+            }
+        };
+
+        template <int FRAC, int DIGITS, typename T>
+        struct formatter< FixedFormat<FRAC, DIGITS, T> >
+        {
+            typedef typename int_format<T>::type U;
+
+            static_assert(FRAC > 0, "");
+            static_assert(FRAC < (int) sizeof(T) * 8, "");
+            static_assert(FRAC <= 28, "");
+            static_assert(DIGITS >= 0, "");
+
+            /* The fraction is multiplied by 10 for each digit, so it
+               needs 4 bits more than FRAC */
+            typedef typename select<(FRAC <= 12), uint16_t, uint32_t>::type F;
+
+            static const F ONE  = (F) 1 << FRAC;
+            static const F HALF = (F) 1 << (FRAC - 1);
+
+            template <typename OUT>
+            static bool put(OUT& out, const FixedFormat<FRAC, DIGITS, T>& x)
+            {
+                U magnitude;
+                if (!put_signed(out, x.value, magnitude)) return false;
+
+                U whole = magnitude >> FRAC;
+                F frac  = (F) (magnitude & (ONE - 1));
+
+                /* The digits are worked out before any are written,
+                   as rounding may carry into the whole part */
+                char digits[DIGITS + 1];
+                for (uint8_t idx=0; idx<DIGITS; idx+=1)
+                {
+                    frac *= 10;
+                    digits[idx] = '0' + (char) (frac >> FRAC);
+                    frac &= (ONE - 1);
+                }
+
+                if (frac >= HALF)
+                {
+                    int8_t idx = DIGITS - 1;
+                    while ((idx >= 0) && (digits[idx] == '9'))
+                    {
+                        digits[idx] = '0';
+                        idx -= 1;
+                    }
+                    if (idx >= 0) digits[idx] += 1;
+                    else          whole += 1;
+                }
+
+                if (!put_unsigned(out, whole)) return false;
+                if (DIGITS == 0) return true;
+                if (!put_char(out, '.')) return false;
+                for (uint8_t idx=0; idx<DIGITS; idx+=1)
+                {
+                    if (!put_char(out, digits[idx])) return false;
+                }
+                return true;
+            }
+        };
+
+        template <>
+        struct formatter<FlashString>
+        {
+            template <typename OUT>
+            static bool put(OUT& out, const FlashString& f)
+            {
+                const char* s = f.s;
+                char c;
+                while ((c = flash_read(s++)) != 0)
+                {
+                    if (!put_char(out, c)) return false;
+                }
+                return true;
+            }
+        };
+    }
+
+    /* Writes the arguments into out.  Arrays are passed by value
+       so that string literals decay to const char*.  Returns
+       false if out filled up */
+    template <typename T, int SIZE, typename... ARGS>
+    bool print(FIFO<T, SIZE>& out, ARGS... args)
+    {
+        return _internal::format(out, args...);
+    }
+
+    /**********************************************************
+     *
+     * Fixed point
+     *
+     * Fixed<INT, FRAC> is a signed number with INT integer bits
+     * (including the sign) and FRAC fraction bits, stored in 8,
+     * 16 or 32 bits.  Fixed<1, 15> is Q15 and Fixed<8, 8> is
+     * 8.8.  Arithmetic saturates instead of wrapping, and a
+     * multiply is rounded to the nearest.
+     *
+     * Multiplies widen the operands first, so 8 bit formats use
+     * the MULS instruction directly and 16 bit formats compile to
+     * the avr-gcc 16x16->32 helper, which is built from four
+     * hardware 8x8 multiplies.  No float code is linked unless a
+     * Fixed is made from a double at run time.
+     *
+     * The filters take one sample at a time with step(), or a
+     * whole block with process(), either in place in an array or
+     * from one FIFO to another:
+     *
+     *   MovingAverage<T, N>  - the mean of the last N samples
+     *   ExpSmoothing<T, S>   - y += (x - y) / 2^S
+     *   Biquad<T, C>         - a second order IIR section with
+     *                          coefficients of type C
+     *
+     * Example:
+     *
+     *   typedef stedos::Fixed<1, 15> q15;
+     *   stedos::Biquad<q15, stedos::Fixed<2, 14> > lowpass(b0, b1, b2, a1, a2);
+     *
+     *   lowpass.process(samples, filtered);    // FIFO to FIFO
+     *
+     **********************************************************/
+
+    namespace _internal
+    {
+        template <int BITS> struct fixed_types;
+        template <> struct fixed_types<8>  { typedef int8_t  raw; typedef int16_t wide; };
+        template <> struct fixed_types<16> { typedef int16_t raw; typedef int32_t wide; };
+        template <> struct fixed_types<32> { typedef int32_t raw; typedef int64_t wide; };
+
+        /* Clamps v to the range of T */
+        template <typename T, typename W>
+        T saturate(const W& v, const T& low, const T& high)
+        {
+            if (v > high) return high;
+            if (v < low)  return low;
+            return (T) v;
+        }
+
+        /* Shifts v right by n, rounding to the nearest */
+        template <typename W>
+        W round_shift(const W& v, const int& n)
+        {
+            return (n > 0) ? (W) ((v + ((W) 1 << (n - 1))) >> n) : v;
+        }
+    }
+
+    template <int INT, int FRAC>
+    class Fixed
+    {
+        static_assert(INT > 0, "the sign needs an integer bit");
+        static_assert(FRAC >= 0, "");
+
+    public:
+        typedef typename _internal::fixed_types<INT + FRAC>::raw  raw_type;
+        typedef typename _internal::fixed_types<INT + FRAC>::wide wide_type;
+
+        static const int INT_BITS  = INT;
+        static const int FRAC_BITS = FRAC;
+
+        static const raw_type MAX = (raw_type) (((wide_type) 1 << (INT + FRAC - 1)) - 1);
+        static const raw_type MIN = (raw_type) (-MAX - 1);
+
+        constexpr Fixed() : value(0) {};
+
+        /* Converts a double, rounding to the nearest.  This is free
+           when v is a constant, otherwise it links in float code */
+        explicit constexpr Fixed(const double& v) : value(from_double(v * ((wide_type) 1 << FRAC))) {};
+
+        static Fixed fromRaw(const raw_type& r) { Fixed f; f.value = r; return f; }
+
+        static Fixed fromInt(const int32_t& i)
+        {
+            if (i > (MAX >> FRAC)) return fromRaw(MAX);
+            if (i < (MIN >> FRAC)) return fromRaw(MIN);
+            return fromRaw((raw_type) (i * ((wide_type) 1 << FRAC)));
+        }
+
+        raw_type raw() const { return value; }
+
+        /* The integer part, rounded down */
+        int32_t toInt() const { return value >> FRAC; }
+
+        double toDouble() const { return (double) value / ((wide_type) 1 << FRAC); }
+
+        Fixed operator + (const Fixed& b) const { return fromRaw(_internal::saturate<raw_type>((wide_type) value + b.value, MIN, MAX)); }
+        Fixed operator - (const Fixed& b) const { return fromRaw(_internal::saturate<raw_type>((wide_type) value - b.value, MIN, MAX)); }
+        Fixed operator - () const               { return fromRaw(_internal::saturate<raw_type>(-(wide_type) value, MIN, MAX)); }
+
+        Fixed operator * (const Fixed& b) const
+        {
+            wide_type p = (wide_type) value * b.value;
+            return fromRaw(_internal::saturate<raw_type>(_internal::round_shift(p, FRAC), MIN, MAX));
+        }
+
+        Fixed& operator += (const Fixed& b) { return *this = *this + b; }
+        Fixed& operator -= (const Fixed& b) { return *this = *this - b; }
+        Fixed& operator *= (const Fixed& b) { return *this = *this * b; }
+
+        bool operator == (const Fixed& b) const { return value == b.value; }
+        bool operator != (const Fixed& b) const { return value != b.value; }
+        bool operator <  (const Fixed& b) const { return value <  b.value; }
+        bool operator <= (const Fixed& b) const { return value <= b.value; }
+        bool operator >  (const Fixed& b) const { return value >  b.value; }
+        bool operator >= (const Fixed& b) const { return value >= b.value; }
+
+    private:
+        raw_type value;
+
+        static constexpr raw_type from_double(const double& v)
+        {
+            return (v >= (double) MAX) ? MAX :
+                   (v <= (double) MIN) ? MIN :
+                   (raw_type) ((v >= 0) ? (v + 0.5) : (v - 0.5));
+        }
+    };
+
+    template <int INT, int FRAC> const int Fixed<INT, FRAC>::INT_BITS;
+    template <int INT, int FRAC> const int Fixed<INT, FRAC>::FRAC_BITS;
+    template <int INT, int FRAC> const typename Fixed<INT, FRAC>::raw_type Fixed<INT, FRAC>::MAX;
+    template <int INT, int FRAC> const typename Fixed<INT, FRAC>::raw_type Fixed<INT, FRAC>::MIN;
+
+    /* Prints a Fixed rounded to DIGITS decimal places, e.g. fixed<2>(x) */
+    template <int DIGITS, int INT, int FRAC>
+    FixedFormat<FRAC, DIGITS, typename Fixed<INT, FRAC>::raw_type> fixed(const Fixed<INT, FRAC>& v)
+    {
+        return fixed<FRAC, DIGITS>(v.raw());
+    }
+
+    namespace _internal
+    {
+        /* Gives a filter, which has step(), the block versions */
+        template <typename FILTER, typename T>
+        struct block_filter
+        {
+            /* Filters n samples in place */
+            void process(T* samples, const uint16_t& n)
+            {
+                FILTER& f = static_cast<FILTER&>(*this);
+                for (uint16_t idx=0; idx<n; idx+=1) samples[idx] = f.step(samples[idx]);
+            }
+
+            /* Filters the samples in in, until it is empty or out is
+               full.  Returns the number of samples filtered */
+            template <int IN, int OUT>
+            uint16_t process(FIFO<T, IN>& in, FIFO<T, OUT>& out)
+            {
+                FILTER& f = static_cast<FILTER&>(*this);
+                uint16_t done  = 0;
+                uint8_t  space = OUT - 1 - out.count();
+                const T* run;
+                uint8_t  n;
+                while ((space > 0) && ((n = in.contiguous(run)) > 0))
+                {
+                    if (n > space) n = space;
+                    for (uint8_t idx=0; idx<n; idx+=1) out.push(f.step(run[idx]));
+                    in.drop(n);
+                    space -= n;
+                    done  += n;
+                }
+                return done;
+            }
+        };
+    }
+
+    template <typename T, int N>
+    class MovingAverage : public _internal::block_filter<MovingAverage<T, N>, T>
+    {
+        static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+        static_assert((N > 1) && (N <= 128), "");
+
+        typedef typename T::wide_type wide_type;
+
+    public:
+        MovingAverage() : sum(0), next(0) {};
+
+        /* The window starts full of zeros */
+        T step(const T& x)
+        {
+            sum += (wide_type) x.raw() - window[next].raw();
+            window[next] = x;
+            next = (next + 1) & (N - 1);
+            return T::fromRaw(_internal::round_shift(sum, _internal::ilog2(N)));
+        }
+
+    private:
+        T         window[N];
+        wide_type sum;
+        uint8_t   next;
+    };
+
+    template <typename T, int SHIFT>
+    class ExpSmoothing : public _internal::block_filter<ExpSmoothing<T, SHIFT>, T>
+    {
+        static_assert((SHIFT > 0) && (SHIFT < 16), "");
+
+        typedef typename T::wide_type wide_type;
+
+    public:
+        ExpSmoothing() : acc(0) {};
+
+        /* Starts the output at v */
+        void reset(const T& v) { acc = (wide_type) v.raw() << SHIFT; }
+
+        T step(const T& x)
+        {
+            /* acc is the output with SHIFT more fraction bits, so the
+               small steps aren't lost */
+            acc += (wide_type) x.raw() - _internal::round_shift(acc, SHIFT);
+            return T::fromRaw(_internal::round_shift(acc, SHIFT));
+        }
+
+    private:
+        wide_type acc;
+    };
+
+    template <typename T, typename C=T>
+    class Biquad : public _internal::block_filter<Biquad<T, C>, T>
+    {
+        /* Each product has raw + coefficient bits, and the sum of
+           five of them needs 3 more */
+        typedef typename _internal::select<(8 * (sizeof(typename T::raw_type) + sizeof(typename C::raw_type)) + 3 <= 32),
+                                           int32_t, int64_t>::type wide_type;
+
+    public:
+        /* y = b0 x + b1 x[-1] + b2 x[-2] - a1 y[-1] - a2 y[-2] */
+        Biquad(const C& b0, const C& b1, const C& b2, const C& a1, const C& a2)
+        {
+            b[0] = b0; b[1] = b1; b[2] = b2;
+            a[0] = a1; a[1] = a2;
+            reset();
+        }
+
+        void reset()
+        {
+            x[0] = x[1] = 0;
+            y[0] = y[1] = 0;
+        }
+
+        /* Direct form I.  The products are summed at full precision
+           and rounded once */
+        T step(const T& in)
+        {
+            wide_type acc = (wide_type) b[0].raw() * in.raw()
+                          + (wide_type) b[1].raw() * x[0]
+                          + (wide_type) b[2].raw() * x[1]
+                          - (wide_type) a[0].raw() * y[0]
+                          - (wide_type) a[1].raw() * y[1];
+
+            typename T::raw_type out = _internal::saturate<typename T::raw_type>(
+                _internal::round_shift(acc, C::FRAC_BITS), T::MIN, T::MAX);
+
+            x[1] = x[0];
+            x[0] = in.raw();
+            y[1] = y[0];
+            y[0] = out;
+            return T::fromRaw(out);
+        }
+
+    private:
+        C b[3];
+        C a[2];
+        typename T::raw_type x[2];    /* the last two inputs  */
+        typename T::raw_type y[2];    /* the last two outputs */
+    };
+
+    /**********************************************************
+     *
+     * UART
+     *
+     * Uart is a buffered, interrupt driven driver for the AVR
+     * USARTs.  The receive ISR writes straight into a FIFO and
+     * the data register empty ISR feeds the transmitter straight
+     * from a FIFO, so no event is queued per byte.
+     *
+     * The receive event is only queued on the triggers that are
+     * enabled.  Its data is the trigger that fired:
+     *
+     *   UART_TRIGGER_TERMINATOR - the terminator byte was received
+     *   UART_TRIGGER_WATERMARK  - the buffer reached the watermark
+     *   UART_TRIGGER_IDLE       - no byte for the idle timeout
+     *
+     * Example:
+     *
+     *   stedos::Uart<0, 64, 64> uart(&queue, line_received);
+     *
+     *   uart.setTerminator('\n');
+     *   uart.begin(1);                  // 1 Mbaud at 16 MHz
+     *
+     *   ISR(USART_RX_vect)   { uart.rxInterrupt(); }
+     *   ISR(USART_UDRE_vect) { uart.txInterrupt(); }
+     *
+     * Template Parameters:
+     *        N - USART number
+     *   RXSIZE - receive buffer size (holds RXSIZE - 1 bytes)
+     *   TXSIZE - transmit buffer size (holds TXSIZE - 1 bytes)
+     *
+     **********************************************************/
+
+    enum uart_trigger
+    {
+        UART_TRIGGER_TERMINATOR = 0x01,
+        UART_TRIGGER_WATERMARK  = 0x02,
+        UART_TRIGGER_IDLE       = 0x04
+    };
+
+    namespace _internal
+    {
+        struct usart_registers
+        {
+            STEDOS_REGISTER* const udr;
+            STEDOS_REGISTER* const ucsra;
+            STEDOS_REGISTER* const ucsrb;
+            STEDOS_REGISTER* const ucsrc;
+            STEDOS_REGISTER* const ubrrl;
+            STEDOS_REGISTER* const ubrrh;
+        };
+
+        const usart_registers usart_table[] =
+        {
+            #ifdef UDR0
+                { &UDR0, &UCSR0A, &UCSR0B, &UCSR0C, &UBRR0L, &UBRR0H },
+            #else
+                { 0, 0, 0, 0, 0, 0 },
+            #endif
+            #ifdef UDR1
+                { &UDR1, &UCSR1A, &UCSR1B, &UCSR1C, &UBRR1L, &UBRR1H },
+            #else
+                { 0, 0, 0, 0, 0, 0 },
+            #endif
+            #ifdef UDR2
+                { &UDR2, &UCSR2A, &UCSR2B, &UCSR2C, &UBRR2L, &UBRR2H },
+            #else
+                { 0, 0, 0, 0, 0, 0 },
+            #endif
+            #ifdef UDR3
+                { &UDR3, &UCSR3A, &UCSR3B, &UCSR3C, &UBRR3L, &UBRR3H },
+            #else
+                { 0, 0, 0, 0, 0, 0 },
+            #endif
+        };
+    }
+
+    #ifdef UDR0
+
+    template <int N, int RXSIZE, int TXSIZE>
+    class Uart
+    {
+        static_assert(N < 4, "");
+
+        /* All of the USARTs use the same bit positions as USART 0 */
+        static const _internal::usart_registers& regs() { return _internal::usart_table[N]; }
+
+    public:
+        /* Constructor.  func is queued when a receive trigger fires */
+        Uart(EventProcessorInterface* p, event_func_t func)
+            : processor(p), receiveEvent(func), triggers(0),
+              terminator(0), watermark(0), idleTicks(0), idle(0), errors(0) {};
+
+        /* Queues the receive event when c is received */
+        void setTerminator(const uint8_t& c) { terminator = c; triggers |= UART_TRIGGER_TERMINATOR; }
+
+        /* Queues the receive event when the buffer holds count bytes */
+        void setWatermark(const uint8_t& count) { watermark = count; triggers |= UART_TRIGGER_WATERMARK; }
+
+        /* Queues the receive event when no byte has arrived for ticks
+           calls to tick().  tick() should be called from a timer ISR */
+        void setIdleTimeout(const uint8_t& ticks) { idleTicks = ticks; triggers |= UART_TRIGGER_IDLE; }
+
+        /* Starts the USART with the baud rate register value ubrr.
+           With doubleSpeed, the baud rate is F_CPU / (8 * (ubrr + 1)),
+           otherwise F_CPU / (16 * (ubrr + 1)).  Frames are 8N1 */
+        void begin(const uint16_t& ubrr, const bool& doubleSpeed=true)
+        {
+            *regs().ubrrh = ubrr >> 8;
+            *regs().ubrrl = ubrr & 0xff;
+            *regs().ucsra = doubleSpeed ? _BV(U2X0) : 0;
+            *regs().ucsrc = _BV(UCSZ01) | _BV(UCSZ00);
+            *regs().ucsrb = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+        }
+
+        /* Queues a byte for transmission.  Returns false if the buffer is full */
+        bool write(const uint8_t& c)
+        {
+            if (tx.isFull()) return false;
+            tx.push(c);
+            auto a = Atomic();
+            *regs().ucsrb |= _BV(UDRIE0);
+            return true;
+        }
+
+        /* Queues a string.  Returns the number of bytes queued */
+        uint8_t write(const char* s)
+        {
+            uint8_t n = 0;
+            while (*s && write(*s++)) n += 1;
+            return n;
+        }
+
+        /* Queues formatted text, see print().  Returns false if
+           the buffer filled up */
+        template <typename... ARGS>
+        bool print(ARGS... args)
+        {
+            bool ok = stedos::print(tx, args...);
+            auto a = Atomic();
+            *regs().ucsrb |= _BV(UDRIE0);
+            return ok;
+        }
+
+        /* Reads a received byte.  Returns false if there are none */
+        bool read(uint8_t& c)
+        {
+            if (rx.isEmpty()) return false;
+            c = rx.pop();
+            return true;
+        }
+
+        /* Number of received bytes waiting to be read */
+        uint8_t available() { return rx.count(); }
+
+        /* Bytes lost to hardware overruns, framing errors or a full buffer */
+        uint8_t errorCount() const { return errors; }
+
+        /* Should be called from the receive complete ISR */
+        void rxInterrupt()
+        {
+            uint8_t status = *regs().ucsra;
+            uint8_t c      = *regs().udr;
+
+            if (status & (_BV(DOR0) | _BV(FE0)))
+            {
+                count_error();
+                if (status & _BV(FE0)) return;
+            }
+
+            if (rx.isFull())
+            {
+                count_error();
+                return;
+            }
+            rx.push(c);
+            idle = idleTicks;
+
+            if ((triggers & UART_TRIGGER_TERMINATOR) && (c == terminator))
+            {
+                processor->queueEvent(receiveEvent, UART_TRIGGER_TERMINATOR);
+            }
+            else if ((triggers & UART_TRIGGER_WATERMARK) && (rx.count() == watermark))
+            {
+                processor->queueEvent(receiveEvent, UART_TRIGGER_WATERMARK);
+            }
+        }
+
+        /* Should be called from the data register empty ISR */
+        void txInterrupt()
+        {
+            if (tx.isEmpty())
+            {
+                *regs().ucsrb &= ~_BV(UDRIE0);
+            }
+            else
+            {
+                *regs().udr = tx.pop();
+            }
+        }
+
+        /* Should be called from a timer ISR if the idle trigger is used */
+        void tick()
+        {
+            if (idle > 0)
+            {
+                idle -= 1;
+                if (idle == 0)
+                {
+                    processor->queueEvent(receiveEvent, UART_TRIGGER_IDLE);
+                }
+            }
+        }
+
+    private:
+        FIFO<uint8_t, RXSIZE> rx;
+        FIFO<uint8_t, TXSIZE> tx;
+
+        EventProcessorInterface* processor;
+        event_func_t receiveEvent;
+
+        uint8_t triggers;       /* uart_trigger bits that are enabled     */
+        uint8_t terminator;
+        uint8_t watermark;
+        uint8_t idleTicks;
+        volatile uint8_t idle;  /* ticks left before the idle trigger     */
+        uint8_t errors;
+
+        void count_error() { if (errors < 0xff) errors += 1; }
+    };
+
+    #endif
+
+    /**********************************************************
+     *
+     * CRC
+     *
+     * Crc<POLY, WIDTH, REFLECT, INIT, XOROUT> calculates any CRC
+     * of 8 to 32 bits with the same input and output reflection
+     * (which covers the common ones, see the typedefs below).
+     * The parameters are as given in the usual CRC catalogues.
+     *
+     * The lookup table is worked out by the compiler and stored
+     * in flash.  The TABLE policy trades size for speed:
+     *
+     *   CrcBitwise      - 2 entries, a step per bit
+     *   CrcNibbleTable  - 16 entries, a step per 4 bits
+     *   CrcFullTable    - 256 entries, a step per byte
+     *
+     * Example:
+     *
+     *   stedos::Crc32<> crc;
+     *   crc.update(data, n);
+     *
+     *   const uint8_t* run;
+     *   uint8_t count;
+     *   while ((count = fifo.contiguous(run)) > 0)
+     *   {
+     *       crc.update(run, count);
+     *       fifo.drop(count);
+     *   }
+     *   uint32_t result = crc.value();
+     *
+     **********************************************************/
+
+    struct CrcBitwise     { static const uint8_t BITS = 1; };
+    struct CrcNibbleTable { static const uint8_t BITS = 4; };
+    struct CrcFullTable   { static const uint8_t BITS = 8; };
+
+    namespace _internal
+    {
+        /* Reverses the order of the lowest n bits of v */
+        constexpr uint32_t reflect_bits(const uint32_t& v, const int& n, const uint32_t& r=0)
+        {
+            return (n == 0) ? r : reflect_bits(v >> 1, n - 1, (r << 1) | (v & 1));
+        }
+
+        /* Shifts n bits through the CRC register */
+        template <typename T, int WIDTH, bool REFLECT>
+        constexpr T crc_shift(const T& crc, const int& n, const T& poly)
+        {
+            return (n == 0) ? crc : crc_shift<T, WIDTH, REFLECT>(
+                REFLECT ? ((crc & 1) ? (T) ((crc >> 1) ^ poly) : (T) (crc >> 1))
+                        : ((crc >> (WIDTH - 1)) & 1) ? (T) (((uint32_t) crc << 1) ^ poly)
+                                                     : (T) ((uint32_t) crc << 1),
+                n - 1, poly) & (T) (0xffffffffUL >> (32 - WIDTH));
+        }
+
+        /* The table for BITS bits at a time */
+        template <typename T, uint32_t POLY, int WIDTH, bool REFLECT, int BITS, typename I>
+        struct crc_table;
+
+        template <typename T, uint32_t POLY, int WIDTH, bool REFLECT, int BITS, int... I>
+        struct crc_table<T, POLY, WIDTH, REFLECT, BITS, indices<I...> >
+        {
+            static constexpr T entry(const int& i)
+            {
+                return REFLECT ? crc_shift<T, WIDTH, true>((T) i, BITS, (T) reflect_bits(POLY, WIDTH))
+                               : crc_shift<T, WIDTH, false>((T) ((uint32_t) i << (WIDTH - BITS)), BITS, (T) POLY);
+            }
+
+            static constexpr T values[sizeof...(I)] PROGMEM = { entry(I)... };
+        };
+
+        template <typename T, uint32_t POLY, int WIDTH, bool REFLECT, int BITS, int... I>
+        constexpr T crc_table<T, POLY, WIDTH, REFLECT, BITS, indices<I...> >::values[sizeof...(I)];
+    }
+
+    template <uint32_t POLY, int WIDTH, bool REFLECT, uint32_t INIT, uint32_t XOROUT, typename TABLE=CrcFullTable>
+    class Crc
+    {
+        static_assert((WIDTH >= 8) && (WIDTH <= 32), "");
+
+        static const uint8_t BITS = TABLE::BITS;
+
+    public:
+        /* The smallest type that holds the CRC */
+        typedef typename _internal::select<(WIDTH <= 8), uint8_t,
+                typename _internal::select<(WIDTH <= 16), uint16_t, uint32_t>::type>::type value_type;
+
+    private:
+        typedef _internal::crc_table<value_type, POLY, WIDTH, REFLECT, BITS,
+                                     typename _internal::make_indices<1 << BITS>::type> table;
+
+        static const value_type MASK  = (value_type) (0xffffffffUL >> (32 - WIDTH));
+        static const value_type START = (value_type) (REFLECT ? _internal::reflect_bits(INIT, WIDTH) : INIT);
+
+    public:
+        Crc() : crc(START) {};
+
+        /* Starts again */
+        void reset() { crc = START; }
+
+        /* Adds a byte */
+        Crc& update(const uint8_t& b)
+        {
+            if (REFLECT)
+            {
+                for (uint8_t shift=0; shift<8; shift+=BITS)
+                {
+                    crc = lookup((crc ^ (b >> shift)) & ((1 << BITS) - 1)) ^ (crc >> BITS);
+                }
+            }
+            else
+            {
+                for (int8_t shift=8-BITS; shift>=0; shift-=BITS)
+                {
+                    uint8_t idx = ((crc >> (WIDTH - BITS)) ^ (b >> shift)) & ((1 << BITS) - 1);
+                    crc = (lookup(idx) ^ ((uint32_t) crc << BITS)) & MASK;
+                }
+            }
+            return *this;
+        }
+
+        /* Adds n bytes */
+        Crc& update(const uint8_t* p, uint16_t n)
+        {
+            while (n > 0)
+            {
+                update(*p++);
+                n -= 1;
+            }
+            return *this;
+        }
+
+        /* The CRC of the bytes added so far */
+        value_type value() const { return crc ^ (value_type) XOROUT; }
+
+        /* The CRC of n bytes */
+        static value_type compute(const uint8_t* p, const uint16_t& n)
+        {
+            Crc c;
+            return c.update(p, n).value();
+        }
+
+    private:
+        value_type crc;
+
+        static value_type lookup(const uint8_t& idx) { return _internal::flash_read(&table::values[idx]); }
+    };
+
+    /* Common CRCs, named as in the catalogues */
+    template <typename TABLE=CrcFullTable> using Crc8        = Crc<0x07,       8,  false, 0x00,       0x00,       TABLE>;
+    template <typename TABLE=CrcFullTable> using Crc8Maxim   = Crc<0x31,       8,  true,  0x00,       0x00,       TABLE>;
+    template <typename TABLE=CrcFullTable> using Crc16Ccitt  = Crc<0x1021,     16, false, 0xffff,     0x0000,     TABLE>;
+    template <typename TABLE=CrcFullTable> using Crc16Xmodem = Crc<0x1021,     16, false, 0x0000,     0x0000,     TABLE>;
+    template <typename TABLE=CrcFullTable> using Crc16Kermit = Crc<0x1021,     16, true,  0x0000,     0x0000,     TABLE>;
+    template <typename TABLE=CrcFullTable> using Crc16Modbus = Crc<0x8005,     16, true,  0xffff,     0x0000,     TABLE>;
+    template <typename TABLE=CrcFullTable> using Crc32       = Crc<0x04c11db7, 32, true,  0xffffffff, 0xffffffff, TABLE>;
+    template <typename TABLE=CrcFullTable> using Crc32c      = Crc<0x1edc6f41, 32, true,  0xffffffff, 0xffffffff, TABLE>;
+
+    /**********************************************************
+     *
+     * Framing
+     *
+     * Frames are sent as the payload followed by a CRC-16/CCITT
+     * (big endian), encoded with COBS or SLIP so that the frame
+     * delimiter never appears inside a frame.
+     *
+     * FrameDecoder decodes one byte at a time, so it can be fed
+     * from the receive ISR or from a FIFO.  It queues one event
+     * per complete frame with a good CRC.  The event data is a
+     * pointer to the Frame, which must be given back with
+     * release() when the handler has finished with it.  There
+     * are two frame buffers, so the next frame can be received
+     * while one is being handled.
+     *
+     * FrameEncoder produces the encoded bytes one at a time from
+     * the caller's payload, so no second frame buffer is needed
+     * and it can feed the transmitter directly.
+     *
+     * Example:
+     *
+     *   stedos::FrameDecoder<stedos::Cobs, 32> decoder(&queue, frame_received);
+     *
+     *   ISR(USART_RX_vect) { decoder.push(UDR0); }
+     *
+     *   void frame_received(uintptr_t data)
+     *   {
+     *       const stedos::Frame<32>* f = (const stedos::Frame<32>*) data;
+     *       ... use f->data and f->length ...
+     *       decoder.release(f);
+     *   }
+     *
+     **********************************************************/
+
+    namespace _internal
+    {
+        /* CRC-16/CCITT (poly 0x1021, not reflected) for one byte */
+        inline uint16_t crc16_ccitt(uint16_t crc, const uint8_t& b)
+        {
+            crc  = (crc >> 8) | (crc << 8);
+            crc ^= b;
+            crc ^= (crc & 0xff) >> 4;
+            crc ^= crc << 12;
+            crc ^= (crc & 0xff) << 5;
+            return crc;
+        }
+
+        const uint16_t CRC16_INIT = 0xffff;
+
+        /* The bytes of a frame to encode: the payload and its CRC */
+        struct frame_source
+        {
+            const uint8_t* data;
+            uint8_t        length;
+            uint16_t       crc;
+
+            uint16_t size() const { return length + 2; }
+
+            uint8_t at(const uint16_t& idx) const
+            {
+                if (idx < length)  return data[idx];
+                if (idx == length) return crc >> 8;
+                return crc & 0xff;
+            }
+        };
+    }
+
+    /* Results of decoding a byte */
+    enum frame_result
+    {
+        FRAME_NONE,     /* byte consumed, nothing to output */
+        FRAME_BYTE,     /* out holds a decoded byte         */
+        FRAME_END,      /* end of frame                     */
+        FRAME_ERROR,    /* the frame is corrupt             */
+        FRAME_BAD_END   /* end of a frame that is corrupt   */
+    };
+
+    /* Consistent Overhead Byte Stuffing.  0x00 ends a frame */
+    struct Cobs
+    {
+        class Decoder
+        {
+        public:
+            Decoder() { reset(); }
+            void reset() { remaining = 0; zero = false; }
+
+            uint8_t decode(const uint8_t& in, uint8_t& out)
+            {
+                if (in == 0)
+                {
+                    return (remaining == 0) ? FRAME_END : FRAME_BAD_END;
+                }
+                if (remaining > 0)
+                {
+                    remaining -= 1;
+                    out = in;
+                    return FRAME_BYTE;
+                }
+
+                /* in is a code byte, starting a new block.  The block
+                   before it ended with a zero unless it was full */
+                bool emit = zero;
+                remaining = in - 1;
+                zero      = (in != 0xff);
+                if (emit)
+                {
+                    out = 0;
+                    return FRAME_BYTE;
+                }
+                return FRAME_NONE;
+            }
+
+        private:
+            uint8_t remaining;  /* data bytes left in this block       */
+            bool    zero;       /* a zero follows the current block    */
+        };
+
+        class Encoder
+        {
+        public:
+            void start() { pos = 0; end = 0; code = 0; inBlock = false; done = false; }
+
+            bool next(const _internal::frame_source& src, uint8_t& out)
+            {
+                if (done) return false;
+
+                if (inBlock)
+                {
+                    if (pos < end)
+                    {
+                        out = src.at(pos++);
+                        return true;
+                    }
+
+                    /* skip the zero that ended the block */
+                    if (code != 0xff) pos += 1;
+                    inBlock = false;
+                }
+
+                if (pos > src.size())
+                {
+                    out  = 0;
+                    done = true;
+                    return true;
+                }
+
+                /* Start a block: find the next zero, the end of
+                   the frame, or 254 bytes */
+                uint8_t len = 0;
+                while ((len < 0xfe) && ((uint16_t) (pos + len) < src.size()) && (src.at(pos + len) != 0))
+                {
+                    len += 1;
+                }
+                code    = len + 1;
+                end     = pos + len;
+                inBlock = true;
+                out     = code;
+                return true;
+            }
+
+        private:
+            uint16_t pos;       /* next byte of the source   */
+            uint16_t end;       /* end of the current block  */
+            uint8_t  code;
+            bool     inBlock;
+            bool     done;
+        };
+    };
+
+    /* Serial Line IP framing.  0xc0 ends a frame */
+    struct Slip
+    {
+        static const uint8_t END     = 0xc0;
+        static const uint8_t ESC     = 0xdb;
+        static const uint8_t ESC_END = 0xdc;
+        static const uint8_t ESC_ESC = 0xdd;
+
+        class Decoder
+        {
+        public:
+            Decoder() { reset(); }
+            void reset() { escaped = false; }
+
+            uint8_t decode(const uint8_t& in, uint8_t& out)
+            {
+                if (in == END)
+                {
+                    bool e = escaped;
+                    escaped = false;
+                    return e ? FRAME_BAD_END : FRAME_END;
+                }
+                if (escaped)
+                {
+                    escaped = false;
+                    if (in == ESC_END) { out = END; return FRAME_BYTE; }
+                    if (in == ESC_ESC) { out = ESC; return FRAME_BYTE; }
+                    return FRAME_ERROR;
+                }
+                if (in == ESC)
+                {
+                    escaped = true;
+                    return FRAME_NONE;
+                }
+                out = in;
+                return FRAME_BYTE;
+            }
+
+        private:
+            bool escaped;
+        };
+
+        class Encoder
+        {
+        public:
+            void start() { pos = 0; pending = 0; done = false; }
+
+            bool next(const _internal::frame_source& src, uint8_t& out)
+            {
+                if (pending)
+                {
+                    out = pending;
+                    pending = 0;
+                    return true;
+                }
+                if (done) return false;
+
+                if (pos == src.size())
+                {
+                    out  = END;
+                    done = true;
+                    return true;
+                }
+
+                uint8_t b = src.at(pos++);
+                if      (b == END) { out = ESC; pending = ESC_END; }
+                else if (b == ESC) { out = ESC; pending = ESC_ESC; }
+                else               { out = b; }
+                return true;
+            }
+
+        private:
+            uint16_t pos;
+            uint8_t  pending;   /* second byte of an escape, or 0 */
+            bool     done;
+        };
+    };
+
+    /* A received frame.  data also holds the CRC, which is not
+       included in length */
+    template <int MAXFRAME>
+    struct Frame
+    {
+        uint8_t length;
+        uint8_t data[MAXFRAME + 2];
+    };
+
+    template <typename CODEC, int MAXFRAME>
+    class FrameDecoder
+    {
+        static_assert(MAXFRAME > 0, "");
+        static_assert(MAXFRAME <= 253, "");
+
+    public:
+        typedef Frame<MAXFRAME> frame_t;
+
+        FrameDecoder(EventProcessorInterface* p, event_func_t func)
+            : processor(p), frameEvent(func), filling(0), length(0),
+              crc(_internal::CRC16_INIT), discarding(false), errors(0)
+        {
+            busy[0] = 0;
+            busy[1] = 0;
+        }
+
+        /* Decodes one received byte.  Call this from one context only,
+           e.g. the receive ISR */
+        void push(const uint8_t& in)
+        {
+            uint8_t out = 0;
+            uint8_t result = codec.decode(in, out);
+
+            if (result == FRAME_END)
+            {
+                finish();
+            }
+            else if (result == FRAME_BAD_END)
+            {
+                discarding = true;
+                finish();
+            }
+            else if (result == FRAME_ERROR)
+            {
+                discarding = true;
+            }
+            else if (result == FRAME_BYTE)
+            {
+                if (busy[filling] || (length == MAXFRAME + 2))
+                {
+                    discarding = true;
+                }
+                else
+                {
+                    frames[filling].data[length++] = out;
+                    crc = _internal::crc16_ccitt(crc, out);
+                }
+            }
+        }
+
+        /* Decodes all of the bytes in a FIFO */
+        template <int SIZE>
+        void push(FIFO<uint8_t, SIZE>& fifo)
+        {
+            while (fifo.isEmpty() == false) push(fifo.pop());
+        }
+
+        /* Gives a frame back once its event has been handled */
+        void release(const frame_t* f)
+        {
+            busy[(f == &frames[0]) ? 0 : 1] = 0;
+        }
+
+        /* Frames dropped for a bad CRC, bad encoding or no free buffer */
+        uint8_t errorCount() const { return errors; }
+
+    private:
+        typename CODEC::Decoder codec;
+        frame_t        frames[2];
+        volatile uint8_t busy[2];   /* frame is waiting for release() */
+
+        EventProcessorInterface* processor;
+        event_func_t frameEvent;
+
+        uint8_t  filling;       /* frame being received         */
+        uint8_t  length;        /* bytes received, with the CRC */
+        uint16_t crc;
+        bool     discarding;    /* drop bytes until the next end */
+        uint8_t  errors;
+
+        void finish()
+        {
+            /* The CRC of a frame including its own CRC is 0 */
+            if (discarding || (length > 0 && ((length < 2) || (crc != 0))))
+            {
+                if (errors < 0xff) errors += 1;
+            }
+            else if (length > 0)
+            {
+                frames[filling].length = length - 2;
+                busy[filling] = 1;
+                processor->queueEvent(frameEvent, (uintptr_t) &frames[filling]);
+                filling ^= 1;
+            }
+
+            length     = 0;
+            crc        = _internal::CRC16_INIT;
+            discarding = false;
+            codec.reset();
+        }
+    };
+
+    template <typename CODEC>
+    class FrameEncoder
+    {
+    public:
+        /* Starts encoding a payload.  data must not change until
+           next() returns false */
+        void start(const uint8_t* data, const uint8_t& n)
+        {
+            uint16_t c = _internal::CRC16_INIT;
+            for (uint8_t idx=0; idx<n; idx+=1) c = _internal::crc16_ccitt(c, data[idx]);
+
+            src.data   = data;
+            src.length = n;
+            src.crc    = c;
+            codec.start();
+        }
+
+        /* Gets the next encoded byte.  Returns false at the end of the frame */
+        bool next(uint8_t& out) { return codec.next(src, out); }
+
+        /* Encodes the whole frame through put().  Returns the encoded length */
+        uint16_t encode(const uint8_t* data, const uint8_t& n, void (*put)(uint8_t))
+        {
+            uint16_t count = 0;
+            uint8_t  b;
+            start(data, n);
+            while (next(b))
+            {
+                put(b);
+                count += 1;
+            }
+            return count;
+        }
+
+    private:
+        typename CODEC::Encoder codec;
+        _internal::frame_source src;
+    };
+
+    /**********************************************************
+     *
+     * ADC
+     *
+     * AdcPipeline runs the ADC on its own, either free running
+     * or started by a timer, so the sample rate doesn't depend
+     * on how quickly the event loop gets around.  The ADC ISR
+     * writes each sample into one of two blocks, and one event
+     * is queued per full block.  The event data is a pointer to
+     * the BLOCK samples, which must be given back with release()
+     * when the handler has finished with them.  Samples that
+     * arrive while neither block is free are dropped and counted.
+     *
+     * The DECIMATOR policy runs in the ISR and can reduce the
+     * rate of samples (and so of events and memory) before they
+     * are stored:
+     *
+     *   AdcNoDecimation     - every sample is stored
+     *   AdcBoxcar<N>        - the average of each N samples
+     *   AdcCic<R, ORDER>    - a CIC filter of order ORDER,
+     *                         decimating by R
+     *
+     * Example:
+     *
+     *   stedos::AdcPipeline<32, stedos::AdcBoxcar<4> > adc(&queue, block_ready);
+     *
+     *   ISR(ADC_vect) { adc.interrupt(); }
+     *
+     *   void block_ready(uintptr_t data)
+     *   {
+     *       const uint16_t* samples = (const uint16_t*) data;
+     *       ... use the 32 samples ...
+     *       adc.release(samples);
+     *   }
+     *
+     *   adc.begin(_BV(REFS0) | 2);     // AVcc reference, channel 2
+     *
+     * When a timer starts the conversions, the ADC is triggered by
+     * the rising edge of the timer's interrupt flag.  interrupt()
+     * clears that flag, so the timer doesn't need an ISR.
+     *
+     **********************************************************/
+
+    /* Stores every sample */
+    struct AdcNoDecimation
+    {
+        /* Takes a sample.  Returns true when out holds a sample to store */
+        bool add(const uint16_t& in, uint16_t& out) { out = in; return true; }
+    };
+
+    /* Stores the average of each N samples.  N must be a power of 2 */
+    template <int N>
+    class AdcBoxcar
+    {
+        static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+        static_assert(N <= 64, "the sum of N 10 bit samples must fit in 16 bits");
+
+    public:
+        AdcBoxcar() : sum(0), count(0) {};
+
+        bool add(const uint16_t& in, uint16_t& out)
+        {
+            sum   += in;
+            count += 1;
+            if (count < N) return false;
+
+            out   = sum >> _internal::ilog2(N);
+            sum   = 0;
+            count = 0;
+            return true;
+        }
+
+    private:
+        uint16_t sum;
+        uint8_t  count;
+    };
+
+    /* A cascaded integrator comb filter.  It is a better low pass
+       filter than the boxcar (which is a CIC of order 1) for a
+       few more additions per sample.  The output is scaled back
+       to the range of the input.  R must be a power of 2 */
+    template <int R, int ORDER=2>
+    class AdcCic
+    {
+        static_assert((R & (R - 1)) == 0, "R must be a power of 2");
+        static_assert((R > 1) && (R <= 256), "");
+        static_assert((ORDER > 0) && (ORDER <= 4), "");
+
+        /* The gain is R ^ ORDER, which must fit in the integrators
+           on top of the 10 bit samples */
+        static const uint8_t SHIFT = ORDER * _internal::ilog2(R);
+        static_assert(SHIFT + 10 <= 32, "R ^ ORDER is too large");
+
+    public:
+        AdcCic() : count(0)
+        {
+            for (uint8_t idx=0; idx<ORDER; idx+=1)
+            {
+                integrator[idx] = 0;
+                delay[idx]      = 0;
+            }
+        }
+
+        bool add(const uint16_t& in, uint16_t& out)
+        {
+            /* The integrators wrap, which the combs undo */
+            uint32_t v = in;
+            for (uint8_t idx=0; idx<ORDER; idx+=1)
+            {
+                integrator[idx] += v;
+                v = integrator[idx];
+            }
+
+            count += 1;
+            if (count < R) return false;
+            count = 0;
+
+            for (uint8_t idx=0; idx<ORDER; idx+=1)
+            {
+                uint32_t previous = delay[idx];
+                delay[idx] = v;
+                v -= previous;
+            }
+            out = v >> SHIFT;
+            return true;
+        }
+
+    private:
+        uint32_t integrator[ORDER];
+        uint32_t delay[ORDER];      /* comb inputs from the last output */
+        uint16_t count;
+    };
+
+    #ifdef ADCSRA
+
+    /* What starts each conversion, the ADTS bits of ADCSRB */
+    enum adc_trigger
+    {
+        ADC_FREE_RUNNING     = 0,
+        ADC_TIMER0_COMPARE_A = 3,
+        ADC_TIMER0_OVERFLOW  = 4,
+        ADC_TIMER1_COMPARE_B = 5,
+        ADC_TIMER1_OVERFLOW  = 6,
+    };
+
+    template <int BLOCK, typename DECIMATOR=AdcNoDecimation>
+    class AdcPipeline
+    {
+        static_assert(BLOCK > 0, "");
+        static_assert(BLOCK <= 255, "");
+
+    public:
+        AdcPipeline(EventProcessorInterface* p, event_func_t func)
+            : processor(p), blockEvent(func), filling(0), count(0), dropped(0), source(ADC_FREE_RUNNING)
+        {
+            busy[0] = 0;
+            busy[1] = 0;
+        }
+
+        /* Starts converting.  admux selects the reference and the
+           channel.  prescaler is the ADPS bits: the ADC clock is
+           F_CPU / 2^prescaler and a conversion takes 13 ADC clocks */
+        void begin(const uint8_t& admux, const uint8_t& trigger=ADC_FREE_RUNNING, const uint8_t& prescaler=7)
+        {
+            source = trigger;
+            clearTrigger();
+            ADMUX  = admux;
+            ADCSRB = (ADCSRB & ~0x07) | (trigger & 0x07);   /* keeps ACME */
+            ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADIF) | (prescaler & 0x07) |
+                     ((trigger == ADC_FREE_RUNNING) ? _BV(ADSC) : 0);
+        }
+
+        /* Stops the ADC */
+        void stop() { ADCSRA = 0; }
+
+        /* Should be called from the ADC conversion complete ISR */
+        void interrupt()
+        {
+            clearTrigger();
+
+            /* ADCL must be read first, it locks ADCH */
+            uint8_t  low  = ADCL;
+            uint8_t  high = ADCH;
+            uint16_t sample;
+
+            if (decimator.add(low | (high << 8), sample) == false) return;
+
+            if (busy[filling])
+            {
+                if (dropped < 0xffff) dropped += 1;
+                return;
+            }
+
+            blocks[filling][count++] = sample;
+            if (count == BLOCK)
+            {
+                busy[filling] = 1;
+                processor->queueEvent(blockEvent, (uintptr_t) blocks[filling]);
+                filling ^= 1;
+                count    = 0;
+            }
+        }
+
+        /* Gives a block back once its event has been handled */
+        void release(const uint16_t* block)
+        {
+            busy[(block == blocks[0]) ? 0 : 1] = 0;
+        }
+
+        /* Samples (after decimation) dropped because no block was free */
+        uint16_t droppedCount() const
+        {
+            auto a = Atomic();
+            return dropped;
+        }
+
+        DECIMATOR decimator;
+
+    private:
+        uint16_t blocks[2][BLOCK];
+        volatile uint8_t busy[2];   /* block is waiting for release() */
+
+        EventProcessorInterface* processor;
+        event_func_t blockEvent;
+
+        uint8_t  filling;           /* block being filled           */
+        uint8_t  count;             /* samples in the filling block */
+        uint16_t dropped;
+        uint8_t  source;            /* the adc_trigger              */
+
+        /* The ADC is triggered by the rising edge of a timer's
+           interrupt flag, so the flag must be cleared for the next
+           trigger.  Its ISR would clear it, but it needn't have one */
+        void clearTrigger()
+        {
+            switch (source)
+            {
+            #ifdef TIFR0
+                case ADC_TIMER0_COMPARE_A: TIFR0 = _BV(OCF0A); break;
+                case ADC_TIMER0_OVERFLOW:  TIFR0 = _BV(TOV0);  break;
+            #endif
+            #ifdef TIFR1
+                case ADC_TIMER1_COMPARE_B: TIFR1 = _BV(OCF1B); break;
+                case ADC_TIMER1_OVERFLOW:  TIFR1 = _BV(TOV1);  break;
+            #endif
+                default: break;
+            }
+        }
+    };
+
+    #endif
+
+    /**********************************************************
+     *
+     * Bus transactions
+     *
+     * Spi and Twi (I2C) run transactions from their ISRs, so
+     * the event loop never waits for the bus.  A transaction
+     * writes txLength bytes from tx and then reads rxLength
+     * bytes into rx, which is how most sensors are read (write
+     * the register address, then read the registers).  On SPI
+     * 0xff is sent while reading, and on TWI the read starts
+     * with a repeated start.
+     *
+     * Transactions are queued and are run back-to-back from the
+     * ISR.  When a whole transaction has finished, its status is
+     * set and its done event is queued.  The transaction and its
+     * buffers must not be touched until then.
+     *
+     * Example:
+     *
+     *   const uint8_t reg = 0x3b;
+     *   uint8_t accel[6];
+     *   stedos::BusTransaction read = { 0x68, &reg, 1, accel, 6, stedos::Event(accel_read) };
+     *
+     *   stedos::Twi<4> twi(&queue);
+     *   ISR(TWI_vect) { twi.interrupt(); }
+     *
+     *   twi.begin(12);                 // 400 kHz at 16 MHz
+     *   twi.queue(&read);
+     *
+     **********************************************************/
+
+    /* The status of a transaction */
+    enum bus_status
+    {
+        BUS_OK,
+        BUS_PENDING,    /* queued or in progress                */
+        BUS_NACK,       /* the TWI slave didn't acknowledge     */
+        BUS_ERROR,      /* TWI arbitration lost or a bus error  */
+    };
+
+    struct BusTransaction
+    {
+        uint8_t        address;     /* TWI: 7 bit slave address.  SPI: chip select pin mask */
+        const uint8_t* tx;
+        uint8_t        txLength;
+        uint8_t*       rx;
+        uint8_t        rxLength;
+        Event          done;        /* queued when the transaction has finished */
+        volatile uint8_t status;    /* bus_status                               */
+    };
+
+    namespace _internal
+    {
+        /* The transactions waiting for a bus.  It holds the one in
+           progress and up to SIZE - 1 more */
+        template <int SIZE>
+        class transaction_queue
+        {
+        public:
+            transaction_queue(EventProcessorInterface* p) : processor(p), active(0) {};
+
+            /* Adds a transaction.  Returns false if the queue is
+               full.  start is set if the bus was idle, in which
+               case t is now the active transaction */
+            bool add(BusTransaction* t, bool& start)
+            {
+                auto a = Atomic();
+                start = false;
+                if (active == 0)
+                {
+                    t->status = BUS_PENDING;
+                    active = t;
+                    start  = true;
+                    return true;
+                }
+                if (pending.isFull()) return false;
+                t->status = BUS_PENDING;
+                pending.push(t);
+                return true;
+            }
+
+            /* Completes the active transaction and returns the next, or 0 */
+            BusTransaction* finish(const uint8_t& status)
+            {
+                active->status = status;
+                processor->queueEvent(active->done);
+                active = pending.isEmpty() ? 0 : pending.pop();
+                return active;
+            }
+
+            BusTransaction* current() const { return active; }
+
+        private:
+            EventProcessorInterface* processor;
+            BusTransaction* volatile active;
+            FIFO<BusTransaction*, SIZE> pending;
+        };
+    }
+
+    #ifdef SPDR
+
+    /* The SPI master.  The address of a transaction is the mask of
+       its chip select pins on PORT, which are driven low while it
+       runs.  The chip selects, MOSI, SCK and SS must be outputs */
+    template <int SIZE, typename PORT>
+    class Spi
+    {
+    public:
+        Spi(EventProcessorInterface* p) : transactions(p), index(0) {};
+
+        /* Starts the SPI as master.  settings holds the DORD, CPOL,
+           CPHA, SPR1 and SPR0 bits of SPCR */
+        void begin(const uint8_t& settings=0, const bool& doubleSpeed=false)
+        {
+            SPSR = doubleSpeed ? _BV(SPI2X) : 0;
+            SPCR = _BV(SPIE) | _BV(SPE) | _BV(MSTR) |
+                   (settings & (_BV(DORD) | _BV(CPOL) | _BV(CPHA) | _BV(SPR1) | _BV(SPR0)));
+        }
+
+        /* Queues a transaction.  Returns false if the queue is full */
+        bool queue(BusTransaction* t)
+        {
+            bool idle;
+            if (transactions.add(t, idle) == false) return false;
+            if (idle) start(t);
+            return true;
+        }
+
+        bool isIdle() const { return transactions.current() == 0; }
+
+        /* Should be called from the serial transfer complete ISR */
+        void interrupt()
+        {
+            BusTransaction* t = transactions.current();
+            uint8_t in = SPDR;
+
+            if (index >= t->txLength)
+            {
+                t->rx[index - t->txLength] = in;
+            }
+            index += 1;
+
+            if (index < t->txLength + t->rxLength)
+            {
+                SPDR = (index < t->txLength) ? t->tx[index] : 0xff;
+            }
+            else
+            {
+                port |= t->address;
+                start(transactions.finish(BUS_OK));
+            }
+        }
+
+    private:
+        _internal::transaction_queue<SIZE> transactions;
+        PORT     port;
+        uint16_t index;     /* byte being transferred */
+
+        void start(BusTransaction* t)
+        {
+            /* Empty transactions finish straight away */
+            while (t && (t->txLength == 0) && (t->rxLength == 0))
+            {
+                t = transactions.finish(BUS_OK);
+            }
+            if (t == 0) return;
+
+            index = 0;
+            port &= ~t->address;
+            SPDR = (t->txLength > 0) ? t->tx[0] : 0xff;
+        }
+    };
+
+    #endif
+
+    #ifdef TWDR
+
+    /* The TWI (I2C) master */
+    template <int SIZE>
+    class Twi
+    {
+        /* TWSR status codes for master transmit and receive */
+        enum
+        {
+            START          = 0x08,
+            REPEATED_START = 0x10,
+            SLA_W_ACK      = 0x18,
+            SLA_W_NACK     = 0x20,
+            DATA_W_ACK     = 0x28,
+            DATA_W_NACK    = 0x30,
+            ARBITRATION    = 0x38,
+            SLA_R_ACK      = 0x40,
+            SLA_R_NACK     = 0x48,
+            DATA_R_ACK     = 0x50,
+            DATA_R_NACK    = 0x58,
+        };
+
+    public:
+        Twi(EventProcessorInterface* p) : transactions(p), txIndex(0), rxIndex(0) {};
+
+        /* Starts the TWI.  The SCL frequency is F_CPU / (16 + 2 * bitrate) */
+        void begin(const uint8_t& bitrate)
+        {
+            TWSR = 0;
+            TWBR = bitrate;
+            TWCR = _BV(TWEN);
+        }
+
+        /* Queues a transaction.  Returns false if the queue is full */
+        bool queue(BusTransaction* t)
+        {
+            bool idle;
+            if (transactions.add(t, idle) == false) return false;
+            if (idle) start(0);
+            return true;
+        }
+
+        bool isIdle() const { return transactions.current() == 0; }
+
+        /* Should be called from the TWI ISR */
+        void interrupt()
+        {
+            BusTransaction* t = transactions.current();
+
+            switch (TWSR & 0xf8)
+            {
+                case START:
+                case REPEATED_START:
+                    /* Read once everything has been written */
+                    TWDR = (t->address << 1) | (((txIndex == t->txLength) && (t->rxLength > 0)) ? 1 : 0);
+                    go(0);
+                    break;
+
+                case SLA_W_ACK:
+                case DATA_W_ACK:
+                    if (txIndex < t->txLength)
+                    {
+                        TWDR = t->tx[txIndex++];
+                        go(0);
+                    }
+                    else if (t->rxLength > 0)
+                    {
+                        go(_BV(TWSTA));
+                    }
+                    else
+                    {
+                        finish(BUS_OK);
+                    }
+                    break;
+
+                case SLA_R_ACK:
+                    /* The last byte is not acknowledged */
+                    go((t->rxLength > 1) ? _BV(TWEA) : 0);
+                    break;
+
+                case DATA_R_ACK:
+                    t->rx[rxIndex++] = TWDR;
+                    go((t->rxLength - rxIndex > 1) ? _BV(TWEA) : 0);
+                    break;
+
+                case DATA_R_NACK:
+                    t->rx[rxIndex++] = TWDR;
+                    finish(BUS_OK);
+                    break;
+
+                case SLA_W_NACK:
+                case DATA_W_NACK:
+                case SLA_R_NACK:
+                    finish(BUS_NACK);
+                    break;
+
+                default:
+                    finish(BUS_ERROR);
+                    break;
+            }
+        }
+
+    private:
+        _internal::transaction_queue<SIZE> transactions;
+        uint8_t txIndex;
+        uint8_t rxIndex;
+
+        void go(const uint8_t& bits)
+        {
+            TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | bits;
+        }
+
+        /* Sends a start, after a stop if one is given */
+        void start(const uint8_t& stop)
+        {
+            txIndex = 0;
+            rxIndex = 0;
+            go(_BV(TWSTA) | stop);
+        }
+
+        /* Stops, and chains straight on to the next transaction */
+        void finish(const uint8_t& status)
+        {
+            if (transactions.finish(status))
+            {
+                start(_BV(TWSTO));
+            }
+            else
+            {
+                TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+            }
+        }
+    };
+
+    #endif
+
+    /**********************************************************
+     *
+     * EEPROM
+     *
+     * Writing a byte of EEPROM takes about 3.3 ms, so writing a
+     * block synchronously stalls the event loop.  EepromCache
+     * keeps the bytes that have been written, but not yet
+     * stored, in a RAM shadow of BLOCKS blocks of BLOCK bytes.
+     * The EEPROM ready ISR writes them back one byte per
+     * interrupt.  Bytes that already hold the value are skipped,
+     * so they don't wear the cell.
+     *
+     * The written event (if any) is queued with the block address
+     * as its data once a block has been stored.  flush() queues
+     * an event once everything written so far is stored.
+     *
+     * Reads are served from the shadow if the byte is waiting to
+     * be written, otherwise from the EEPROM.  A read from the
+     * EEPROM waits for the byte being written, if there is one.
+     *
+     * EepromLog spreads the wear of a record that is written
+     * often, such as a counter or the last settings, over SLOTS
+     * copies.  Each write goes to the next slot with a sequence
+     * number and a check byte, and begin() finds the newest good
+     * copy.  A write that was cut short by a reset fails the check,
+     * so the copy before it is used.
+     *
+     * Example:
+     *
+     *   stedos::EepromCache<8, 4> eeprom(&queue);
+     *   stedos::EepromLog<Settings, stedos::EepromCache<8, 4> > settings(eeprom, 0x100, 16);
+     *
+     *   ISR(EE_READY_vect) { eeprom.interrupt(); }
+     *
+     *   if (settings.begin()) settings.read(current);
+     *   ...
+     *   settings.write(current);
+     *   eeprom.flush(stedos::Event(saved));
+     *
+     **********************************************************/
+
+    #ifdef EECR
+
+    namespace _internal
+    {
+        /* Sets the EEPROM address register */
+        inline void eeprom_address(const uint16_t& address)
+        {
+            #ifdef EEARH
+                EEARH = address >> 8;
+            #endif
+            EEARL = address & 0xff;
+        }
+
+        /* Reads a byte, waiting for a write in progress to finish.
+           Interrupts are only disabled for the read itself, so the
+           ISR can't start another write in between */
+        inline uint8_t eeprom_read(const uint16_t& address)
+        {
+            while (1)
+            {
+                auto a = Atomic();
+                if ((EECR & _BV(EEPE)) == 0)
+                {
+                    eeprom_address(address);
+                    EECR |= _BV(EERE);
+                    return EEDR;
+                }
+            }
+        }
+    }
+
+    template <int BLOCK=8, int BLOCKS=4>
+    class EepromCache
+    {
+        static_assert((BLOCK & (BLOCK - 1)) == 0, "BLOCK must be a power of 2");
+        static_assert((BLOCK >= 8) && (BLOCK <= 64), "");
+        static_assert((BLOCKS > 0) && (BLOCKS <= 16), "");
+
+        static const uint16_t FREE = 0xffff;
+
+        struct block
+        {
+            uint16_t address;           /* of byte 0, or FREE           */
+            uint8_t  pending;           /* bytes waiting to be written  */
+            uint8_t  dirty[BLOCK / 8];  /* bit per byte                 */
+            uint8_t  data[BLOCK];
+        };
+
+    public:
+        EepromCache(EventProcessorInterface* p, event_func_t written=0)
+            : processor(p), writtenEvent(written), current(0), finished(FREE),
+              flushing(false), rejected(0)
+        {
+            for (uint8_t idx=0; idx<BLOCKS; idx+=1)
+            {
+                blocks[idx].address = FREE;
+                blocks[idx].pending = 0;
+            }
+        }
+
+        /* Writes n bytes.  It is all or nothing: returns false,
+           and writes nothing, if the shadow doesn't have room */
+        bool write(const uint16_t& address, const void* src, const uint16_t& n)
+        {
+            const uint8_t* bytes = (const uint8_t*) src;
+            auto a = Atomic();
+
+            /* Count the blocks that aren't in the shadow */
+            uint8_t needed = 0;
+            uint8_t spare  = 0;
+            for (uint8_t idx=0; idx<BLOCKS; idx+=1)
+            {
+                if (blocks[idx].address == FREE) spare += 1;
+            }
+            for (uint16_t base=start(address); base<address + n; base+=BLOCK)
+            {
+                if (find(base) == 0) needed += 1;
+            }
+            if (needed > spare)
+            {
+                if (rejected < 0xff) rejected += 1;
+                return false;
+            }
+
+            for (uint16_t idx=0; idx<n; idx+=1)
+            {
+                uint16_t at = address + idx;
+                block* b = find(start(at));
+                if (b == 0) b = claim(start(at));
+
+                uint8_t offset = at & (BLOCK - 1);
+                uint8_t bit    = _BV(offset & 7);
+                b->data[offset] = bytes[idx];
+                if ((b->dirty[offset >> 3] & bit) == 0)
+                {
+                    b->dirty[offset >> 3] |= bit;
+                    b->pending += 1;
+                }
+            }
+
+            EECR |= _BV(EERIE);
+            return true;
+        }
+
+        /* Reads n bytes, including any that are still waiting to be written */
+        void read(const uint16_t& address, void* dest, const uint16_t& n)
+        {
+            uint8_t* bytes = (uint8_t*) dest;
+            for (uint16_t idx=0; idx<n; idx+=1)
+            {
+                uint16_t at = address + idx;
+                bool cached = false;
+                {
+                    auto a = Atomic();
+                    block* b = find(start(at));
+                    uint8_t offset = at & (BLOCK - 1);
+                    if (b && (b->dirty[offset >> 3] & _BV(offset & 7)))
+                    {
+                        bytes[idx] = b->data[offset];
+                        cached = true;
+                    }
+                }
+                if (!cached) bytes[idx] = _internal::eeprom_read(at);
+            }
+        }
+
+        /* Queues e once everything written so far has been stored.
+           Returns false if a flush is already waiting */
+        bool flush(const Event& e)
+        {
+            auto a = Atomic();
+            if (flushing) return false;
+            flushEvent = e;
+            flushing   = true;
+            EECR |= _BV(EERIE);
+            return true;
+        }
+
+        /* True when nothing is waiting to be written */
+        bool isClean()
+        {
+            auto a = Atomic();
+            for (uint8_t idx=0; idx<BLOCKS; idx+=1)
+            {
+                if (blocks[idx].address != FREE) return false;
+            }
+            return (EECR & _BV(EEPE)) == 0;
+        }
+
+        /* Writes refused because the shadow was full */
+        uint8_t rejectedCount() const { return rejected; }
+
+        /* Should be called from the EEPROM ready ISR */
+        void interrupt()
+        {
+            /* The last byte of a block has now been stored */
+            if (finished != FREE)
+            {
+                if (writtenEvent) processor->queueEvent(writtenEvent, finished);
+                finished = FREE;
+            }
+
+            /* Finish a block before starting another, and start the
+               lowest, so a record is written in address order */
+            while (1)
+            {
+                block& b = blocks[current];
+                if (b.pending == 0)
+                {
+                    if (next() == false) break;
+                    continue;
+                }
+
+                uint8_t offset = first_dirty(b);
+                uint16_t at    = b.address + offset;
+                uint8_t value  = b.data[offset];
+
+                b.dirty[offset >> 3] &= ~_BV(offset & 7);
+                b.pending -= 1;
+
+                bool last = (b.pending == 0);
+                if (last)
+                {
+                    finished  = b.address;
+                    b.address = FREE;
+                }
+
+                _internal::eeprom_address(at);
+                EECR |= _BV(EERE);
+                if (EEDR != value)
+                {
+                    EEDR  = value;
+                    EECR |= _BV(EEMPE);
+                    EECR |= _BV(EEPE);
+                    return;
+                }
+
+                /* Already holds the value */
+                if (last)
+                {
+                    if (writtenEvent) processor->queueEvent(writtenEvent, finished);
+                    finished = FREE;
+                }
+            }
+
+            EECR &= ~_BV(EERIE);
+            if (flushing)
+            {
+                flushing = false;
+                processor->queueEvent(flushEvent);
+            }
+        }
+
+    private:
+        block blocks[BLOCKS];
+
+        EventProcessorInterface* processor;
+        event_func_t writtenEvent;
+        Event        flushEvent;
+
+        uint8_t  current;   /* block being written back              */
+        uint16_t finished;  /* block whose last byte is being stored */
+        bool     flushing;
+        uint8_t  rejected;
+
+        static uint16_t start(const uint16_t& address) { return address & ~(uint16_t) (BLOCK - 1); }
+
+        block* find(const uint16_t& base)
+        {
+            for (uint8_t idx=0; idx<BLOCKS; idx+=1)
+            {
+                if (blocks[idx].address == base) return &blocks[idx];
+            }
+            return 0;
+        }
+
+        block* claim(const uint16_t& base)
+        {
+            for (uint8_t idx=0; idx<BLOCKS; idx+=1)
+            {
+                block& b = blocks[idx];
+                if (b.address == FREE)
+                {
+                    b.address = base;
+                    b.pending = 0;
+                    for (uint8_t d=0; d<BLOCK / 8; d+=1) b.dirty[d] = 0;
+                    return &b;
+                }
+            }
+            return 0;
+        }
+
+        /* Moves current to the lowest block that is waiting */
+        bool next()
+        {
+            bool found = false;
+            for (uint8_t idx=0; idx<BLOCKS; idx+=1)
+            {
+                if ((blocks[idx].pending > 0) &&
+                    (!found || (blocks[idx].address < blocks[current].address)))
+                {
+                    current = idx;
+                    found   = true;
+                }
+            }
+            return found;
+        }
+
+        static uint8_t first_dirty(const block& b)
+        {
+            uint8_t offset = 0;
+            while ((b.dirty[offset >> 3] & _BV(offset & 7)) == 0) offset += 1;
+            return offset;
+        }
+    };
+
+    template <typename T, typename CACHE>
+    class EepromLog
+    {
+        /* A record is the sequence number, T and the check byte */
+        static const uint16_t RECORD = sizeof(T) + 2;
+        static const uint8_t  NONE   = 0xff;
+
+        static_assert(sizeof(T) < 250, "");
+
+    public:
+        /* The log uses count * (sizeof(T) + 2) bytes from start.
+           count must be less than 128 */
+        EepromLog(CACHE& c, const uint16_t& start, const uint8_t& count)
+            : cache(c), base(start), slots(count), newest(NONE), sequence(0) {};
+
+        /* Finds the newest good record.  Returns false if there is none */
+        bool begin()
+        {
+            newest = NONE;
+            for (uint8_t idx=0; idx<slots; idx+=1)
+            {
+                uint8_t seq;
+                if (!valid(idx, seq)) continue;
+
+                uint8_t following = (idx + 1 == slots) ? 0 : idx + 1;
+                uint8_t next;
+                if (!valid(following, next) || (next != (uint8_t) (seq + 1)))
+                {
+                    newest   = idx;
+                    sequence = seq;
+                    break;
+                }
+            }
+            return newest != NONE;
+        }
+
+        /* Reads the newest record.  Returns false if there is none */
+        bool read(T& v)
+        {
+            if (newest == NONE) return false;
+            cache.read(address(newest) + 1, &v, sizeof(T));
+            return true;
+        }
+
+        /* Writes v to the next slot.  Returns false if the cache is full */
+        bool write(const T& v)
+        {
+            uint8_t slot = ((newest == NONE) || (newest + 1 == slots)) ? 0 : newest + 1;
+            uint8_t seq  = (newest == NONE) ? 0 : sequence + 1;
+
+            uint8_t record[RECORD];
+            record[0] = seq;
+            memcpy(&record[1], &v, sizeof(T));
+            record[RECORD - 1] = check(record);
+
+            if (cache.write(address(slot), record, RECORD) == false) return false;
+            newest   = slot;
+            sequence = seq;
+            return true;
+        }
+
+    private:
+        CACHE&   cache;
+        uint16_t base;
+        uint8_t  slots;
+        uint8_t  newest;    /* slot of the newest record, or NONE */
+        uint8_t  sequence;  /* its sequence number                */
+
+        uint16_t address(const uint8_t& slot) const { return base + slot * RECORD; }
+
+        static uint8_t check(const uint8_t* record)
+        {
+            uint8_t sum = 0;
+            for (uint16_t idx=0; idx<RECORD - 1; idx+=1) sum += record[idx];
+            return ~sum;
+        }
+
+        bool valid(const uint8_t& slot, uint8_t& seq)
+        {
+            uint8_t record[RECORD];
+            cache.read(address(slot), record, RECORD);
+            seq = record[0];
+            return record[RECORD - 1] == check(record);
+        }
+    };
+
+    template <typename T, typename CACHE>
+    const uint16_t EepromLog<T, CACHE>::RECORD;
+
+    #endif
+
+    /**********************************************************
+     *
+     * Debug
+     *
+     * Debugging is useful, however, it can be quite hard on
+     * microprocessors due to their limited resources.  The
+     * debug class provides a null implementation for a number
+     * of debug functions.  To get debug out of the class, this
+     * class should be subclassed and the required functionality
+     * provided.
+     *
+     **********************************************************/
+
+    struct Debug
+    {
+        /* This function should be called when something bad has happened */
+        void assert() {};
+
+        /* The folowing functions are used to output debug messages.  The
+           debug levels are used as follows:
+
+           * info  - general purpose information
+           * warn  - warning (something might not be right)
+           * error - a recoverable error has occurred
+           * fatal - something very bad has happened
+        */ 
+
+        /* Adjust the level of the output */
+        void setLevel(const uint8_t& l) { level = l; }
+
+        /* This function is used to output a debug string */
+        virtual void log(const uint8_t& level, const char& output)  {}
+
+        /* This function is used by the stedos modules to report a
+           problem.  code is one of the DEBUG_ codes below and value
+           gives more detail (see each code) */
+        virtual void report(const uint8_t& level, const uint8_t& code, const uint16_t& value) {}
+
+        Debug(const uint8_t& l=3) : level(l) {};
+
+    private:
+        uint8_t level;
+
+    };
+
+    #define LEVEL_TRACE (4)
+    #define LEVEL_INFO  (3)
+    #define LEVEL_WARN  (2)
+    #define LEVEL_ERROR (1)
+    #define LEVEL_FATAL (0)
+
+    /* Codes passed to Debug::report() */
+    enum debug_code
+    {
+        DEBUG_STACK_LOW,        /* value = bytes of stack margin left */
+        DEBUG_WATCHDOG_RESET,   /* value = address of the handler that hung */
+        DEBUG_HANDLER_OVERRUN,  /* value = address of the handler that ran over budget */
+        DEBUG_DEADLINE_MISSED,  /* value = address of the handler that started late */
+        DEBUG_TIMER_FULL,       /* value = bytes of stack margin at the last check */
+        DEBUG_CODE_LAST
+    };
+
+    /**********************************************************
+     *
+     * Stack monitor
+     *
+     * stedos doesn't use a heap, so the memory between the end
+     * of .bss and the stack is only ever used by the stack.  The
+     * region is painted with a known value at startup and the
+     * stack high water mark is found by looking for the lowest
+     * byte that has been overwritten.  Interrupts can nest, so
+     * this is the real worst case that has been seen.
+     *
+     * To paint the region before main() runs, use the
+     * STEDOS_PAINT_STACK() macro once in the program:
+     *
+     *   STEDOS_PAINT_STACK();
+     *
+     *   stedos::StackMonitor stack;
+     *   stack.start(&timer, 1000, 64, &debug);
+     *
+     * start() checks the margin every period ticks and reports
+     * DEBUG_STACK_LOW at LEVEL_FATAL if it falls below threshold.
+     * It returns false if the timer has no free slot.  If the
+     * slot is taken between checks, the checks stop and
+     * DEBUG_TIMER_FULL is reported.
+     *
+     **********************************************************/
+
+    #ifdef __AVR__
+        extern "C" uint8_t __heap_start;
+
+        /* Paints from the end of .bss to the end of RAM.  This runs
+           in .init1, before the stack is used, so it paints it all */
+        #define STEDOS_PAINT_STACK() \
+            extern "C" void stedos_paint_stack(void) __attribute__((naked, used, section(".init1"))); \
+            void stedos_paint_stack(void) \
+            { \
+                for (uint8_t* p = &__heap_start; p <= (uint8_t*) RAMEND; p++) *p = stedos::StackMonitor::PAINT; \
+            }
+    #endif
+
+    class StackMonitor
+    {
+    public:
+        static const uint8_t PAINT = 0xc5;
+
+        #ifdef __AVR__
+            StackMonitor() : low(&__heap_start), high((uint8_t*) RAMEND + 1) {};
+        #endif
+
+        /* Monitors the region [l, h), where the stack grows down from h */
+        StackMonitor(uint8_t* l, uint8_t* h) : low(l), high(h) {};
+
+        /* Paints the region up to (but not including) top.  top must
+           be below the current stack pointer */
+        void paint(uint8_t* top)
+        {
+            for (uint8_t* p = low; p < top; p++) *p = PAINT;
+        }
+
+        /* The size of the region */
+        uint16_t size() const { return high - low; }
+
+        /* The number of bytes that the stack has never reached */
+        uint16_t margin() const
+        {
+            const uint8_t* p = low;
+            while ((p < high) && (*p == PAINT)) p++;
+            return p - low;
+        }
+
+        /* The most stack that has been used */
+        uint16_t highWater() const { return size() - margin(); }
+
+        /* Starts a periodic check of the margin using timer.
+           Returns false if the timer has no free slot */
+        bool start(TimerImplementationInterface* t, const uint16_t& period,
+                   const uint16_t& threshold, Debug* d)
+        {
+            timer      = t;
+            interval   = period;
+            limit      = threshold;
+            debug      = d;
+            return timer->add(interval, { check, (uintptr_t) this }) != 0xff;
+        }
+
+    private:
+        uint8_t* low;
+        uint8_t* high;
+
+        TimerImplementationInterface* timer;
+        Debug*   debug;
+        uint16_t interval;
+        uint16_t limit;
+
+        static void check(uintptr_t data)
+        {
+            StackMonitor* m = (StackMonitor*) data;
+            uint16_t left = m->margin();
+            if (left < m->limit)
+            {
+                m->debug->report(LEVEL_FATAL, DEBUG_STACK_LOW, left);
+            }
+            if (m->timer->add(m->interval, { check, data }) == 0xff)
+            {
+                m->debug->report(LEVEL_ERROR, DEBUG_TIMER_FULL, left);
+            }
+        }
+    };
+
+    /**********************************************************
+     *
+     * Watchdog supervisor
+     *
+     * Supervisor is an EventProcessor policy (in place of the
+     * Profiler) that feeds the watchdog at the start of each
+     * process() round, so the watchdog is only fed while every
+     * handler returns.  If one hangs, the watchdog resets the
+     * chip.
+     *
+     * The handler that is running is kept in a record in the
+     * .noinit section, which survives the reset.  begin()
+     * reports DEBUG_WATCHDOG_RESET with its address after a
+     * watchdog reset, and DEBUG_HANDLER_OVERRUN for the last
+     * handler that ran over its budget before any reset.
+     *
+     * Each handler is timed with CLOCK.  A handler that takes
+     * longer than its budget (in clock ticks) is reported with
+     * DEBUG_HANDLER_OVERRUN at LEVEL_WARN, and the overrun event
+     * is queued with the handler's address as its data.
+     *
+     * After a watchdog reset the watchdog is still enabled, with
+     * the shortest timeout, so the reset cause must be saved and
+     * the watchdog stopped before main().  Use the
+     * STEDOS_WATCHDOG_INIT() macro once in the program.  It also
+     * defines the record that survives the reset:
+     *
+     *   STEDOS_WATCHDOG_INIT();
+     *
+     *   stedos::EventProcessor<16, stedos::Supervisor<stedos::Timer1Clock> > queue;
+     *
+     *   queue.profiler.setBudget(4000);              // default
+     *   queue.profiler.setBudget(crunch, 30000);     // per handler
+     *   queue.profiler.begin(&queue, &debug, WDTO_500MS, overrun);
+     *
+     * Template Parameters:
+     *     CLOCK - class with a static uint16_t now(), e.g. Timer1Clock
+     *   BUDGETS - number of handlers that can have their own budget
+     *
+     **********************************************************/
+
+    #ifdef MCUSR
+
+    #ifdef __AVR__
+        #define STEDOS_NOINIT __attribute__((section(".noinit")))
+
+        /* Defines the record and runs watchdogBoot() in .init3,
+           after the stack is set up */
+        #define STEDOS_WATCHDOG_INIT() \
+            stedos::_internal::watchdog_record stedos::_internal::watchdog_noinit STEDOS_NOINIT; \
+            extern "C" void stedos_watchdog_init(void) __attribute__((naked, used, section(".init3"))); \
+            void stedos_watchdog_init(void) { stedos::watchdogBoot(); }
+    #else
+        #define STEDOS_NOINIT
+
+        #define STEDOS_WATCHDOG_INIT() \
+            stedos::_internal::watchdog_record stedos::_internal::watchdog_noinit
+    #endif
+
+    namespace _internal
+    {
+        struct watchdog_record
+        {
+            uint16_t     magic;     /* MAGIC if the record is valid    */
+            uint8_t      cause;     /* MCUSR at the last reset         */
+            event_func_t running;   /* handler being run, or 0         */
+            event_func_t overrun;   /* last handler that ran over, or 0 */
+        };
+
+        /* Defined once, by STEDOS_WATCHDOG_INIT().  It can't be a
+           static in an inline function, because those are COMDAT
+           and can't share the .noinit section */
+        extern watchdog_record watchdog_noinit;
+
+        inline watchdog_record& watchdog_state() { return watchdog_noinit; }
+    }
+
+    /* Saves the reset cause and stops the watchdog */
+    inline void watchdogBoot()
+    {
+        _internal::watchdog_state().cause = MCUSR;
+        MCUSR = 0;
+        wdt_disable();
+    }
+
+    struct SupervisorBudget
+    {
+        event_func_t func;
+        uint16_t     ticks;
+    };
+
+    template <typename CLOCK, int BUDGETS=4>
+    class Supervisor
+    {
+    public:
+        static const uint16_t MAGIC = 0x5e7d;
+
+        Supervisor() : processor(0), debug(0), warning(0), budget(0xffff), overruns(0), hung(0), start(0)
+        {
+            memset(budgets, 0, sizeof(budgets));
+        };
+
+        /* Reports the previous reset and starts the watchdog.
+           warning (if not 0) is queued on processor when a
+           handler runs over budget */
+        void begin(EventProcessorInterface* p, Debug* d, const uint8_t& timeout, event_func_t w=0)
+        {
+            processor = p;
+            debug     = d;
+            warning   = w;
+
+            _internal::watchdog_record& r = _internal::watchdog_state();
+            if (r.magic == MAGIC)
+            {
+                if ((r.cause & _BV(WDRF)) && r.running)
+                {
+                    hung = r.running;
+                    report(LEVEL_ERROR, DEBUG_WATCHDOG_RESET, hung);
+                }
+                if (r.overrun)
+                {
+                    report(LEVEL_WARN, DEBUG_HANDLER_OVERRUN, r.overrun);
+                }
+            }
+
+            r.magic   = MAGIC;
+            r.running = 0;
+            r.overrun = 0;
+            wdt_enable(timeout);
+        }
+
+        /* The budget for the handlers without their own (0xffff,
+           the default, is no budget) */
+        void setBudget(const uint16_t& ticks) { budget = ticks; }
+
+        /* Gives f its own budget.  Returns false if there is no room */
+        bool setBudget(const event_func_t& f, const uint16_t& ticks)
+        {
+            for (uint8_t idx=0; idx<BUDGETS; idx+=1)
+            {
+                if ((budgets[idx].func == f) || (budgets[idx].func == 0))
+                {
+                    budgets[idx].func  = f;
+                    budgets[idx].ticks = ticks;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /* The handler that was running at the last watchdog reset */
+        event_func_t resetHandler() const { return hung; }
+
+        uint16_t overrunCount() const { return overruns; }
+
+        /* The policy functions, called by EventProcessor */
+        void poll() { wdt_reset(); }
+
+        void enter(const Event& e)
+        {
+            _internal::watchdog_state().running = e.func;
+            start = CLOCK::now();
+        }
+
+        void leave(const event_func_t& f)
+        {
+            uint16_t ticks = CLOCK::now() - start;
+            _internal::watchdog_state().running = 0;
+
+            if (ticks > find(f))
+            {
+                _internal::watchdog_state().overrun = f;
+                if (overruns < 0xffff) overruns += 1;
+                report(LEVEL_WARN, DEBUG_HANDLER_OVERRUN, f);
+                if (warning && processor) processor->queueEvent(warning, (uintptr_t) f);
+            }
+        }
+
+    private:
+        EventProcessorInterface* processor;
+        Debug*           debug;
+        event_func_t     warning;
+        SupervisorBudget budgets[BUDGETS];
+        uint16_t         budget;
+        uint16_t         overruns;
+        event_func_t     hung;
+        uint16_t         start;     /* clock when the handler was entered */
+
+        uint16_t find(const event_func_t& f) const
+        {
+            for (uint8_t idx=0; idx<BUDGETS; idx+=1)
+            {
+                if (budgets[idx].func == f) return budgets[idx].ticks;
+            }
+            return budget;
+        }
+
+        void report(const uint8_t& level, const uint8_t& code, const event_func_t& f)
+        {
+            if (debug) debug->report(level, code, (uint16_t) (uintptr_t) f);
+        }
+    };
+
+    #endif
+
+    /**********************************************************
+     *
+     * Earliest deadline first event processing
+     *
+     * EdfEventProcessor runs the event with the earliest deadline
+     * first, rather than the oldest.  Events that are worth
+     * nothing if they are late, e.g. a control loop update due at
+     * tick T, are queued with a deadline.  They are kept in a
+     * binary heap, so queueing and dispatching are O(log SIZE).
+     *
+     * Events queued through EventProcessorInterface (e.g. by a
+     * timer or an ISR that doesn't know about deadlines) are
+     * background work.  They run in order, when no event with a
+     * deadline is waiting.
+     *
+     * Deadlines are ticks of the timer given to begin(), which is
+     * usually the one that the application already ticks.  They
+     * wrap, so every deadline that is queued must be within 32767
+     * ticks of the others.  An event that is dispatched after its
+     * deadline tick has passed is a miss.  Misses are counted and
+     * reported with DEBUG_DEADLINE_MISSED at LEVEL_WARN.  If
+     * dropLate is set, late events are not run, to save the time
+     * for the events that can still make their deadlines.
+     *
+     * A queue that is full refuses the event (queueDeadline()
+     * returns false) and counts it as dropped, rather than
+     * overwriting the oldest event like the FIFO does.
+     *
+     * Example:
+     *
+     *   stedos::EdfEventProcessor<8, stedos::SimpleTimerImplementation<4> > queue;
+     *   stedos::SimpleTimerImplementation<4> timer(&queue);
+     *
+     *   queue.begin(&timer, &debug);
+     *
+     *   ISR(ADC_vect) { queue.queueWithin(stedos::Event(control, ADC), 2); }
+     *
+     * Template Parameters:
+     *   SIZE  - events with a deadline (and background events) that
+     *           can be queued, up to 255
+     *   TIMER - class with a uint16_t now() tick count, e.g.
+     *           SimpleTimerImplementation
+     *
+     **********************************************************/
+
+    /* An event waiting in the EdfEventProcessor heap */
+    struct EdfEntry
+    {
+        Event    event;
+        uint16_t deadline;
+    };
+
+    template <int SIZE, typename TIMER>
+    class EdfEventProcessor : public EventProcessorInterface
+    {
+        static_assert((SIZE > 0) && (SIZE < 256), "EdfEventProcessor SIZE must be 1 to 255");
+
+    public:
+        EdfEventProcessor() : timer(0), debug(0), dropLate(false), count(0), missed(0), dropped(0) {};
+
+        /* Sets the timer that the deadlines are measured with */
+        void begin(const TIMER* t, Debug* d=0, const bool& drop=false)
+        {
+            timer    = t;
+            debug    = d;
+            dropLate = drop;
+        }
+
+        /* Queues an event that must start by tick deadline */
+        bool queueDeadline(const Event& event, const uint16_t& deadline)
+        {
+            auto a = Atomic();
+            if (count == SIZE)
+            {
+                dropped += 1;
+                return false;
+            }
+
+            /* Sift the hole up from the end to where the event goes */
+            uint8_t idx = count++;
+            while (idx > 0)
+            {
+                uint8_t parent = (idx - 1) / 2;
+                if (!before(deadline, heap[parent].deadline)) break;
+                heap[idx] = heap[parent];
+                idx = parent;
+            }
+            heap[idx].event    = event;
+            heap[idx].deadline = deadline;
+            return true;
+        }
+
+        /* Queues an event that must start within ticks from now */
+        bool queueWithin(const Event& event, const uint16_t& ticks)
+        {
+            return queueDeadline(event, timer->now() + ticks);
+        }
+
+        /* Background events, with no deadline */
+        void queueEvent(event_func_t func)                 { queueEvent(Event(func));       }
+        void queueEvent(event_func_t func, uintptr_t data) { queueEvent(Event(func, data)); }
+        void queueEvent(const Event& event)
+        {
+            auto a = Atomic();
+            if (background.isFull()) dropped += 1;
+            else                     background.push(event);
+        }
+
+        void process()
+        {
+            while (true)
+            {
+                Event    event;
+                uint16_t deadline;
+                bool     timed;
+                {
+                    auto a = Atomic();
+                    timed = (count > 0);
+                    if (timed)
+                    {
+                        event    = heap[0].event;
+                        deadline = heap[0].deadline;
+                        pop();
+                    }
+                    else if (background.isEmpty()) return;
+                    else event = background.pop();
+                }
+
+                if (timed && before(deadline, timer->now()))
+                {
+                    missed += 1;
+                    if (debug) debug->report(LEVEL_WARN, DEBUG_DEADLINE_MISSED, (uint16_t) (uintptr_t) event.func);
+                    if (dropLate) continue;
+                }
+                event.func(event.data);
+            }
+        }
+
+        bool isEmpty()
+        {
+            auto a = Atomic();
+            return (count == 0) && background.isEmpty();
+        }
+
+        /* The number of events with a deadline that are waiting */
+        uint8_t  pendingCount() { auto a = Atomic(); return count;   }
+
+        uint16_t missedCount()  { auto a = Atomic(); return missed;  }
+        uint16_t droppedCount() { auto a = Atomic(); return dropped; }
+
+    private:
+        const TIMER*       timer;
+        Debug*             debug;
+        bool               dropLate;
+        uint8_t            count;
+        uint16_t           missed;
+        uint16_t           dropped;
+        EdfEntry           heap[SIZE];
+        FIFO<Event, SIZE + 1> background;    /* holds SIZE */
+
+        /* True if deadline a is earlier than b, allowing for the wrap */
+        static bool before(const uint16_t& a, const uint16_t& b) { return (int16_t) (a - b) < 0; }
+
+        /* Removes the root, sifting the last entry down from the top */
+        void pop()
+        {
+            EdfEntry last = heap[--count];
+            uint8_t idx = 0;
+            while (true)
+            {
+                uint16_t child = 2 * idx + 1;
+                if (child >= count) break;
+                if ((child + 1 < count) && before(heap[child + 1].deadline, heap[child].deadline)) child += 1;
+                if (!before(heap[child].deadline, last.deadline)) break;
+                heap[idx] = heap[child];
+                idx = child;
+            }
+            heap[idx] = last;
+        }
+    };
+
+    /**********************************************************
+     *
+     * Deferred logging
+     *
+     * Formatting text on the target is slow and the strings use
+     * a lot of flash.  Instead, each log call writes a message ID
+     * (1 or 2 bytes) and the raw argument bytes into a ring
+     * buffer, which is drained (e.g. over the UART) when the CPU
+     * is idle.  tools/logdecode turns the stream back into text.
+     *
+     * The messages are listed in a definition file, which is
+     * shared by the target and by tools/logdecode:
+     *
+     *   STEDOS_MESSAGE(BOOT,   "boot")
+     *   STEDOS_MESSAGE(SAMPLE, "adc ch=%u value=%u", uint8_t, uint16_t)
+     *
+     * The file is named by STEDOS_MESSAGES before stedos.h is
+     * included, and is found through the include path.  Each
+     * argument is converted to the type given in the definition:
+     *
+     *   #define STEDOS_MESSAGES "messages.def"
+     *   #include "stedos.h"
+     *
+     *   STEDOS_LOG_INFO(SAMPLE, channel, value);
+     *
+     *   while(1)
+     *   {
+     *       queue.process();
+     *       stedos::log::ring().drain(uart_put);
+     *   }
+     *
+     * Log calls below STEDOS_LOG_LEVEL are removed by the
+     * preprocessor, so their arguments are not even evaluated.
+     *
+     **********************************************************/
+
+    #ifndef STEDOS_LOG_LEVEL
+    #define STEDOS_LOG_LEVEL LEVEL_INFO
+    #endif
+
+    #ifndef STEDOS_LOG_SIZE
+    #define STEDOS_LOG_SIZE (64)
+    #endif
+
+    namespace log
+    {
+        /* The ring buffer that holds the log records.
+           Writers disable interrupts for the few byte stores of one
+           record.  The reader never disables interrupts, as it is
+           the only one that changes tail. */
+        template <int SIZE>
+        class LogRing
+        {
+            static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+            static_assert(SIZE <= 128, "");
+
+            static const uint8_t MASK = (SIZE - 1);
+
+        public:
+            constexpr LogRing() : buffer(), head(0), tail(0), dropped(0) {};
+
+            /* Writes a whole record, or nothing if there isn't room */
+            bool write(const uint8_t* record, const uint8_t& n)
+            {
+                auto a = Atomic();
+                uint8_t h = head;
+                if ((uint8_t) (SIZE - (uint8_t) (h - tail)) < n)
+                {
+                    if (dropped < 0xff) dropped += 1;
+                    return false;
+                }
+                for (uint8_t idx=0; idx<n; idx+=1)
+                {
+                    buffer[(uint8_t) (h + idx) & MASK] = record[idx];
+                }
+                asm volatile ("" ::: "memory");
+                head = h + n;
+                return true;
+            }
+
+            /* Reads the next byte.  Returns false if the ring is empty */
+            bool read(uint8_t& b)
             {
-                v &= MASK; /* use MASK to limit index (optimisation if SIZE is a power of 2) */
+                uint8_t t = tail;
+                if (head == t) return false;
+                b = buffer[t & MASK];
+                asm volatile ("" ::: "memory");
+                tail = t + 1;
+                return true;
             }
-            else
+
+            /* Passes bytes to put() until the ring is empty or put()
+               returns false because the output is full */
+            void drain(bool (*put)(uint8_t))
             {
-                if(v == SIZE)
+                uint8_t t = tail;
+                while ((head != t) && put(buffer[t & MASK]))
                 {
-                    v = 0;  // use SIZE to limit index
+                    t += 1;
+                    tail = t;
                 }
             }
+
+            bool isEmpty() const { return head == tail; }
+
+            /* Number of records lost because the ring was full */
+            uint8_t droppedCount() const { return dropped; }
+
+        private:
+            uint8_t buffer[SIZE];
+            volatile uint8_t head;  /* free running write index */
+            volatile uint8_t tail;  /* free running read index  */
+            uint8_t dropped;
+        };
+
+        /* The ring used by the STEDOS_LOG macros */
+        inline LogRing<STEDOS_LOG_SIZE>& ring()
+        {
+            static LogRing<STEDOS_LOG_SIZE> r;
+            return r;
         }
 
-    };
+        namespace _internal
+        {
+            template <typename... T> struct arg_bytes;
+            template <> struct arg_bytes<> { static const uint8_t value = 0; };
+            template <typename T, typename... REST>
+            struct arg_bytes<T, REST...> { static const uint8_t value = sizeof(T) + arg_bytes<REST...>::value; };
+
+            /* Copies v into the record, little endian (the same as the AVR) */
+            template <typename T>
+            uint8_t* put(uint8_t* p, T v)
+            {
+                for (uint8_t idx=0; idx<sizeof(T); idx+=1)
+                {
+                    p[idx] = (uint8_t) v;
+                    v = (T) (v >> 8);
+                }
+                return p + sizeof(T);
+            }
+        }
 
+        /* Args holds the argument types of a message */
+        template <typename... T>
+        struct Args
+        {
+            static const uint8_t BYTES = _internal::arg_bytes<T...>::value;
 
-    /* Array - handles an array of items */
+            template <typename... U>
+            static void write(const uint16_t& id, U... values)
+            {
+                static_assert(sizeof...(T) == sizeof...(U), "wrong number of arguments for this message");
 
-    template<typename T, int SIZE>
-    class Array
-    {
-        static_assert(SIZE > 0, "");
-        static_assert(SIZE <= 256, "");
+                uint8_t  record[2 + BYTES];
+                uint8_t* p = record;
+                if (id < 0x80)
+                {
+                    *p++ = id;
+                }
+                else
+                {
+                    *p++ = 0x80 | (id & 0x7f);
+                    *p++ = id >> 7;
+                }
+                int expand[] = { 0, (p = _internal::put<T>(p, static_cast<T>(values)), 0)... };
+                (void) expand;
 
-    public:
-        /* Adds an item to the back of the array */
-        void     append(const T& v) { array[length] = v; length += 1; }
+                ring().write(record, p - record);
+            }
+        };
 
-        /* Adds an item at the specified index */
-        void     insert(const T& v, uint8_t idx=0) { /* Not implemented */ }
+        #ifdef STEDOS_MESSAGES
+            /* The message IDs */
+            enum message_id
+            {
+                #define STEDOS_MESSAGE(name, format, ...) name,
+                #include STEDOS_MESSAGES
+                #undef STEDOS_MESSAGE
+                MESSAGE_COUNT
+            };
+
+            /* The argument types of each message */
+            #define STEDOS_MESSAGE(name, format, ...) typedef Args<__VA_ARGS__> name##_args;
+            #include STEDOS_MESSAGES
+            #undef STEDOS_MESSAGE
+        #endif
+    }
 
-        /* Removes an item at the specified index */
-        const T& remove(uint8_t idx) { /* Not implemented */  }
+    #define STEDOS_LOG(name, ...) stedos::log::name##_args::write(stedos::log::name, ##__VA_ARGS__)
 
-        /* Removes an item at the back of the array */
-        const T& pop()              { length -= 1; return array[length]; }
+    #if STEDOS_LOG_LEVEL >= LEVEL_TRACE
+    #define STEDOS_LOG_TRACE(name, ...) STEDOS_LOG(name, ##__VA_ARGS__)
+    #else
+    #define STEDOS_LOG_TRACE(name, ...) do {} while (0)
+    #endif
 
-        const T& operator[] (uint8_t idx) { return array[idx]; }
+    #if STEDOS_LOG_LEVEL >= LEVEL_INFO
+    #define STEDOS_LOG_INFO(name, ...) STEDOS_LOG(name, ##__VA_ARGS__)
+    #else
+    #define STEDOS_LOG_INFO(name, ...) do {} while (0)
+    #endif
 
-    private:
-        T array[SIZE];
-        uint8_t length;
-    };
+    #if STEDOS_LOG_LEVEL >= LEVEL_WARN
+    #define STEDOS_LOG_WARN(name, ...) STEDOS_LOG(name, ##__VA_ARGS__)
+    #else
+    #define STEDOS_LOG_WARN(name, ...) do {} while (0)
+    #endif
 
+    #if STEDOS_LOG_LEVEL >= LEVEL_ERROR
+    #define STEDOS_LOG_ERROR(name, ...) STEDOS_LOG(name, ##__VA_ARGS__)
+    #else
+    #define STEDOS_LOG_ERROR(name, ...) do {} while (0)
+    #endif
 
+    #define STEDOS_LOG_FATAL(name, ...) STEDOS_LOG(name, ##__VA_ARGS__)
 
     /**********************************************************
      *
-     * Event processing
+     * Event recording
+     *
+     * Recorder is an EventProcessor policy (in place of the
+     * Profiler) that writes every event that is dispatched, in
+     * the order that it is dispatched, to a compact binary
+     * stream.  The timer ticks between them and the external
+     * inputs that the handlers read are written as well.  The
+     * stream is drained like the log ring, e.g. over the UART.
+     *
+     * The order that the events run in is what interrupt timing
+     * changes, so tools/replay can reproduce a run on a PC by
+     * calling the same handlers, with the same data, in the same
+     * order.  The events that the handlers queue while replaying
+     * are not run, they are already in the stream.
+     *
+     * Handlers are recorded by their index in a table, so that
+     * the replay can be built for a different target.  Event
+     * data is recorded as it is, so pointers can't be replayed.
+     *
+     * Anything a handler reads that came from outside, e.g. a
+     * register or a buffer filled by an ISR, must be passed
+     * through input(), which records it.  When replaying,
+     * input() returns the recorded value instead.
+     *
+     * Example:
+     *
+     *   const stedos::event_func_t handlers[] PROGMEM = { sample, received };
+     *
+     *   stedos::EventProcessor<16, stedos::Recorder<64> > queue;
+     *   queue.profiler.begin(handlers, 2);
+     *
+     *   ISR(TIMER0_COMPA_vect) { queue.profiler.tick(); timer.tick(); }
+     *
+     *   void sample(uintptr_t data)
+     *   {
+     *       uint16_t v = queue.profiler.input(ADC_CHANNEL, adc.read());
+     *   }
+     *
+     * Stream format: each record starts with a tag byte, whose
+     * low 6 bits are a count, a handler index or a channel (see
+     * record_tag).  Values are unsigned LEB128 varints, 7 bits
+     * per byte, low bits first.
+     *
+     * Template Parameters:
+     *   SIZE - bytes in the ring (a power of 2, up to 128)
      *
      **********************************************************/
 
-
-    /* Define a function prototype to use for structures */
-    typedef void (*event_func_t) (uintptr_t data);
-
-    /* Define a struct used to store a function pointer
-       and the user data associated with it
-    */
-
-    struct Event
+    enum record_tag
     {
-        event_func_t func;
-        uintptr_t    data;
-
-        Event() {};
-        Event(event_func_t f) : func(f) {};
-        Event(event_func_t f, uintptr_t d) : func(f), data(d) {};
-
+        RECORD_TICKS = 0x00,    /* n ticks passed (1-63), 0 starts a recording  */
+        RECORD_EVENT = 0x40,    /* handler index, then the data                 */
+        RECORD_INPUT = 0x80,    /* input channel, then the value                */
+        RECORD_LOST  = 0xc0,    /* n records (1-63) lost because the ring was full */
+        RECORD_MASK  = 0xc0,
     };
 
-    class EventProcessorInterface
+    /* Supplies input() with the recorded values during a replay */
+    class ReplaySource
     {
     public:
-        virtual void queueEvent(event_func_t func) =0;
-        virtual void queueEvent(event_func_t func, uintptr_t data) =0;
-        virtual void queueEvent(const Event& event) =0;
-        virtual void process() = 0;
+        virtual bool input(const uint8_t& channel, uint32_t& value) = 0;
     };
 
-    template <int SIZE>
-    class EventProcessor : public EventProcessorInterface
+    namespace _internal
     {
-    public:
-        /** Adds an event to the queue */
-        void queueEvent(event_func_t func)                 { events.push(Event(func));   }
-        void queueEvent(event_func_t func, uintptr_t data) { events.push({ func, data}); }
-        void queueEvent(const Event& event)                { events.push(event);         }
-        void process()
+        /* Writes v as a varint.  Returns the number of bytes */
+        template <typename T>
+        uint8_t varint(uint8_t* p, T v)
         {
-            while(events.isEmpty() == false)
+            uint8_t n = 0;
+            while (v >= 0x80)
             {
-                Event event = events.pop();
-                event.func(event.data);
+                p[n++] = (uint8_t) v | 0x80;
+                v >>= 7;
             }
+            p[n++] = (uint8_t) v;
+            return n;
         }
+    }
 
-    private:
-        FIFO<Event, SIZE> events;
-    };
-
-    extern "C" void __cxa_pure_virtual() { while (1); }
-
-    /**********************************************************
-     *
-     * Delayed Event processing (Timer Module)
-     *
-     **********************************************************/
-
-    /* The Timer Module uses policy based class design to implement
-       the actual details of the timer.  This is so that the timer code
-       can be optimised for the application required.
-
-       Timer Implementations should inherit from this base class
-    */
-    class TimerImplementationInterface
+    template <int SIZE=64>
+    class Recorder
     {
     public:
-        /* tick() is called on every timer tick */
-        virtual void    tick(void) = 0;
-
-        /* add() is called to add a new timer */
-        virtual uint8_t add(uint16_t timeout, Event event) = 0;
-
-        /* remove() is called to remove a timer, using the handle returned by add */
-        virtual void    remove(uint8_t handle) = 0;
-        
-    };
+        /* The index recorded for a handler that isn't in the table */
+        static const uint8_t UNKNOWN = 0x3f;
 
-    /* 
-       Simple Timer Implmentation.  This maintains a list of
-       timers, which are decremented on each tick.  When the count is 0,
-       the callback is executed.
-    */
+        Recorder() : handlers(0), count(0), ticks(0), lost(0), source(0) {};
 
-    /* Struct to keep information on each timer */
-    struct TimerQueue_t
-    {
-        uint16_t ticks;     /* Ticks remaining             */
-        Event    event;     /* Event to activate on expiry */
-    };
+        /* Starts a recording.  table (which may be in flash) lists
+           up to 63 handlers */
+        void begin(const event_func_t* table, const uint8_t& n)
+        {
+            handlers = table;
+            count    = (n < UNKNOWN) ? n : UNKNOWN;
 
-    template<int SIZE>
-    class SimpleTimerImplementation : public TimerImplementationInterface
-    {
-    public:
-        /* Constructor */
-        SimpleTimerImplementation(EventProcessorInterface* p) : processor(p) {};
+            uint8_t start = RECORD_TICKS;
+            append(&start, 1);
+        }
 
-        /* tick() adds a timer event to the queue */
-        void tick(void)
+        /* Counts a timer tick.  Call it from the timer ISR.  The
+           ticks are kept while the ring is full and written when
+           there is room, up to 65535 of them */
+        void tick()
         {
             auto a = Atomic();
-            /* Go through all of the queue items.
-               Decrement them and call the callback if necessary.  */
-            for (uint8_t idx=0; idx<SIZE; idx+=1)
-            {
-                if (queue[idx].ticks > 0)
-                {
-                    queue[idx].ticks -= 1;
-
-                    if (queue[idx].ticks == 0)
-                    {
-                        processor->queueEvent(queue[idx].event);
-                    }
-                }
-            }
+            if (ticks < 0xffff) ticks += 1;
+            else if (lost < 0x3f) lost += 1;
+            if (ticks >= 0x3f) flush();
         }
 
-        /* add an event to be timed */
-        uint8_t add(uint16_t timeout, Event event)
+        /* Records an input that a handler is using and returns it.
+           When replaying, returns the recorded value */
+        template <typename T>
+        T input(const uint8_t& channel, const T& value)
         {
-            auto a = Atomic();
-            for (uint8_t idx=0; idx<SIZE; idx+=1)
+            if (source)
             {
-                if (queue[idx].ticks == 0)
-                {
-                    queue[idx].ticks = timeout;
-                    queue[idx].event = event;
-                    return idx;
-                }
+                uint32_t v;
+                return source->input(channel & 0x3f, v) ? (T) v : value;
             }
 
-            return 0xff; /* Invalid Handle */
-        }
-
-        /* Remove handle from the list */
-        void    remove(uint8_t handle)
-        {
-            auto a = Atomic();
-            queue[handle].ticks = 0;
+            uint8_t record[1 + 5];
+            record[0] = RECORD_INPUT | (channel & 0x3f);
+            append(record, 1 + _internal::varint(record + 1, (uint32_t) value));
+            return value;
         }
 
-    private:
-        TimerQueue_t queue[SIZE];
-        EventProcessorInterface* processor;
-    };
-
-    template<class T>
-    class Timer : public T
-    {
-        //virtual void callback(callbackFunction f, void* userData) { f(userData); };
-    };
-
-    /**********************************************************
-     *
-     * Debug
-     *
-     * Debugging is useful, however, it can be quite hard on
-     * microprocessors due to their limited resources.  The
-     * debug class provides a null implementation for a number
-     * of debug functions.  To get debug out of the class, this
-     * class should be subclassed and the required functionality
-     * provided.
-     *
-     **********************************************************/
-
-    struct Debug
-    {
-        /* This function should be called when something bad has happened */
-        void assert() {};
-
-        /* The folowing functions are used to output debug messages.  The
-           debug levels are used as follows:
+        /* Makes input() return the values from s (0 to record again) */
+        void replay(ReplaySource* s) { source = s; }
+        bool isReplaying() const     { return source != 0; }
 
-           * info  - general purpose information
-           * warn  - warning (something might not be right)
-           * error - a recoverable error has occurred
-           * fatal - something very bad has happened
-        */ 
+        /* Passes the stream to put(), see log::LogRing::drain() */
+        void drain(bool (*put)(uint8_t)) { ring.drain(put); }
+        bool isEmpty() const             { return ring.isEmpty(); }
 
-        /* Adjust the level of the output */
-        void setLevel(const uint8_t& l) { level = l; }
+        /* The policy functions, called by EventProcessor */
+        void poll() {}
 
-        /* This function is used to output a debug string */
-        virtual void log(const uint8_t& level, const char& output)  {}
+        void enter(const Event& e)
+        {
+            uint8_t record[1 + (sizeof(uintptr_t) * 8 + 6) / 7];
+            record[0] = RECORD_EVENT | find(e.func);
+            append(record, 1 + _internal::varint(record + 1, e.data));
+        }
 
-        Debug(const uint8_t& l=3) : level(l) {};
+        void leave(const event_func_t& f) {}
 
     private:
-        uint8_t level;
+        log::LogRing<SIZE>  ring;
+        const event_func_t* handlers;
+        uint8_t             count;
+        uint16_t            ticks;  /* ticks not written yet              */
+        uint8_t             lost;   /* records lost since the last write  */
+        ReplaySource*       source;
+
+        uint8_t find(const event_func_t& f) const
+        {
+            for (uint8_t idx=0; idx<count; idx+=1)
+            {
+                if (_internal::flash_read(&handlers[idx]) == f) return idx;
+            }
+            return UNKNOWN;
+        }
 
-    };
+        /* Writes the ticks and the lost count, so that the next
+           record is in the right place */
+        bool flush()
+        {
+            while (ticks)
+            {
+                uint8_t n = (ticks < 0x3f) ? ticks : 0x3f;
+                uint8_t t = RECORD_TICKS | n;
+                if (!ring.write(&t, 1)) return false;
+                ticks -= n;
+            }
+            if (lost)
+            {
+                uint8_t l = RECORD_LOST | lost;
+                if (!ring.write(&l, 1)) return false;
+                lost = 0;
+            }
+            return true;
+        }
 
-    #define LEVEL_TRACE (4)
-    #define LEVEL_INFO  (3)
-    #define LEVEL_WARN  (2)
-    #define LEVEL_ERROR (1)
-    #define LEVEL_FATAL (0)
+        void append(const uint8_t* record, const uint8_t& n)
+        {
+            auto a = Atomic();
+            if (flush() && ring.write(record, n)) return;
+            if (lost < 0x3f) lost += 1;
+        }
+    };
 
 }
 /*
@@ -919,54 +5684,6 @@ private:
     T items[maxItems];
 };
 
-template <class T, int maxItems>
-class LinkedList
-{
-public:
-    LinkedList() : first(NULL), last(NULL) {};
-    void pushBack(T& item)
-    {
-        ItemData* item = addItem(item);
-        item->next = NULL;
-        this->last->next = item;
-        this->last = item;
-
-        if(this->first == NULL) this->first = item;
-    };
-    void pushFront(T& item)
-    {
-        ItemData* item = addItem(item);
-        item->next = this->first;
-        this->first = item;
-
-        if(this->last == NULL) this->last = item;
-    };
-private:
-    class ItemData
-    {
-        uint8_t inUse;
-        T data;
-        ItemData* next;
-    } items[maxItems];
-
-    ItemData* first;
-    ItemData* last;
-
-    ItemData* addItem(T& item)
-    {
-        for(uint16_t idx=0; idx<maxItems; idx+=1)
-        {
-            if (items[idx].inUse == 0)
-            {
-                items[idx].data = item;
-                items[idx].inUse = 1;
-                return &items[idx];
-            }
-        }
-        return NULL;
-    }
-};
-
 template <int maxEvents>
 void SimpleProcess<maxEvents>::queueEvent(callbackFunction f, void* data)
 {
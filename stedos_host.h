@@ -0,0 +1,705 @@
+/*
+ * StedOS - host simulation backend
+ *
+ * Include this instead of <avr/io.h> to build stedos on a PC.
+ * It provides simulated port registers, cli() / sei() and a
+ * model of the global interrupt flag, so that the library can
+ * be tested without any hardware.
+ *
+ * Every register access and every critical section is counted,
+ * which allows the cost of the stedos primitives to be measured
+ * and checked by the tests.
+ *
+ * (c) stedmeister
+ *
+ * Licesnse TBD
+ */
+
+#include <stdint.h>
+
+namespace stedos
+{
+    namespace host
+    {
+        /**********************************************************
+         *
+         * Access counters
+         *
+         **********************************************************/
+
+        struct Counters
+        {
+            uint32_t reads;         /* register reads                      */
+            uint32_t writes;        /* register writes                     */
+            uint32_t critical;      /* critical sections entered (cli())   */
+            uint32_t interrupts;    /* interrupt service routines executed */
+        };
+
+        inline Counters& counters()
+        {
+            static Counters c = { 0, 0, 0, 0 };
+            return c;
+        }
+
+        /* Zeroes all of the counters */
+        inline void resetCounters()
+        {
+            Counters zero = { 0, 0, 0, 0 };
+            counters() = zero;
+        }
+
+        /**********************************************************
+         *
+         * Registers
+         *
+         * Register behaves like a volatile uint8_t, but counts
+         * each access.  A read-modify-write such as |= counts as
+         * one read and one write, the same as on the AVR.
+         *
+         * The PIN register of a port is special: reading it
+         * returns the level on the pins and writing a 1 toggles
+         * the corresponding PORT bit.
+         *
+         **********************************************************/
+
+        struct io_port;
+
+        class Register
+        {
+        public:
+            /* Called after each write with the value before it, so
+               that a control register can start an action */
+            typedef void (*hook_t)(const uint8_t& previous);
+
+            Register() : value(0), hook(0), owner(0) {};
+
+            operator uint8_t() const
+            {
+                counters().reads += 1;
+                return get();
+            }
+
+            Register& operator = (const uint8_t& v)
+            {
+                counters().writes += 1;
+                put(v);
+                return *this;
+            }
+
+            uint8_t operator |= (const uint8_t& v) { uint8_t r = uint8_t(*this) | v; *this = r; return r; }
+            uint8_t operator &= (const uint8_t& v) { uint8_t r = uint8_t(*this) & v; *this = r; return r; }
+            uint8_t operator ^= (const uint8_t& v) { uint8_t r = uint8_t(*this) ^ v; *this = r; return r; }
+
+            /* The stored value.  Tests may use this directly
+               to inspect or set a register without it being counted */
+            uint8_t value;
+
+            hook_t hook;
+
+        private:
+            friend struct io_port;
+            io_port* owner;    /* Set for PIN registers only */
+
+            inline uint8_t get() const;
+            inline void    put(const uint8_t& v);
+        };
+
+        /* The simulated registers for a single port */
+        struct io_port
+        {
+            Register port;
+            Register pin;
+            Register ddr;
+            uint8_t  input;    /* level driven onto the pins from outside */
+
+            io_port() : input(0) { pin.owner = this; }
+
+            /* The level seen on the pins.  Outputs read back
+               the PORT value, inputs read the external level */
+            uint8_t level() const
+            {
+                return (port.value & ddr.value) | (input & ~ddr.value);
+            }
+        };
+
+        uint8_t Register::get() const
+        {
+            return owner ? owner->level() : value;
+        }
+
+        void Register::put(const uint8_t& v)
+        {
+            uint8_t previous = value;
+            if (owner) owner->port.value ^= v; else value = v;
+            if (hook) hook(previous);
+        }
+
+        /* Ports B, C and D are simulated, the same as an atmega328p.
+           The table is indexed in the same way as the stedos port table */
+        inline io_port* ports()
+        {
+            static io_port table[7];
+            return table;
+        }
+
+        /* The simulated registers for a USART.  Tests set udr.value
+           before raising the receive interrupt, and read it after
+           the transmit interrupt */
+        struct usart
+        {
+            Register udr;
+            Register ucsra;
+            Register ucsrb;
+            Register ucsrc;
+            Register ubrrl;
+            Register ubrrh;
+        };
+
+        inline usart* usarts()
+        {
+            static usart table[1];
+            return table;
+        }
+
+        /* The simulated ADC registers.  Tests use convert() to
+           supply the result of each conversion */
+        struct adc_unit
+        {
+            Register admux;
+            Register adcsra;
+            Register adcsrb;
+            Register adcl;
+            Register adch;
+        };
+
+        inline adc_unit& adc()
+        {
+            static adc_unit unit;
+            return unit;
+        }
+
+        /* The simulated SPI and TWI registers.  Tests play the part
+           of the slave: they read what was written to the data
+           register and set the reply before raising the interrupt */
+        struct spi_unit
+        {
+            Register spcr;
+            Register spsr;
+            Register spdr;
+        };
+
+        inline spi_unit& spi()
+        {
+            static spi_unit unit;
+            return unit;
+        }
+
+        struct twi_unit
+        {
+            Register twbr;
+            Register twsr;
+            Register twar;
+            Register twdr;
+            Register twcr;
+        };
+
+        inline twi_unit& twi()
+        {
+            static twi_unit unit;
+            return unit;
+        }
+
+        /* The timer interrupt flag registers.  Like the hardware,
+           writing a 1 to a flag clears it */
+        struct timer_flags
+        {
+            Register tifr0;
+            Register tifr1;
+
+            timer_flags()
+            {
+                tifr0.hook = clear0;
+                tifr1.hook = clear1;
+            }
+
+            static inline void clear0(const uint8_t& previous);
+            static inline void clear1(const uint8_t& previous);
+        };
+
+        inline timer_flags& timers()
+        {
+            static timer_flags unit;
+            return unit;
+        }
+
+        inline void timer_flags::clear0(const uint8_t& previous) { timers().tifr0.value = previous & ~timers().tifr0.value; }
+        inline void timer_flags::clear1(const uint8_t& previous) { timers().tifr1.value = previous & ~timers().tifr1.value; }
+
+        /* Drives the external level of the pins of a port */
+        inline void drive(const uint8_t& id, const uint8_t& levels)
+        {
+            ports()[id].input = levels;
+        }
+
+        /**********************************************************
+         *
+         * Interrupts
+         *
+         * interrupt() requests an ISR.  If interrupts are enabled
+         * it runs immediately, with interrupts disabled, and they
+         * are enabled again when it returns (as reti does).  If
+         * they are disabled, the request is held pending and runs
+         * when sei() is next called.
+         *
+         **********************************************************/
+
+        typedef void (*isr_t)(void);
+
+        struct cpu_state
+        {
+            uint8_t enabled;        /* global interrupt flag */
+            uint8_t pendingCount;
+            isr_t   pending[8];
+        };
+
+        inline cpu_state& cpu()
+        {
+            static cpu_state state = { 0, 0, { 0 } };
+            return state;
+        }
+
+        inline bool interruptsEnabled() { return cpu().enabled != 0; }
+
+        inline void run(isr_t isr)
+        {
+            counters().interrupts += 1;
+            cpu().enabled = 0;
+            isr();
+            cpu().enabled = 1;
+        }
+
+        /* Runs any interrupts that were requested while disabled */
+        inline void runPending()
+        {
+            cpu_state& c = cpu();
+            while (c.enabled && (c.pendingCount > 0))
+            {
+                isr_t isr = c.pending[0];
+                c.pendingCount -= 1;
+                for (uint8_t idx=0; idx<c.pendingCount; idx+=1)
+                {
+                    c.pending[idx] = c.pending[idx + 1];
+                }
+                run(isr);
+            }
+        }
+
+        /* SREG behaves like the status register.  Only the global
+           interrupt flag (bit 7) is modelled.  Writing it with the
+           flag set runs any pending interrupts. */
+        class StatusRegister
+        {
+        public:
+            operator uint8_t() const
+            {
+                counters().reads += 1;
+                return cpu().enabled ? 0x80 : 0x00;
+            }
+
+            StatusRegister& operator = (const uint8_t& v)
+            {
+                counters().writes += 1;
+                cpu().enabled = (v & 0x80) ? 1 : 0;
+                runPending();
+                return *this;
+            }
+        };
+
+        inline StatusRegister& sreg()
+        {
+            static StatusRegister r;
+            return r;
+        }
+
+        inline void interrupt(isr_t isr)
+        {
+            cpu_state& c = cpu();
+            if (c.enabled)
+            {
+                run(isr);
+                runPending();
+                return;
+            }
+
+            /* Like the AVR interrupt flags, a vector is only pending once */
+            for (uint8_t idx=0; idx<c.pendingCount; idx+=1)
+            {
+                if (c.pending[idx] == isr) return;
+            }
+            if (c.pendingCount < 8)
+            {
+                c.pending[c.pendingCount] = isr;
+                c.pendingCount += 1;
+            }
+        }
+
+        /* Completes an ADC conversion with the result value
+           and requests its interrupt */
+        inline void convert(const uint16_t& value, isr_t isr)
+        {
+            adc().adcl.value = value & 0xff;
+            adc().adch.value = value >> 8;
+            interrupt(isr);
+        }
+
+        /**********************************************************
+         *
+         * EEPROM
+         *
+         * The EEPROM of an atmega328p.  Writing EECR strobes a read
+         * or starts a write, as on the AVR.  A write is ignored
+         * unless EEMPE was set by the write before.  It stays in
+         * progress (EEPE set) until the test calls eepromStep(),
+         * which completes it, adds the write time and counts the
+         * wear on the cell.
+         *
+         **********************************************************/
+
+        struct eeprom_unit
+        {
+            enum
+            {
+                SIZE       = 1024,
+                WRITE_US   = 3400,  /* erase and write time of one byte */
+
+                EERE_MASK  = 0x01,
+                EEPE_MASK  = 0x02,
+                EEMPE_MASK = 0x04,
+                EERIE_MASK = 0x08,
+            };
+
+            Register eecr;
+            Register eedr;
+            Register eearl;
+            Register eearh;
+
+            uint8_t  memory[SIZE];
+            uint32_t wear[SIZE];    /* writes to each cell             */
+            uint32_t writes;        /* total bytes written             */
+            uint32_t elapsed;       /* microseconds spent writing      */
+
+            bool     busy;          /* a write is in progress          */
+            uint16_t latchAddress;
+            uint8_t  latchData;
+
+            uint16_t address() const { return ((eearh.value << 8) | eearl.value) & (SIZE - 1); }
+
+            /* Erases the memory and zeroes the counters */
+            void reset()
+            {
+                for (uint16_t idx=0; idx<SIZE; idx+=1)
+                {
+                    memory[idx] = 0xff;
+                    wear[idx]   = 0;
+                }
+                writes  = 0;
+                elapsed = 0;
+                busy    = false;
+                eecr.value = 0;
+            }
+
+            eeprom_unit() { reset(); eecr.hook = control; }
+
+            static void control(const uint8_t& previous);
+        };
+
+        inline eeprom_unit& eeprom()
+        {
+            static eeprom_unit unit;
+            return unit;
+        }
+
+        inline void eeprom_unit::control(const uint8_t& previous)
+        {
+            eeprom_unit& e = eeprom();
+            uint8_t v = e.eecr.value;
+
+            /* Reads are ignored while a write is in progress */
+            if (v & EERE_MASK)
+            {
+                if (!e.busy) e.eedr.value = e.memory[e.address()];
+                v &= ~EERE_MASK;
+            }
+
+            if ((v & EEPE_MASK) && !(previous & EEPE_MASK))
+            {
+                if ((previous & EEMPE_MASK) && !e.busy)
+                {
+                    e.busy         = true;
+                    e.latchAddress = e.address();
+                    e.latchData    = e.eedr.value;
+                }
+                else
+                {
+                    v &= ~EEPE_MASK;
+                }
+                v &= ~EEMPE_MASK;
+            }
+            e.eecr.value = v;
+        }
+
+        /* Completes the write in progress, if any, and then requests
+           the EEPROM ready interrupt if it is enabled.  Returns
+           false once there is nothing more to do */
+        inline bool eepromStep(isr_t isr)
+        {
+            eeprom_unit& e = eeprom();
+            bool wrote = e.busy;
+            if (e.busy)
+            {
+                e.memory[e.latchAddress] = e.latchData;
+                e.wear[e.latchAddress]  += 1;
+                e.writes                += 1;
+                e.elapsed               += eeprom_unit::WRITE_US;
+                e.busy                   = false;
+                e.eecr.value            &= ~eeprom_unit::EEPE_MASK;
+            }
+            if (e.eecr.value & eeprom_unit::EERIE_MASK)
+            {
+                interrupt(isr);
+                return true;
+            }
+            return wrote;
+        }
+
+        /**********************************************************
+         *
+         * Watchdog
+         *
+         * The watchdog counts the time that the test says has
+         * passed with watchdogElapse().  When it expires it sets
+         * WDRF in MCUSR, as a reset does, stops, and calls the
+         * reset hook, which can longjmp() back to a simulated
+         * power up.
+         *
+         **********************************************************/
+
+        struct watchdog_unit
+        {
+            bool     enabled;
+            uint16_t timeout;       /* ms */
+            uint16_t elapsed;       /* ms since the last wdt_reset() */
+            uint32_t feeds;
+            uint32_t resets;
+            void   (*reset)(void);
+            Register mcusr;
+
+            enum { WDRF_MASK = 0x08 };
+
+            watchdog_unit() : enabled(false), timeout(0), elapsed(0), feeds(0), resets(0), reset(0) {};
+        };
+
+        inline watchdog_unit& watchdog()
+        {
+            static watchdog_unit unit;
+            return unit;
+        }
+
+        /* Returns true if the watchdog expired (and the hook returned) */
+        inline bool watchdogElapse(const uint16_t& ms)
+        {
+            watchdog_unit& w = watchdog();
+            if (!w.enabled) return false;
+
+            w.elapsed += ms;
+            if (w.elapsed < w.timeout) return false;
+
+            w.enabled      = false;
+            w.elapsed      = 0;
+            w.resets      += 1;
+            w.mcusr.value |= watchdog_unit::WDRF_MASK;
+            if (w.reset) w.reset();
+            return true;
+        }
+    }
+}
+
+inline void cli()
+{
+    stedos::host::counters().critical += 1;
+    stedos::host::cpu().enabled = 0;
+}
+
+inline void sei()
+{
+    stedos::host::cpu().enabled = 1;
+    stedos::host::runPending();
+}
+
+#define SREG (stedos::host::sreg())
+
+/* The watchdog, as in <avr/wdt.h>.  The timeouts are 16 ms << WDTO */
+inline void wdt_reset()
+{
+    stedos::host::watchdog().elapsed = 0;
+    stedos::host::watchdog().feeds  += 1;
+}
+
+inline void wdt_enable(const uint8_t& timeout)
+{
+    stedos::host::watchdog().enabled = true;
+    stedos::host::watchdog().timeout = 16 << timeout;
+    stedos::host::watchdog().elapsed = 0;
+}
+
+inline void wdt_disable()
+{
+    stedos::host::watchdog().enabled = false;
+}
+
+#define WDTO_15MS  0
+#define WDTO_30MS  1
+#define WDTO_60MS  2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S    6
+#define WDTO_2S    7
+#define WDTO_4S    8
+#define WDTO_8S    9
+
+#define MCUSR (stedos::host::watchdog().mcusr)
+
+#define WDRF  3
+#define BORF  2
+#define EXTRF 1
+#define PORF  0
+
+/* ISRs become plain functions that are run with stedos::host::interrupt() */
+#define ISR(vector, ...) extern "C" void vector(void)
+
+#define _BV(bit) (1 << (bit))
+
+/* Tell stedos.h to access registers through the simulation */
+#define STEDOS_REGISTER stedos::host::Register
+
+#define PORTB (stedos::host::ports()[1].port)
+#define PINB  (stedos::host::ports()[1].pin)
+#define DDRB  (stedos::host::ports()[1].ddr)
+
+#define PORTC (stedos::host::ports()[2].port)
+#define PINC  (stedos::host::ports()[2].pin)
+#define DDRC  (stedos::host::ports()[2].ddr)
+
+#define PORTD (stedos::host::ports()[3].port)
+#define PIND  (stedos::host::ports()[3].pin)
+#define DDRD  (stedos::host::ports()[3].ddr)
+
+/* USART 0, with the same bit positions as an atmega328p */
+#define UDR0   (stedos::host::usarts()[0].udr)
+#define UCSR0A (stedos::host::usarts()[0].ucsra)
+#define UCSR0B (stedos::host::usarts()[0].ucsrb)
+#define UCSR0C (stedos::host::usarts()[0].ucsrc)
+#define UBRR0L (stedos::host::usarts()[0].ubrrl)
+#define UBRR0H (stedos::host::usarts()[0].ubrrh)
+
+#define RXC0   7
+#define TXC0   6
+#define UDRE0  5
+#define FE0    4
+#define DOR0   3
+#define UPE0   2
+#define U2X0   1
+#define MPCM0  0
+
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0  4
+#define TXEN0  3
+#define UCSZ02 2
+
+#define USBS0  3
+#define UCSZ01 2
+#define UCSZ00 1
+
+/* The ADC, with the same bit positions as an atmega328p */
+#define ADMUX  (stedos::host::adc().admux)
+#define ADCSRA (stedos::host::adc().adcsra)
+#define ADCSRB (stedos::host::adc().adcsrb)
+#define ADCL   (stedos::host::adc().adcl)
+#define ADCH   (stedos::host::adc().adch)
+
+#define REFS1  7
+#define REFS0  6
+#define ADLAR  5
+
+#define ADEN   7
+#define ADSC   6
+#define ADATE  5
+#define ADIF   4
+#define ADIE   3
+#define ADPS2  2
+#define ADPS1  1
+#define ADPS0  0
+
+/* The timer interrupt flags, with the same bit positions as an atmega328p */
+#define TIFR0  (stedos::host::timers().tifr0)
+#define TIFR1  (stedos::host::timers().tifr1)
+
+#define OCF0B  2
+#define OCF0A  1
+#define TOV0   0
+
+#define ICF1   5
+#define OCF1B  2
+#define OCF1A  1
+#define TOV1   0
+
+/* SPI, with the same bit positions as an atmega328p */
+#define SPCR  (stedos::host::spi().spcr)
+#define SPSR  (stedos::host::spi().spsr)
+#define SPDR  (stedos::host::spi().spdr)
+
+#define SPIE  7
+#define SPE   6
+#define DORD  5
+#define MSTR  4
+#define CPOL  3
+#define CPHA  2
+#define SPR1  1
+#define SPR0  0
+
+#define SPIF  7
+#define WCOL  6
+#define SPI2X 0
+
+/* TWI, with the same bit positions as an atmega328p */
+#define TWBR  (stedos::host::twi().twbr)
+#define TWSR  (stedos::host::twi().twsr)
+#define TWAR  (stedos::host::twi().twar)
+#define TWDR  (stedos::host::twi().twdr)
+#define TWCR  (stedos::host::twi().twcr)
+
+#define TWINT 7
+#define TWEA  6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC  3
+#define TWEN  2
+#define TWIE  0
+
+/* EEPROM, with the same bit positions as an atmega328p */
+#define EECR  (stedos::host::eeprom().eecr)
+#define EEDR  (stedos::host::eeprom().eedr)
+#define EEARL (stedos::host::eeprom().eearl)
+#define EEARH (stedos::host::eeprom().eearh)
+
+#define E2END 0x3ff
+
+#define EEPM1 5
+#define EEPM0 4
+#define EERIE 3
+#define EEMPE 2
+#define EEPE  1
+#define EERE  0
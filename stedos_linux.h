@@ -0,0 +1,897 @@
+/*
+ * StedOS - Linux backend
+ *
+ * Include this instead of <avr/io.h> and stedos.h (it includes
+ * stedos.h itself, after setting up the lock) to run the event
+ * core on a Linux host, e.g. a gateway that shares its protocol
+ * code with the AVR nodes.  The event handlers, the timers and
+ * the storage classes are used unmodified.
+ *
+ * "Interrupts disabled" becomes "holding the stedos lock".  cli()
+ * takes a single mutex and sei() releases it, and SREG reads
+ * back whether the calling thread holds it, so Atomic nests in
+ * the same way as on the AVR.  Any thread may then queue events
+ * or use a FIFO, as an ISR would.
+ *
+ * EventLoop is an EventProcessor that sleeps in epoll_wait()
+ * when there is nothing to do.  It is woken by file descriptors
+ * becoming ready, by timerfd ticks that drive a timer
+ * implementation, and by events queued from other threads.
+ *
+ * Example:
+ *
+ *   stedos::posix::EventLoop<64> loop;
+ *   stedos::SimpleTimerImplementation<8> timer(&loop);
+ *
+ *   loop.begin();
+ *   loop.tick(&timer, 1000);                  // 1 ms ticks
+ *   loop.watch(socket, EPOLLIN, stedos::Event(received, socket));
+ *   loop.run();
+ *
+ * (c) stedmeister
+ *
+ * Licesnse TBD
+ */
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+namespace stedos
+{
+    namespace posix
+    {
+        /**********************************************************
+         *
+         * The stedos lock
+         *
+         * held() is per thread, so a nested cli() doesn't take
+         * the mutex again and only the outermost Atomic releases
+         * it.
+         *
+         **********************************************************/
+
+        inline pthread_mutex_t& mutex()
+        {
+            static pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+            return m;
+        }
+
+        inline uint8_t& held()
+        {
+            static thread_local uint8_t h = 0;
+            return h;
+        }
+
+        inline void lock()
+        {
+            if (held() == 0)
+            {
+                pthread_mutex_lock(&mutex());
+                held() = 1;
+            }
+        }
+
+        inline void unlock()
+        {
+            if (held() != 0)
+            {
+                held() = 0;
+                pthread_mutex_unlock(&mutex());
+            }
+        }
+
+        /* SREG has the interrupt flag (bit 7) set while the
+           calling thread does not hold the lock */
+        class StatusRegister
+        {
+        public:
+            operator uint8_t() const { return held() ? 0x00 : 0x80; }
+
+            StatusRegister& operator = (const uint8_t& v)
+            {
+                if (v & 0x80) unlock(); else lock();
+                return *this;
+            }
+        };
+
+        inline StatusRegister& sreg()
+        {
+            static StatusRegister r;
+            return r;
+        }
+    }
+}
+
+inline void cli() { stedos::posix::lock();   }
+inline void sei() { stedos::posix::unlock(); }
+
+#define SREG (stedos::posix::sreg())
+
+#define _BV(bit) (1 << (bit))
+
+#include "stedos.h"
+
+namespace stedos
+{
+    namespace posix
+    {
+        /**********************************************************
+         *
+         * MonotonicClock
+         *
+         * A clock for the Profiler, in microseconds.  Like
+         * Timer1Clock it wraps at 16 bits, so events longer than
+         * 65 ms are not timed correctly.
+         *
+         **********************************************************/
+
+        struct MonotonicClock
+        {
+            static void start() {}
+
+            static uint16_t now()
+            {
+                struct timespec t;
+                clock_gettime(CLOCK_MONOTONIC, &t);
+                return (uint16_t) ((uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000);
+            }
+        };
+
+        /**********************************************************
+         *
+         * EventLoop
+         *
+         * poll() processes the queued events, waits for a file
+         * descriptor, a tick or a queued event, and processes the
+         * events that result.  run() calls poll() until stop().
+         *
+         * watch() queues an event each time a file descriptor is
+         * ready.  epoll is level triggered, so the handler must
+         * read (or write) the descriptor, or the event is queued
+         * again by the next poll().
+         *
+         * tick() calls a timer implementation's tick() every
+         * period microseconds, from the loop thread.  If the loop
+         * falls behind, the missed ticks are made up at once, so
+         * the timeouts don't drift.
+         *
+         * Events may be queued from any thread.  The loop is only
+         * woken (one eventfd write) if it is sleeping.  If the
+         * queue is full the event is dropped and counted, use
+         * post() to find out and retry.
+         *
+         * Template Parameters:
+         *      SIZE - event queue length (see EventProcessor)
+         *   WATCHES - number of file descriptors and tickers
+         *  PROFILER - profiler policy (see EventProcessor)
+         *
+         **********************************************************/
+
+        template <int SIZE, int WATCHES=8, typename PROFILER=NoProfiler>
+        class EventLoop : public EventProcessor<SIZE, PROFILER>
+        {
+            typedef EventProcessor<SIZE, PROFILER> base;
+
+            static_assert(WATCHES < 255, "");
+
+            /* The eventfd is registered with this index */
+            static const uint8_t WAKE = 255;
+
+            struct Watch
+            {
+                int   fd;               /* -1 if the entry is free        */
+                Event event;            /* queued when fd is ready        */
+                TimerImplementationInterface* timer;   /* set for tickers */
+            };
+
+        public:
+            EventLoop() : epoll(-1), wake(-1), sleeping(false), stopping(false), dropped(0)
+            {
+                for (uint8_t idx=0; idx<WATCHES; idx+=1)
+                {
+                    watches[idx].fd    = -1;
+                    watches[idx].timer = 0;
+                }
+            };
+
+            ~EventLoop()
+            {
+                for (uint8_t idx=0; idx<WATCHES; idx+=1)
+                {
+                    if ((watches[idx].fd >= 0) && watches[idx].timer) close(watches[idx].fd);
+                }
+                if (wake >= 0)  close(wake);
+                if (epoll >= 0) close(epoll);
+            }
+
+            /* Creates the epoll and wake descriptors */
+            bool begin()
+            {
+                epoll = epoll_create1(EPOLL_CLOEXEC);
+                wake  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                if ((epoll < 0) || (wake < 0)) return false;
+
+                return add(wake, EPOLLIN, WAKE);
+            }
+
+            /* Queues event when fd is ready for events (EPOLLIN,
+               EPOLLOUT, ...) */
+            bool watch(const int& fd, const uint32_t& events, const Event& event)
+            {
+                uint8_t idx = allocate();
+                if (idx == WATCHES) return false;
+
+                if (add(fd, events, idx) == false) return false;
+
+                auto a = Atomic();
+                watches[idx].fd    = fd;
+                watches[idx].event = event;
+                watches[idx].timer = 0;
+                return true;
+            }
+
+            /* Stops watching fd.  Events that are already queued
+               are still processed */
+            void unwatch(const int& fd)
+            {
+                for (uint8_t idx=0; idx<WATCHES; idx+=1)
+                {
+                    if ((watches[idx].fd == fd) && (watches[idx].timer == 0))
+                    {
+                        epoll_ctl(epoll, EPOLL_CTL_DEL, fd, 0);
+                        auto a = Atomic();
+                        watches[idx].fd = -1;
+                    }
+                }
+            }
+
+            /* Calls timer->tick() every period microseconds */
+            bool tick(TimerImplementationInterface* timer, const uint32_t& period)
+            {
+                uint8_t idx = allocate();
+                if (idx == WATCHES) return false;
+
+                int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+                if (fd < 0) return false;
+
+                struct itimerspec spec;
+                spec.it_interval.tv_sec  = period / 1000000;
+                spec.it_interval.tv_nsec = (period % 1000000) * 1000;
+                spec.it_value            = spec.it_interval;
+
+                if ((timerfd_settime(fd, 0, &spec, 0) < 0) || (add(fd, EPOLLIN, idx) == false))
+                {
+                    close(fd);
+                    return false;
+                }
+
+                auto a = Atomic();
+                watches[idx].fd    = fd;
+                watches[idx].timer = timer;
+                return true;
+            }
+
+            /** Adds an event to the queue, from any thread.
+                Returns false if the queue is full */
+            bool post(const Event& event)
+            {
+                auto a = Atomic();
+                if (base::isFull())
+                {
+                    dropped += 1;
+                    return false;
+                }
+
+                base::queueEvent(event);
+                if (sleeping)
+                {
+                    sleeping = false;
+                    signal();
+                }
+                return true;
+            }
+
+            void queueEvent(event_func_t func)                 { post(Event(func));       }
+            void queueEvent(event_func_t func, uintptr_t data) { post(Event(func, data)); }
+            void queueEvent(const Event& event)                { post(event);             }
+
+            /* Processes the events, then waits up to timeout ms (-1
+               is forever) for something to happen and processes
+               the events that result */
+            void poll(const int& timeout = -1)
+            {
+                base::process();
+
+                int wait = timeout;
+                {
+                    auto a = Atomic();
+                    if (base::isEmpty() && !stopping) sleeping = true;
+                    else wait = 0;
+                }
+
+                struct epoll_event ready[WATCHES + 1];
+                int n = epoll_wait(epoll, ready, WATCHES + 1, wait);
+
+                {
+                    auto a = Atomic();
+                    sleeping = false;
+                }
+
+                for (int idx=0; idx<n; idx+=1)
+                {
+                    dispatch(ready[idx].data.u32);
+                }
+
+                base::process();
+            }
+
+            /* Polls until stop() */
+            void run()
+            {
+                while (stopped() == false) poll();
+            }
+
+            /* Makes run() return, from any thread or event */
+            void stop()
+            {
+                auto a = Atomic();
+                stopping = true;
+                signal();
+            }
+
+            bool stopped()
+            {
+                auto a = Atomic();
+                return stopping;
+            }
+
+            /* Events dropped because the queue was full */
+            uint32_t droppedCount()
+            {
+                auto a = Atomic();
+                return dropped;
+            }
+
+        private:
+            int      epoll;
+            int      wake;
+            bool     sleeping;      /* set while in epoll_wait() */
+            bool     stopping;
+            uint32_t dropped;
+            Watch    watches[WATCHES];
+
+            bool add(const int& fd, const uint32_t& events, const uint8_t& idx)
+            {
+                struct epoll_event e;
+                e.events   = events;
+                e.data.u64 = 0;
+                e.data.u32 = idx;
+                return epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &e) == 0;
+            }
+
+            uint8_t allocate()
+            {
+                auto a = Atomic();
+                for (uint8_t idx=0; idx<WATCHES; idx+=1)
+                {
+                    if (watches[idx].fd < 0) return idx;
+                }
+                return WATCHES;
+            }
+
+            void signal()
+            {
+                uint64_t one = 1;
+                ssize_t r = write(wake, &one, sizeof(one));
+                (void) r;
+            }
+
+            void dispatch(const uint32_t& idx)
+            {
+                uint64_t count;
+
+                if (idx == WAKE)
+                {
+                    ssize_t r = read(wake, &count, sizeof(count));
+                    (void) r;
+                    return;
+                }
+
+                Watch w;
+                {
+                    auto a = Atomic();
+                    w = watches[idx];
+                }
+
+                if (w.fd < 0)
+                {
+                    /* unwatched since epoll_wait() returned */
+                }
+                else if (w.timer)
+                {
+                    if (read(w.fd, &count, sizeof(count)) != sizeof(count)) return;
+                    while (count--) w.timer->tick();
+                }
+                else
+                {
+                    post(w.event);
+                }
+            }
+        };
+
+        template <int SIZE, int WATCHES, typename PROFILER>
+        const uint8_t EventLoop<SIZE, WATCHES, PROFILER>::WAKE;
+
+        /**********************************************************
+         *
+         * ParallelEventProcessor
+         *
+         * Runs events on a pool of worker threads.  Each worker has
+         * a Chase-Lev deque: events queued by a handler go onto the
+         * bottom of its own worker's deque and are popped from
+         * there (newest first, while the data is still in cache),
+         * and an idle worker steals from the top of another's.
+         * Events queued from other threads go onto a shared
+         * injection queue.
+         *
+         * Events queued with an affinity key are never stolen.
+         * They go onto the ordered queue of worker (key % workers),
+         * so the events for one key run one at a time and in the
+         * order they were queued.  Use the component's address or
+         * id as the key to keep its handlers single threaded.
+         *
+         * A worker looks for work in the order: its ordered queue,
+         * its deque, the injection queue, the other deques.  It
+         * sleeps when there is none.
+         *
+         * process() waits until every queued event, and every
+         * event those queue, has run.  It must not be called from
+         * a handler.
+         *
+         * If a queue is full the event is dropped and counted, use
+         * post() to find out and retry.  The exception is a keyed
+         * event queued by a handler that is running on the worker
+         * that owns the key.  Only that worker can empty its
+         * ordered queue, so a retry would never succeed.  These
+         * events go onto an unbounded spill list instead, which
+         * the worker runs once its ordered queue is empty, and
+         * are never dropped.
+         *
+         * Example:
+         *
+         *   stedos::posix::ParallelEventProcessor<8> pool;
+         *   pool.begin(4);
+         *   pool.queueEvent(work, 0);                     // any worker
+         *   pool.post(sensor.id, Event(update, &sensor)); // ordered
+         *   pool.process();
+         *
+         * Template Parameters:
+         *   WORKERS - maximum number of worker threads
+         *      SIZE - length of each queue (a power of 2)
+         *
+         **********************************************************/
+
+        namespace _internal
+        {
+            /* Chase-Lev work stealing deque, with the memory orders
+               of Le et al, "Correct and Efficient Work-Stealing for
+               Weak Memory Models".  Only the owner may push() and
+               pop(), any thread may steal().  The slots are atomic
+               because a thief can read a slot that the owner is
+               reusing; it then loses the compare and swap and throws
+               the value away. */
+            template <int SIZE>
+            class deque
+            {
+                static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+
+                static const int64_t MASK = SIZE - 1;
+
+                struct slot
+                {
+                    std::atomic<event_func_t> func;
+                    std::atomic<uintptr_t>    data;
+                };
+
+            public:
+                deque() : top(0), bottom(0) {};
+
+                bool push(const Event& e)
+                {
+                    int64_t b = bottom.load(std::memory_order_relaxed);
+                    int64_t t = top.load(std::memory_order_acquire);
+                    if (b - t >= SIZE) return false;
+
+                    slots[b & MASK].func.store(e.func, std::memory_order_relaxed);
+                    slots[b & MASK].data.store(e.data, std::memory_order_relaxed);
+                    bottom.store(b + 1, std::memory_order_release);
+                    return true;
+                }
+
+                bool pop(Event& e)
+                {
+                    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+                    bottom.store(b, std::memory_order_seq_cst);
+                    int64_t t = top.load(std::memory_order_seq_cst);
+
+                    if (t > b)
+                    {
+                        bottom.store(b + 1, std::memory_order_relaxed);
+                        return false;
+                    }
+
+                    read(b, e);
+                    if (t == b)
+                    {
+                        /* The last one, race the thieves for it */
+                        bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                        bottom.store(b + 1, std::memory_order_relaxed);
+                        return won;
+                    }
+                    return true;
+                }
+
+                bool steal(Event& e)
+                {
+                    int64_t t = top.load(std::memory_order_seq_cst);
+                    int64_t b = bottom.load(std::memory_order_seq_cst);
+                    if (t >= b) return false;
+
+                    read(t, e);
+                    return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                }
+
+            private:
+                std::atomic<int64_t> top;
+                std::atomic<int64_t> bottom;
+                slot slots[SIZE];
+
+                void read(const int64_t& idx, Event& e)
+                {
+                    e.func = slots[idx & MASK].func.load(std::memory_order_relaxed);
+                    e.data = slots[idx & MASK].data.load(std::memory_order_relaxed);
+                }
+            };
+
+            /* Bounded multi producer, multi consumer queue (Vyukov).
+               Each slot has a sequence number that says whether it
+               is free or holds the item for a given position, so a
+               push doesn't overtake an earlier one that hasn't
+               finished writing, and the order is kept */
+            template <int SIZE>
+            class ring
+            {
+                static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+
+                static const uint64_t MASK = SIZE - 1;
+
+                struct slot
+                {
+                    std::atomic<uint64_t> seq;
+                    Event event;
+                };
+
+            public:
+                ring() : head(0), tail(0)
+                {
+                    for (uint64_t idx=0; idx<SIZE; idx+=1) slots[idx].seq.store(idx, std::memory_order_relaxed);
+                };
+
+                bool push(const Event& e)
+                {
+                    uint64_t pos = head.load(std::memory_order_relaxed);
+                    while (true)
+                    {
+                        slot& s = slots[pos & MASK];
+                        int64_t diff = (int64_t) (s.seq.load(std::memory_order_acquire) - pos);
+                        if (diff == 0)
+                        {
+                            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                            {
+                                s.event = e;
+                                s.seq.store(pos + 1, std::memory_order_release);
+                                return true;
+                            }
+                        }
+                        else if (diff < 0) return false;    /* full */
+                        else pos = head.load(std::memory_order_relaxed);
+                    }
+                }
+
+                bool pop(Event& e)
+                {
+                    uint64_t pos = tail.load(std::memory_order_relaxed);
+                    while (true)
+                    {
+                        slot& s = slots[pos & MASK];
+                        int64_t diff = (int64_t) (s.seq.load(std::memory_order_acquire) - (pos + 1));
+                        if (diff == 0)
+                        {
+                            if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                            {
+                                e = s.event;
+                                s.seq.store(pos + SIZE, std::memory_order_release);
+                                return true;
+                            }
+                        }
+                        else if (diff < 0) return false;    /* empty */
+                        else pos = tail.load(std::memory_order_relaxed);
+                    }
+                }
+
+            private:
+                std::atomic<uint64_t> head;
+                std::atomic<uint64_t> tail;
+                slot slots[SIZE];
+            };
+
+            /* The processor and worker that the calling thread is,
+               if it is a worker */
+            struct worker_id
+            {
+                const void* owner;
+                uint8_t     index;
+            };
+
+            inline worker_id& worker()
+            {
+                static thread_local worker_id w = { 0, 0 };
+                return w;
+            }
+        }
+
+        template <int WORKERS, int SIZE=256>
+        class ParallelEventProcessor : public EventProcessorInterface
+        {
+            static_assert((WORKERS > 0) && (WORKERS < 256), "");
+
+            struct worker
+            {
+                _internal::deque<SIZE> deque;
+                _internal::ring<SIZE>  ordered;
+                std::deque<Event>      spill;      /* ordered events queued by
+                                                      this worker, used only by
+                                                      its own thread */
+                pthread_t              thread;
+                ParallelEventProcessor* owner;
+                uint8_t                index;
+            };
+
+        public:
+            ParallelEventProcessor() : count(0), stopping(false), sleepers(0), pending(0), dropped(0), stolen(0)
+            {
+                pthread_mutex_init(&mutex, 0);
+                pthread_cond_init(&work, 0);
+                pthread_cond_init(&idle, 0);
+            };
+
+            ~ParallelEventProcessor()
+            {
+                stop();
+                pthread_cond_destroy(&idle);
+                pthread_cond_destroy(&work);
+                pthread_mutex_destroy(&mutex);
+            }
+
+            /* Starts n worker threads (at most WORKERS) */
+            bool begin(const uint8_t& n)
+            {
+                if ((n == 0) || (n > WORKERS) || (count != 0)) return false;
+
+                /* count is set first, as the workers read it */
+                stopping.store(false);
+                count = n;
+                for (uint8_t idx=0; idx<n; idx+=1)
+                {
+                    workers[idx].owner = this;
+                    workers[idx].index = idx;
+                    if (pthread_create(&workers[idx].thread, 0, run, &workers[idx]) != 0)
+                    {
+                        count = idx;
+                        stop();
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            /* Runs the queued events, and any that they queue, and
+               then stops the workers */
+            void stop()
+            {
+                if (count == 0) return;
+
+                stopping.store(true);
+                pthread_mutex_lock(&mutex);
+                pthread_cond_broadcast(&work);
+                pthread_mutex_unlock(&mutex);
+
+                for (uint8_t idx=0; idx<count; idx+=1) pthread_join(workers[idx].thread, 0);
+                count = 0;
+            }
+
+            uint8_t workerCount() const { return count; }
+
+            /** Adds an event that may run on any worker.  Returns
+                false if the queue is full */
+            bool post(const Event& e)
+            {
+                pending.fetch_add(1);
+
+                const _internal::worker_id& self = _internal::worker();
+                bool queued = (self.owner == this) && workers[self.index].deque.push(e);
+                if (!queued) queued = inject.push(e);
+
+                return queued ? wake(false) : reject();
+            }
+
+            /** Adds an event that runs after, and never at the same
+                time as, the other events with the same key.  Never
+                fails when called from a handler running on the
+                worker that owns the key */
+            bool post(const uint16_t& key, const Event& e)
+            {
+                if (count == 0) return false;
+
+                pending.fetch_add(1);
+                worker& w = workers[key % count];
+
+                const _internal::worker_id& self = _internal::worker();
+                if ((self.owner == this) && (self.index == w.index))
+                {
+                    /* Once an event has spilled, the later ones follow
+                       it, so that they stay in order */
+                    if (w.spill.empty() && w.ordered.push(e)) return true;
+                    w.spill.push_back(e);
+                    return true;
+                }
+                return w.ordered.push(e) ? wake(true) : reject();
+            }
+
+            void queueEvent(event_func_t func)                 { post(Event(func));       }
+            void queueEvent(event_func_t func, uintptr_t data) { post(Event(func, data)); }
+            void queueEvent(const Event& event)                { post(event);             }
+
+            /* Waits until all of the events have run */
+            void process()
+            {
+                pthread_mutex_lock(&mutex);
+                while (pending.load() != 0) pthread_cond_wait(&idle, &mutex);
+                pthread_mutex_unlock(&mutex);
+            }
+
+            /* Events dropped because a queue was full */
+            uint32_t droppedCount() const { return dropped.load(); }
+
+            /* Events run by a worker that took them from another's deque */
+            uint32_t stolenCount() const  { return stolen.load(); }
+
+        private:
+            worker                 workers[WORKERS];
+            _internal::ring<SIZE>  inject;
+            uint8_t                count;
+
+            pthread_mutex_t        mutex;
+            pthread_cond_t         work;       /* signalled when events are queued  */
+            pthread_cond_t         idle;       /* signalled when pending reaches 0  */
+            std::atomic<bool>      stopping;
+            std::atomic<uint32_t>  sleepers;
+            std::atomic<uint32_t>  pending;    /* queued or running */
+            std::atomic<uint32_t>  dropped;
+            std::atomic<uint32_t>  stolen;
+
+            /* Wakes a sleeping worker.  An ordered event can only be
+               run by one worker, so they are all woken for it */
+            bool wake(const bool& all)
+            {
+                /* A read-modify-write, like the one in sleep(), so
+                   either the sleeper sees the event or this sees
+                   the sleeper */
+                if (sleepers.fetch_add(0) != 0)
+                {
+                    pthread_mutex_lock(&mutex);
+                    if (all) pthread_cond_broadcast(&work);
+                    else     pthread_cond_signal(&work);
+                    pthread_mutex_unlock(&mutex);
+                }
+                return true;
+            }
+
+            bool reject()
+            {
+                dropped.fetch_add(1);
+                finished();
+                return false;
+            }
+
+            void finished()
+            {
+                if (pending.fetch_sub(1) == 1)
+                {
+                    pthread_mutex_lock(&mutex);
+                    pthread_cond_broadcast(&idle);
+                    if (stopping.load()) pthread_cond_broadcast(&work);
+                    pthread_mutex_unlock(&mutex);
+                }
+            }
+
+            bool find(worker& w, Event& e)
+            {
+                if (w.ordered.pop(e)) return true;
+                if (!w.spill.empty())
+                {
+                    e = w.spill.front();
+                    w.spill.pop_front();
+                    return true;
+                }
+                if (w.deque.pop(e))   return true;
+                if (inject.pop(e))    return true;
+
+                for (uint8_t n=1; n<count; n+=1)
+                {
+                    uint8_t victim = w.index + n;
+                    if (victim >= count) victim -= count;
+                    if (workers[victim].deque.steal(e))
+                    {
+                        stolen.fetch_add(1, std::memory_order_relaxed);
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            /* Sleeps until there might be work.  Returns false when
+               the worker should exit */
+            bool sleep(worker& w, Event& e)
+            {
+                pthread_mutex_lock(&mutex);
+                sleepers.fetch_add(1);
+
+                /* Every worker stays until nothing is pending, as a
+                   running handler may still post to its ordered queue */
+                bool found = find(w, e);
+                bool exit  = !found && stopping.load() && (pending.load() == 0);
+                if (!found && !exit) pthread_cond_wait(&work, &mutex);
+
+                sleepers.fetch_sub(1, std::memory_order_relaxed);
+                pthread_mutex_unlock(&mutex);
+
+                if (found) dispatch(e);
+                return !exit;
+            }
+
+            void dispatch(const Event& e)
+            {
+                e.func(e.data);
+                finished();
+            }
+
+            static void* run(void* p)
+            {
+                worker& w = *(worker*) p;
+                ParallelEventProcessor& self = *w.owner;
+
+                _internal::worker_id& id = _internal::worker();
+                id.owner = &self;
+                id.index = w.index;
+
+                Event e;
+                while (true)
+                {
+                    if (self.find(w, e)) self.dispatch(e);
+                    else if (self.sleep(w, e) == false) break;
+                }
+
+                id.owner = 0;
+                return 0;
+            }
+        };
+    }
+}
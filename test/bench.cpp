@@ -0,0 +1,289 @@
+/*
+ * Host benchmarks for stedos
+ *
+ * Times the stedos primitives on the host simulation backend,
+ * against the standard library where there is an equivalent.
+ * The results are written as CSV, one row per benchmark:
+ *
+ *   revision,name,param,iterations,ns_per_iteration,
+ *   critical_per_iteration,registers_per_iteration
+ *
+ * param is the size, count or length that the benchmark is run
+ * with.  The critical section (cli()) and register access counts
+ * come from the host backend and are exact, so unlike the times
+ * they are the same on every machine and any change to them is a
+ * real change to the code.  revision is the first argument, so
+ * results from different commits can be kept in one file.
+ *
+ * The host times only compare one approach with another, they
+ * say nothing about the absolute speed on an AVR.
+ *
+ * run        : make bench
+ */
+
+#include <stdint.h>
+#include "../stedos_host.h"
+#include "../stedos.h"
+#include <chrono>
+#include <cstdio>
+
+using namespace std;
+
+/* Stops the compiler throwing the work away */
+volatile uint32_t sink;
+
+const char* revision = "";
+
+template <typename FUNC>
+void bench(const char* name, const uint32_t& param, const uint32_t& iterations, FUNC f)
+{
+	stedos::host::resetCounters();
+	auto start = chrono::steady_clock::now();
+	for (uint32_t idx=0; idx<iterations; idx+=1)
+	{
+		f(idx);
+	}
+	auto end = chrono::steady_clock::now();
+	double ns = chrono::duration<double, nano>(end - start).count();
+
+	const stedos::host::Counters& c = stedos::host::counters();
+	printf("%s,%s,%u,%u,%.1f,%.2f,%.2f\n", revision, name, (unsigned) param, (unsigned) iterations,
+	       ns / iterations, (double) c.critical / iterations, (double) (c.reads + c.writes) / iterations);
+}
+
+/* An empty critical section */
+void bench_atomic(void)
+{
+	bench("atomic", 0, 1000000, [&](uint32_t i) {
+		auto a = stedos::Atomic();
+		sink += i;
+	});
+}
+
+/* A push and a pop, with the FIFO kept half full so the indices
+   wrap.  Sizes that are a power of 2 wrap with a mask, the
+   others with a compare */
+template <int SIZE>
+void bench_fifo(void)
+{
+	stedos::FIFO<uint8_t, SIZE> fifo;
+	for (int idx=0; idx<SIZE / 2; idx+=1) fifo.push(idx);
+
+	bench("fifo_push_pop", SIZE, 1000000, [&](uint32_t i) {
+		fifo.push(i);
+		sink += fifo.pop();
+	});
+}
+
+void nullEvent(uintptr_t data) { sink += data; }
+
+/* Events queued in batches of BATCH and then dispatched.  The
+   time is per event */
+template <int BATCH>
+void bench_events(void)
+{
+	stedos::EventProcessor<64> queue;
+
+	bench("event_queue_dispatch", BATCH, 1000000, [&](uint32_t i) {
+		queue.queueEvent(nullEvent, i);
+		if ((i % BATCH) == BATCH - 1) queue.process();
+	});
+}
+
+/* A burst of BURST bytes from an ISR, then the consumer.  The
+   FIFO version queues a drain event with every byte pushed, and
+   the Channel queues one per burst.  The time is per burst */
+stedos::EventProcessor<64> burst_queue;
+stedos::FIFO<uint8_t, 64> burst_fifo;
+
+void fifoConsumer(uintptr_t data)
+{
+	while (burst_fifo.isEmpty() == false) sink += burst_fifo.pop();
+}
+
+void channelConsumer(uintptr_t data);
+stedos::Channel<uint8_t, 64> burst_channel(&burst_queue, channelConsumer);
+
+void channelConsumer(uintptr_t data)
+{
+	burst_channel.drain([](const uint8_t& v) { sink += v; });
+}
+
+template <int BURST>
+void bench_burst(void)
+{
+	bench("fifo_queue_burst", BURST, 200000, [&](uint32_t i) {
+		for (int idx=0; idx<BURST; idx+=1)
+		{
+			burst_fifo.push(idx);
+			burst_queue.queueEvent(fifoConsumer);
+		}
+		burst_queue.process();
+	});
+
+	bench("channel_burst", BURST, 200000, [&](uint32_t i) {
+		for (int idx=0; idx<BURST; idx+=1) burst_channel.push(idx);
+		burst_queue.process();
+	});
+}
+
+/* tick() with ARMED of the 32 timers running.  None of them
+   expire during the run */
+template <int ARMED>
+void bench_timer(void)
+{
+	stedos::EventProcessor<8> queue;
+	stedos::SimpleTimerImplementation<32> timer(&queue);
+	for (int idx=0; idx<ARMED; idx+=1) timer.add(60000, stedos::Event(nullEvent));
+
+	bench("timer_tick", ARMED, 50000, [&](uint32_t i) {
+		timer.tick();
+	});
+}
+
+/* Formatted output: stedos::print into a FIFO, against snprintf
+   into a buffer.  Both results are read back out, as the UART
+   would */
+void bench_print(void)
+{
+	const uint32_t N = 1000000;
+	stedos::FIFO<char, 64> out;
+	char buffer[64];
+
+	bench("print_int", 0, N, [&](uint32_t i) {
+		stedos::print(out, (int32_t) i - 500000);
+		while (!out.isEmpty()) sink += out.pop();
+	});
+	bench("snprintf_int", 0, N, [&](uint32_t i) {
+		int n = snprintf(buffer, sizeof(buffer), "%d", (int) i - 500000);
+		for (int c=0; c<n; c+=1) sink += buffer[c];
+	});
+
+	bench("print_hex", 0, N, [&](uint32_t i) {
+		stedos::print(out, stedos::hex((uint16_t) i));
+		while (!out.isEmpty()) sink += out.pop();
+	});
+	bench("snprintf_hex", 0, N, [&](uint32_t i) {
+		int n = snprintf(buffer, sizeof(buffer), "%04x", (unsigned) (uint16_t) i);
+		for (int c=0; c<n; c+=1) sink += buffer[c];
+	});
+
+	bench("print_fixed", 0, N, [&](uint32_t i) {
+		stedos::print(out, stedos::fixed<8, 2>((int16_t) i));
+		while (!out.isEmpty()) sink += out.pop();
+	});
+	bench("snprintf_fixed", 0, N, [&](uint32_t i) {
+		int n = snprintf(buffer, sizeof(buffer), "%.2f", (int16_t) i / 256.0);
+		for (int c=0; c<n; c+=1) sink += buffer[c];
+	});
+
+	bench("print_line", 0, N, [&](uint32_t i) {
+		stedos::print(out, "t=", i, " v=", stedos::fixed<8, 2>((int16_t) i), '\n');
+		while (!out.isEmpty()) sink += out.pop();
+	});
+	bench("snprintf_line", 0, N, [&](uint32_t i) {
+		int n = snprintf(buffer, sizeof(buffer), "t=%u v=%.2f\n", (unsigned) i, (int16_t) i / 256.0);
+		for (int c=0; c<n; c+=1) sink += buffer[c];
+	});
+}
+
+/* CRC of a 256 byte block with each table size */
+template <typename CRC>
+void bench_crc(const char* name)
+{
+	uint8_t block[256];
+	for (int i=0; i<256; ++i) block[i] = i * 7;
+
+	bench(name, sizeof(block), 20000, [&](uint32_t i) {
+		block[0] = i;
+		sink += CRC::compute(block, sizeof(block));
+	});
+}
+
+/* Fixed point against float and double.  On the host the FPU
+   makes float fast, so these mostly check that Fixed costs no
+   more than a plain integer multiply */
+void bench_fixed(void)
+{
+	typedef stedos::Fixed<1, 15> q15;
+	typedef stedos::Fixed<2, 14> coeff;
+	const uint32_t N = 1000000;
+
+	q15 fa(0.3);
+	volatile int16_t raw = 12345;
+	bench("fixed_q15_mul", 0, N, [&](uint32_t i) {
+		fa = q15::fromRaw((int16_t) raw) * fa + q15::fromRaw((int16_t) i);
+		sink += fa.raw();
+	});
+
+	float fl = 0.3f;
+	volatile float fv = 0.37f;
+	bench("float_mul", 0, N, [&](uint32_t i) {
+		fl = fv * fl + (float) (int16_t) i / 32768.0f;
+		sink += (uint32_t) (fl * 1000);
+	});
+
+	stedos::Biquad<q15, coeff> fixedFilter(coeff(0.02), coeff(0.04), coeff(0.02), coeff(-1.56), coeff(0.64));
+	bench("biquad_q15_sample", 0, N, [&](uint32_t i) {
+		sink += fixedFilter.step(q15::fromRaw((int16_t) (i * 40503))).raw();
+	});
+
+	double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+	bench("biquad_double_sample", 0, N, [&](uint32_t i) {
+		double x = (int16_t) (i * 40503) / 32768.0;
+		double y = 0.02 * x + 0.04 * x1 + 0.02 * x2 + 1.56 * y1 - 0.64 * y2;
+		x2 = x1; x1 = x; y2 = y1; y1 = y;
+		sink += (uint32_t) (y * 1000);
+	});
+
+	stedos::MovingAverage<q15, 16> average;
+	bench("moving_average_q15_sample", 0, N, [&](uint32_t i) {
+		sink += average.step(q15::fromRaw((int16_t) (i * 40503))).raw();
+	});
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1) revision = argv[1];
+
+	printf("revision,name,param,iterations,ns_per_iteration,critical_per_iteration,registers_per_iteration\n");
+
+	bench_atomic();
+
+	bench_fifo<8>();
+	bench_fifo<10>();
+	bench_fifo<16>();
+	bench_fifo<24>();
+	bench_fifo<32>();
+	bench_fifo<50>();
+	bench_fifo<64>();
+	bench_fifo<100>();
+	bench_fifo<128>();
+	bench_fifo<200>();
+	bench_fifo<256>();
+
+	bench_events<1>();
+	bench_events<8>();
+	bench_events<32>();
+
+	bench_timer<0>();
+	bench_timer<1>();
+	bench_timer<4>();
+	bench_timer<8>();
+	bench_timer<16>();
+	bench_timer<32>();
+
+	bench_burst<1>();
+	bench_burst<8>();
+	bench_burst<32>();
+
+	bench_print();
+	bench_crc< stedos::Crc32<stedos::CrcBitwise> >("crc32_bitwise");
+	bench_crc< stedos::Crc32<stedos::CrcNibbleTable> >("crc32_nibble");
+	bench_crc< stedos::Crc32<stedos::CrcFullTable> >("crc32_table");
+	bench_crc< stedos::Crc16Ccitt<stedos::CrcBitwise> >("crc16_bitwise");
+	bench_crc< stedos::Crc16Ccitt<stedos::CrcNibbleTable> >("crc16_nibble");
+	bench_crc< stedos::Crc16Ccitt<stedos::CrcFullTable> >("crc16_table");
+	bench_fixed();
+	return 0;
+}
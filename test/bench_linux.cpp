@@ -0,0 +1,244 @@
+/*
+ * Throughput benchmarks for the stedos Linux backend
+ *
+ * Measures how many events per second an EventLoop dispatches
+ * under a synthetic load.  The results are written as CSV:
+ *
+ *   revision,name,param,events,seconds,events_per_second
+ *
+ *   self_requeue   - each event queues the next, on the loop
+ *                    thread, so this is the dispatch cost alone
+ *   posted         - param threads post events as fast as they
+ *                    can, retrying when the queue is full
+ *   fd_ready       - a thread writes one byte to a pipe for each
+ *                    event, the loop is woken by epoll
+ *   posted_ticking - posted, with a 1 kHz SimpleTimer tick and
+ *                    param timers running on the loop as well
+ *   parallel_fan   - a ParallelEventProcessor with param workers
+ *                    running a tree of events that each queue two
+ *                    more, with some work at the leaves, so the
+ *                    workers steal from each other
+ *   parallel_keyed - param workers, with the events posted from
+ *                    one thread across 64 affinity keys
+ *
+ * run        : make bench_linux
+ */
+
+#include <stdint.h>
+#include "../stedos_linux.h"
+#include <fcntl.h>
+#include <chrono>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+const char* revision = "";
+
+typedef stedos::posix::EventLoop<256, 8> Loop;
+
+Loop* loop;
+uint32_t remaining;
+
+void report(const char* name, const uint32_t& param, const uint32_t& events, chrono::steady_clock::time_point start)
+{
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	printf("%s,%s,%u,%u,%.3f,%.0f\n", revision, name, param, events, seconds, events / seconds);
+}
+
+void counted(uintptr_t data)
+{
+	remaining -= 1;
+	if (remaining == 0) loop->stop();
+}
+
+void requeue(uintptr_t data)
+{
+	if (data == 0) loop->stop();
+	else           loop->queueEvent(requeue, data - 1);
+}
+
+void bench_self_requeue(void)
+{
+	const uint32_t EVENTS = 2000000;
+	Loop l;
+	loop = &l;
+	l.begin();
+
+	auto start = chrono::steady_clock::now();
+	l.queueEvent(requeue, EVENTS - 1);
+	l.run();
+	report("self_requeue", 0, EVENTS, start);
+}
+
+void post(uint32_t count)
+{
+	for (uint32_t idx=0; idx<count; idx+=1)
+	{
+		while (loop->post(stedos::Event(counted)) == false) this_thread::yield();
+	}
+}
+
+void bench_posted(const uint32_t& threads)
+{
+	const uint32_t EVENTS = 1000000;
+	Loop l;
+	loop = &l;
+	l.begin();
+	remaining = EVENTS;
+
+	auto start = chrono::steady_clock::now();
+	vector<thread> posters;
+	for (uint32_t t=0; t<threads; t+=1) posters.push_back(thread(post, EVENTS / threads));
+	l.run();
+	for (auto& t : posters) t.join();
+	report("posted", threads, EVENTS, start);
+}
+
+int pipes[2];
+
+void readable(uintptr_t fd)
+{
+	uint8_t buffer[64];
+	ssize_t n = read((int) fd, buffer, sizeof(buffer));
+	if (n <= 0) return;
+	if ((uint32_t) n >= remaining) { remaining = 0; loop->stop(); }
+	else remaining -= n;
+}
+
+void bench_fd_ready(void)
+{
+	const uint32_t EVENTS = 200000;
+	Loop l;
+	loop = &l;
+	l.begin();
+	remaining = EVENTS;
+
+	if (pipe(pipes) != 0) return;
+	fcntl(pipes[0], F_SETFL, O_NONBLOCK);
+	l.watch(pipes[0], EPOLLIN, stedos::Event(readable, pipes[0]));
+
+	auto start = chrono::steady_clock::now();
+	thread writer([]() {
+		uint8_t c = 0;
+		for (uint32_t idx=0; idx<EVENTS; idx+=1)
+		{
+			ssize_t r = write(pipes[1], &c, 1);
+			(void) r;
+		}
+	});
+	l.run();
+	writer.join();
+	report("fd_ready", 1, EVENTS, start);
+
+	close(pipes[0]);
+	close(pipes[1]);
+}
+
+void expired(uintptr_t data) {}
+
+void bench_posted_ticking(const uint32_t& timers)
+{
+	const uint32_t EVENTS = 1000000;
+	Loop l;
+	loop = &l;
+	l.begin();
+	remaining = EVENTS;
+
+	stedos::SimpleTimerImplementation<32> timer(&l);
+	for (uint32_t idx=0; idx<timers; idx+=1) timer.add(60000, stedos::Event(expired));
+	l.tick(&timer, 1000);
+
+	auto start = chrono::steady_clock::now();
+	vector<thread> posters;
+	for (uint32_t t=0; t<2; t+=1) posters.push_back(thread(post, EVENTS / 2));
+	l.run();
+	for (auto& t : posters) t.join();
+	report("posted_ticking", timers, EVENTS, start);
+}
+
+typedef stedos::posix::ParallelEventProcessor<16> Pool;
+
+Pool* pool;
+
+std::atomic<uint32_t> sink(0);
+
+/* A few microseconds of work that the compiler can't remove */
+void work(uintptr_t seed)
+{
+	uint32_t x = seed | 1;
+	for (int idx=0; idx<500; idx+=1)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+	}
+	sink += x;
+}
+
+void fan(uintptr_t depth)
+{
+	if (depth == 0) { work(depth); return; }
+	pool->queueEvent(fan, depth - 1);
+	pool->queueEvent(fan, depth - 1);
+}
+
+void bench_parallel_fan(const uint8_t& workers)
+{
+	const uint32_t DEPTH = 17;
+	Pool p;
+	pool = &p;
+	p.begin(workers);
+
+	auto start = chrono::steady_clock::now();
+	p.queueEvent(fan, DEPTH);
+	p.process();
+	report("parallel_fan", workers, (2 << DEPTH) - 1, start);
+}
+
+void bench_parallel_keyed(const uint8_t& workers)
+{
+	const uint32_t EVENTS = 200000;
+	Pool p;
+	pool = &p;
+	p.begin(workers);
+
+	auto start = chrono::steady_clock::now();
+	for (uint32_t idx=0; idx<EVENTS; idx+=1)
+	{
+		while (p.post(idx % 64, stedos::Event(work, idx)) == false) this_thread::yield();
+	}
+	p.process();
+	report("parallel_keyed", workers, EVENTS, start);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1) revision = argv[1];
+
+	printf("revision,name,param,events,seconds,events_per_second\n");
+
+	bench_self_requeue();
+	bench_posted(1);
+	bench_posted(2);
+	bench_posted(4);
+	bench_fd_ready();
+	bench_posted_ticking(0);
+	bench_posted_ticking(32);
+
+	/* 1 to N workers, where N is the number of cores (at least 4) */
+	uint32_t cores = thread::hardware_concurrency();
+	if (cores < 4) cores = 4;
+	for (uint32_t workers=1; workers<=16; workers*=2)
+	{
+		bench_parallel_fan(workers);
+		if (workers >= cores) break;
+	}
+	for (uint32_t workers=1; workers<=16; workers*=2)
+	{
+		bench_parallel_keyed(workers);
+		if (workers >= cores) break;
+	}
+}
@@ -0,0 +1,71 @@
+/*
+ * A small application that is recorded by test_record and that
+ * tools/replay is built with by default (make replay).
+ *
+ * A timer samples a sensor and a UART receives lines.  Each
+ * handler folds what it sees into a hash, so the end state
+ * depends on the order that the events ran in.
+ *
+ * Include stedos.h (through a backend) before this file.
+ */
+
+#include <stdio.h>
+
+namespace app
+{
+    const uint8_t SENSOR = 1;
+
+    stedos::EventProcessor<16, stedos::Recorder<128> > queue;
+
+    volatile uint16_t sensor = 0;   /* written by the "ADC"  */
+
+    uint32_t hash    = 0;
+    uint8_t  length  = 0;
+    uint8_t  lines   = 0;
+    uint16_t samples = 0;
+
+    void mix(const uint32_t& v) { hash = hash * 31 + v; }
+
+    void sample(uintptr_t data)
+    {
+        uint16_t v = queue.profiler.input(SENSOR, sensor);
+        mix(v);
+        samples += 1;
+    }
+
+    void lineDone(uintptr_t n)
+    {
+        mix(0x10000 | n);
+        lines += 1;
+    }
+
+    void received(uintptr_t c)
+    {
+        mix(c);
+        length += 1;
+        if (c == '\n')
+        {
+            queue.queueEvent(lineDone, length);
+            length = 0;
+        }
+    }
+
+    const stedos::event_func_t handlers[] PROGMEM = { sample, received, lineDone };
+    const char* const names[] = { "sample", "received", "lineDone" };
+    const uint8_t handlerCount = 3;
+
+    /* Clears the state, and replays the inputs from source */
+    void setup(stedos::ReplaySource* source)
+    {
+        hash    = 0;
+        length  = 0;
+        lines   = 0;
+        samples = 0;
+        queue.profiler.replay(source);
+    }
+
+    void report()
+    {
+        printf("hash %08x, %u samples, %u lines\n", (unsigned) hash, samples, lines);
+    }
+}
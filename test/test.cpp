@@ -1,30 +1,38 @@
 /* this file tests stedos */
 #include <stdint.h>
+#include "../stedos_host.h"
+#define STEDOS_MESSAGES "messages.def"
 #include "../stedos.h"
+#include "../tools/logdecode.h"
+#include "../tools/replay.h"
+#include "record_app.h"
 #include <cassert>
+#include <cmath>
+#include <csetjmp>
+#include <cstdio>
 #include <iostream>
+#include <vector>
 
 using namespace std;
 
 bool fired[8] = { false, false, false, false, false, false, false, false };
 
-void timerCallback(void* data)
+void timerCallback(uintptr_t data)
 {
-	long idx = (long) data;
-	fired[idx] = true;
-	cout << "timerCallback : " << (long) data << endl;
+	fired[data] = true;
+	cout << "timerCallback : " << data << endl;
 }
 
 void test_multiple_add(void)
 {
 	cout << "test_multiple_add" << endl;
-	#if 0
-	auto timer = Timer< SimpleTimerImplementation<4> >();
-	uint8_t h0 = timer.addEvent(4, timerCallback, (void*) 1);
-	uint8_t h1 = timer.addEvent(1, timerCallback, (void*) 2);
-	uint8_t h2 = timer.addEvent(2, timerCallback, (void*) 3);
-	uint8_t h3 = timer.addEvent(2, timerCallback, (void*) 4);
-	uint8_t h4 = timer.addEvent(1, timerCallback, (void*) 5);
+	stedos::EventProcessor<8> queue;
+	auto timer = stedos::SimpleTimerImplementation<4>(&queue);
+	uint8_t h0 = timer.add(4, {timerCallback, 1});
+	uint8_t h1 = timer.add(1, {timerCallback, 2});
+	uint8_t h2 = timer.add(2, {timerCallback, 3});
+	uint8_t h3 = timer.add(2, {timerCallback, 4});
+	uint8_t h4 = timer.add(1, {timerCallback, 5});
 
 	assert((h0 == 0x00) && "h0 != 0");	
 	assert((h1 == 0x01) && "h1 != 1");
@@ -33,18 +41,21 @@ void test_multiple_add(void)
 	assert((h4 == 0xff) && "h4 != invalid");
 
 	/* Now test the firing of the handles */
-	timer.increment();
+	timer.tick();
+	queue.process();
 	assert((fired[2] == true) && "fired[2]");
 
-	timer.increment();
+	timer.tick();
+	queue.process();
 	assert((fired[3] == true) && "fired[3]");
 	assert((fired[4] == true) && "fired[4]");
 
-	timer.increment();
+	timer.tick();
+	queue.process();
 	assert((fired[1] == false) && "fired[1]");
-	timer.increment();
+	timer.tick();
+	queue.process();
 	assert((fired[1] == true) && "fired[1]");
-	#endif
 }
 
 /* This test overflows the buffers
@@ -94,8 +105,2092 @@ void test_FIFO(void)
 
 }
 
+uint8_t  button_calls = 0;
+uintptr_t button_level = 0;
+uint8_t  dial_calls = 0;
+uintptr_t dial_value = 0;
+
+void buttonChanged(uintptr_t data) { button_calls += 1; button_level = data; }
+void dialChanged(uintptr_t data)   { dial_calls += 1;   dial_value = data;   }
+
+/* This test injects edges onto the simulated port
+   and checks that only the handlers for the pins
+   that changed are queued
+ */
+void channelConsumer(uintptr_t data);
+
+stedos::EventProcessor<8> channel_queue;
+stedos::Channel<uint8_t, 8> channel(&channel_queue, channelConsumer, 7);
+uint8_t  channel_events = 0;
+uint8_t  channel_data   = 0;
+std::vector<uint8_t> channel_items;
+
+void channelConsumer(uintptr_t data)
+{
+	channel_events += 1;
+	channel_data    = data;
+	channel.drain([](const uint8_t& v) {
+		channel_items.push_back(v);
+		/* an item pushed while draining is drained as well */
+		if (v == 3) channel.push(100);
+	});
+}
+
+void channelIsr(void)
+{
+	for (uint8_t v=1; v<=5; v+=1) channel.push(v);
+}
+
+void test_channel(void)
+{
+	cout << "test_channel" << endl;
+	stedos::host::Counters& c = stedos::host::counters();
+
+	sei();
+
+	/* a burst from an ISR: one critical section per push and one
+	   queue insertion for the whole burst */
+	stedos::host::resetCounters();
+	stedos::host::interrupt(channelIsr);
+	assert((c.critical == 5 + 1) && "one critical section per push");
+	assert((channel.count() == 5) && "count");
+
+	channel_queue.process();
+	assert((channel_events == 1) && "consumer queued once");
+	assert((channel_data == 7) && "consumer data");
+	const uint8_t expected[] = { 1, 2, 3, 4, 5, 100 };
+	assert((channel_items == std::vector<uint8_t>(expected, expected + 6)) && "drained in order");
+	assert((channel.isEmpty()) && "empty");
+
+	/* re-armed, wrapping round the buffer */
+	channel_items.clear();
+	stedos::host::interrupt(channelIsr);
+	channel_queue.process();
+	assert((channel_events == 2) && "queued again");
+	assert((channel_items.size() == 6) && "drained again");
+
+	/* nothing queued while the consumer hasn't run */
+	uint8_t burst[12] = { 0 };
+	assert((channel.push(burst, 3) == 3) && "burst");
+	assert((channel.push(burst, 12) == 5) && "burst fills");
+	assert((channel.push(9) == false) && "full");
+	assert((channel.droppedCount() == 2) && "dropped");
+	channel_queue.process();
+	assert((channel_events == 3) && "one event for three bursts");
+
+	/* pop re-arms when it finds the channel empty */
+	uint8_t v;
+	channel.push(42);
+	assert((channel.pop(v) && (v == 42)) && "pop");
+	assert((channel.pop(v) == false) && "pop empty");
+	channel.push(43);
+	channel_queue.process();
+	assert((channel_events == 5) && "pop re-armed");
+}
+
+/* A link protocol as a hierarchical state machine.  The actions
+   and the trace policy write to sm_trace
+ */
+std::vector<std::string> sm_trace;
+
+void smOnline(uintptr_t arg)  { sm_trace.push_back("enter ONLINE"); }
+void smOffline(uintptr_t arg) { sm_trace.push_back("exit ONLINE"); }
+void smAuth(uintptr_t arg)    { sm_trace.push_back("enter AUTH"); }
+void smReady(uintptr_t arg)   { sm_trace.push_back("enter READY"); }
+void smLeave(uintptr_t arg)   { sm_trace.push_back("exit READY"); }
+void smData(uintptr_t arg)    { sm_trace.push_back("data " + std::to_string(arg)); }
+void smRefused(uintptr_t arg) { sm_trace.push_back("refused"); }
+bool smPassword(uintptr_t arg) { return arg == 42; }
+
+struct Link
+{
+	enum { IDLE, ONLINE, AUTH, READY };
+	enum { CONNECT, LOGIN, DATA, DROP, RESET };
+
+	static const uint8_t initial = IDLE;
+
+	static constexpr stedos::SmState states[] =
+	{
+		{ stedos::SM_NONE, stedos::SM_NONE, 0,        0         },   /* IDLE   */
+		{ stedos::SM_NONE, AUTH,            smOnline, smOffline },   /* ONLINE */
+		{ ONLINE,          stedos::SM_NONE, smAuth,   0         },   /* AUTH   */
+		{ ONLINE,          stedos::SM_NONE, smReady,  smLeave   },   /* READY  */
+	};
+
+	/* given out of order, to check the sort */
+	static constexpr auto transitions = stedos::makeTransitions({
+		{ READY,  DATA,    0,          smData,    stedos::SM_INTERNAL },
+		{ ONLINE, DROP,    0,          0,         IDLE                },
+		{ AUTH,   LOGIN,   smPassword, 0,         READY               },
+		{ AUTH,   LOGIN,   0,          smRefused, stedos::SM_INTERNAL },
+		{ IDLE,   CONNECT, 0,          0,         ONLINE              },
+		{ ONLINE, RESET,   0,          0,         ONLINE              },
+	});
+};
+
+constexpr stedos::SmState Link::states[];
+constexpr decltype(Link::transitions) Link::transitions;
+
+const char* const sm_names[] = { "IDLE", "ONLINE", "AUTH", "READY" };
+
+struct SmTestTrace
+{
+	static void transition(const uint8_t& from, const uint8_t& event, const uint8_t& to)
+	{
+		sm_trace.push_back(std::string(from == stedos::SM_NONE ? "start" : sm_names[from]) + " -> " + sm_names[to]);
+	}
+
+	static void unhandled(const uint8_t& state, const uint8_t& event)
+	{
+		sm_trace.push_back(std::string("unhandled in ") + sm_names[state]);
+	}
+};
+
+typedef stedos::StateMachine<Link, SmTestTrace> LinkMachine;
+LinkMachine link;
+
+stedos::EventProcessor<8> sm_queue;
+void smConsumer(uintptr_t data);
+stedos::Channel<uint8_t, 8> sm_channel(&sm_queue, smConsumer);
+
+void smConsumer(uintptr_t data)
+{
+	sm_channel.drain([](const uint8_t& e) { link.dispatch(e); });
+}
+
+bool smExpect(const std::vector<std::string>& expected)
+{
+	bool same = (sm_trace == expected);
+	if (!same) for (const std::string& t : sm_trace) cout << "  " << t << endl;
+	sm_trace.clear();
+	return same;
+}
+
+void test_state_machine(void)
+{
+	cout << "test_state_machine" << endl;
+
+	assert((sizeof(link) == 1) && "only the state in RAM");
+	assert((Link::transitions.entries[0].state == Link::IDLE) && "sorted");
+	assert((Link::transitions.entries[3].guard == smPassword) && "equal keys keep their order");
+	assert((Link::transitions.entries[4].action == smRefused) && "equal keys keep their order");
+
+	link.start();
+	assert((link.state() == Link::IDLE) && "initial state");
+	assert(smExpect({ "start -> IDLE" }) && "start trace");
+
+	/* unhandled */
+	assert((link.dispatch(Link::DATA, 1) == false) && "unhandled");
+	assert(smExpect({ "unhandled in IDLE" }) && "unhandled trace");
+
+	/* enters ONLINE and then its initial child */
+	assert((link.dispatch(Link::CONNECT)) && "connect");
+	assert((link.state() == Link::AUTH) && "auth");
+	assert((link.isIn(Link::ONLINE)) && "in online");
+	assert(smExpect({ "enter ONLINE", "enter AUTH", "IDLE -> AUTH" }) && "connect trace");
+
+	/* the first guard fails, so the second transition is taken */
+	link.dispatch(Link::LOGIN, 7);
+	assert((link.state() == Link::AUTH) && "still auth");
+	assert(smExpect({ "refused", "AUTH -> AUTH" }) && "refused trace");
+
+	link.dispatch(Link::LOGIN, 42);
+	assert(smExpect({ "enter READY", "AUTH -> READY" }) && "login trace");
+
+	/* internal transition */
+	link.dispatch(Link::DATA, 5);
+	assert(smExpect({ "data 5", "READY -> READY" }) && "data trace");
+
+	/* self transition on the parent exits and enters it again */
+	link.dispatch(Link::RESET);
+	assert((link.state() == Link::AUTH) && "reset to auth");
+	assert(smExpect({ "exit READY", "exit ONLINE", "enter ONLINE", "enter AUTH", "READY -> AUTH" }) && "reset trace");
+
+	/* events queued on an EventProcessor */
+	sm_queue.queueEvent(stedos::deliver<LinkMachine, link>, stedos::smEvent(Link::LOGIN, 42));
+	sm_queue.queueEvent(stedos::deliver<LinkMachine, link>, stedos::smEvent(Link::DATA, 9));
+	sm_queue.process();
+	assert(smExpect({ "enter READY", "AUTH -> READY", "data 9", "READY -> READY" }) && "queued trace");
+
+	/* and through a Channel, inherited from ONLINE */
+	sm_channel.push(Link::DROP);
+	sm_channel.push(Link::CONNECT);
+	sm_queue.process();
+	assert((link.state() == Link::AUTH) && "reconnected");
+	assert(smExpect({ "exit READY", "exit ONLINE", "READY -> IDLE", "enter ONLINE", "enter AUTH", "IDLE -> AUTH" }) && "channel trace");
+}
+
+void test_pin_change(void)
+{
+	cout << "test_pin_change" << endl;
+	stedos::EventProcessor<8> queue;
+	stedos::PinChangeDispatcher<stedos::port_b,
+		stedos::PinChange<stedos::IO<stedos::port_b, 0>,    buttonChanged>,
+		stedos::PinChange<stedos::IO<stedos::port_b, 4, 2>, dialChanged>
+	> pins(&queue);
+
+	assert((pins.MASK == 0x31) && "MASK");
+
+	stedos::host::drive(1, 0x00);
+	pins.begin();
+
+	/* rising edge on the button */
+	stedos::host::drive(1, 0x01);
+	pins.changed();
+	queue.process();
+	assert((button_calls == 1) && "button rising");
+	assert((button_level == 1) && "button level high");
+	assert((dial_calls   == 0) && "dial untouched");
+
+	/* one bit of the dial changes */
+	stedos::host::drive(1, 0x21);
+	pins.changed();
+	queue.process();
+	assert((button_calls == 1) && "button untouched");
+	assert((dial_calls   == 1) && "dial changed");
+	assert((dial_value   == 2) && "dial value");
+
+	/* pins without a handler are ignored */
+	stedos::host::drive(1, 0xa1);
+	pins.changed();
+	queue.process();
+	assert((button_calls == 1) && "unregistered pin button");
+	assert((dial_calls   == 1) && "unregistered pin dial");
+
+	/* both handlers fire on the same interrupt */
+	stedos::host::drive(1, 0x90);
+	pins.changed();
+	queue.process();
+	assert((button_calls == 2) && "button falling");
+	assert((button_level == 0) && "button level low");
+	assert((dial_calls   == 2) && "dial changed again");
+	assert((dial_value   == 1) && "dial value again");
+}
+
+/* Counts the live Sensor objects so that the
+   test can check that Array constructs and
+   destroys its items correctly
+ */
+int sensors_alive = 0;
+
+struct Sensor
+{
+	uint8_t id;
+	uint16_t reading;
+
+	Sensor(uint8_t i, uint16_t r) : id(i), reading(r) { sensors_alive += 1; }
+	Sensor(const Sensor& o) : id(o.id), reading(o.reading) { sensors_alive += 1; }
+	~Sensor() { sensors_alive -= 1; }
+};
+
+void test_array(void)
+{
+	cout << "test_array" << endl;
+	stedos::Array<uint8_t, 5> bytes;
+
+	assert((bytes.size() == 0) && "starts empty");
+	assert((bytes.capacity() == 5) && "capacity");
+
+	bytes.append(1);
+	bytes.append(3);
+	bytes.insert(2, 1);
+	bytes.insert(0);
+	assert((bytes.size() == 4) && "size after insert");
+	assert((bytes[0] == 0) && (bytes[1] == 1) && (bytes[2] == 2) && (bytes[3] == 3) && "insert order");
+
+	assert((bytes.insert(9, 6) == false) && "insert past end");
+	assert(bytes.append(4) && "append to capacity");
+	assert((bytes.append(5) == false) && "append when full");
+
+	assert((bytes.remove(1) == 1) && "remove");
+	assert((bytes[0] == 0) && (bytes[1] == 2) && (bytes[2] == 3) && (bytes[3] == 4) && "remove keeps order");
+
+	assert((bytes.swapRemove(0) == 0) && "swapRemove");
+	assert((bytes.size() == 3) && "size after swapRemove");
+	assert((bytes[0] == 4) && (bytes[1] == 2) && (bytes[2] == 3) && "swapRemove moves the last item");
+
+	int sum = 0;
+	for (uint8_t v : bytes) sum += v;
+	assert((sum == 9) && "iterators");
+
+	assert((bytes.pop() == 3) && "pop");
+
+	{
+		stedos::Array<Sensor, 4> sensors;
+		sensors.emplace(1, 100);
+		sensors.emplace(2, 200);
+		sensors.emplace(3, 300);
+		sensors.insert(Sensor(0, 0), 0);
+		assert((sensors_alive == 4) && "constructed in place");
+		assert((sensors.emplace(4, 400) == 0) && "emplace when full");
+		assert((sensors[3].id == 3) && (sensors[3].reading == 300) && "insert moves items");
+
+		sensors.remove(0);
+		assert((sensors_alive == 3) && "remove destroys");
+		sensors.swapRemove(0);
+		assert((sensors_alive == 2) && "swapRemove destroys");
+		assert((sensors[0].id == 3) && (sensors[1].id == 2) && "swapRemove order");
+	}
+	assert((sensors_alive == 0) && "destructor clears");
+}
+
+/* The map is given out of order and must be
+   sorted by the compiler
+ */
+constexpr auto squares PROGMEM = stedos::makeStaticMap<uint16_t, uint32_t>({
+	{ 300, 90000 },
+	{   7,    49 },
+	{  12,   144 },
+	{   1,     1 },
+	{ 255, 65025 },
+});
+
+static_assert(squares.entries[0].key == 1,   "sorted at compile time");
+static_assert(squares.entries[4].key == 300, "sorted at compile time");
+
+void test_static_map(void)
+{
+	cout << "test_static_map" << endl;
+	uint32_t v = 0;
+
+	assert(squares.find(1, v)   && (v == 1)     && "find first");
+	assert(squares.find(12, v)  && (v == 144)   && "find middle");
+	assert(squares.find(300, v) && (v == 90000) && "find last");
+	assert((squares.find(0, v)   == false) && "below range");
+	assert((squares.find(8, v)   == false) && "gap");
+	assert((squares.find(999, v) == false) && "above range");
+
+	static constexpr auto single PROGMEM = stedos::makeStaticMap<char, uint8_t>({ { 'x', 1 } });
+	uint8_t b = 0;
+	assert(single.find('x', b) && (b == 1) && "single entry");
+	assert((single.find('y', b) == false) && "single entry miss");
+}
+
+struct Packet
+{
+	uint8_t length;
+	uint8_t payload[6];
+
+	Packet(uint8_t l) : length(l) {}
+};
+
+stedos::Pool<Packet, 3, stedos::PoolStats> packets;
+uint8_t packet_length = 0;
+
+void packetReceived(uintptr_t data)
+{
+	Packet* p = (Packet*) data;
+	packet_length = p->length;
+	packets.free(p);
+}
+
+void test_pool(void)
+{
+	cout << "test_pool" << endl;
+	stedos::EventProcessor<4> queue;
+
+	Packet* a = packets.alloc(1);
+	Packet* b = packets.alloc(2);
+	Packet* c = packets.alloc(3);
+	assert(a && b && c && "alloc");
+	assert((a != b) && (b != c) && (a != c) && "distinct blocks");
+	assert((b->length == 2) && "constructed in place");
+	assert(packets.isEmpty() && "exhausted");
+	assert((packets.alloc(4) == 0) && "alloc when exhausted");
+	assert((packets.stats.failures == 1) && "failure counted");
+
+	packets.free(b);
+	assert((packets.alloc(4) == b) && "last freed is reused first");
+
+	/* pass a packet through an event and free it in the handler */
+	queue.queueEvent(packetReceived, (uintptr_t) c);
+	queue.process();
+	assert((packet_length == 3) && "packet through Event::data");
+	assert((packets.stats.used == 2) && "used");
+	assert((packets.stats.highWater == 3) && "high water");
+
+	/* alloc() costs a single critical section */
+	stedos::host::resetCounters();
+	Packet* d = packets.alloc(6);
+	assert((stedos::host::counters().critical == 1) && "alloc cost");
+	packets.free(d);
+	assert((stedos::host::counters().critical == 2) && "free cost");
+
+	packets.free(a);
+	packets.free(b);
+	assert((packets.stats.used == 0) && "all returned");
+}
+
+struct Active {};
+struct Dirty  {};
+
+struct Node : stedos::ListHook<Active>, stedos::ListHook<Dirty>
+{
+	uint8_t id;
+	Node(uint8_t i) : id(i) {}
+};
+
+void test_list(void)
+{
+	cout << "test_list" << endl;
+	Node n0(0), n1(1), n2(2), n3(3);
+	stedos::List<Node, Active> active;
+	stedos::List<Node, Dirty>  dirty;
+
+	assert(active.isEmpty() && "starts empty");
+	assert((active.popFront() == 0) && "pop when empty");
+
+	active.pushBack(n1);
+	active.pushBack(n2);
+	active.pushFront(n0);
+	active.insertBefore(n2, n3);
+	dirty.pushBack(n2);
+
+	uint8_t order[4];
+	uint8_t count = 0;
+	for (Node& n : active) order[count++] = n.id;
+	assert((count == 4) && "iterate");
+	assert((order[0] == 0) && (order[1] == 1) && (order[2] == 3) && (order[3] == 2) && "order");
+
+	/* remove from the middle, and from a second list */
+	active.remove(n3);
+	assert((active.isLinked(n3) == false) && "unlinked");
+	assert(dirty.isLinked(n2) && "still on dirty");
+	assert((dirty.popFront() == &n2) && "dirty list");
+	assert(dirty.isEmpty() && "dirty list empty");
+
+	assert((active.front() == &n0) && "front");
+	assert((active.back()  == &n2) && "back");
+	assert((active.popBack()  == &n2) && "popBack");
+	assert((active.popFront() == &n0) && "popFront");
+	assert((active.popFront() == &n1) && "last item");
+	assert(active.isEmpty() && "empty again");
+}
+
+std::string log_output[8];
+uint8_t log_lines = 0;
+uint8_t log_bytes[256];
+uint16_t log_count = 0;
+
+bool logPut(uint8_t b)
+{
+	if (log_count == sizeof(log_bytes)) return false;
+	log_bytes[log_count++] = b;
+	return true;
+}
+
+int evaluated = 0;
+uint8_t sideEffect(void) { evaluated += 1; return 1; }
+
+/* Logs some messages, drains the ring and
+   decodes the stream back into text
+ */
+void test_log(void)
+{
+	cout << "test_log" << endl;
+	stedos::log::LogRing<STEDOS_LOG_SIZE>& ring = stedos::log::ring();
+
+	STEDOS_LOG_INFO(BOOT);
+	STEDOS_LOG_INFO(SAMPLE, 3, 1023);
+	STEDOS_LOG_WARN(OFFSET, -5, 0xbeef);
+	STEDOS_LOG_TRACE(TRACE_ISR, sideEffect());
+	STEDOS_LOG_ERROR(TOTAL, 99);
+	assert((evaluated == 0) && "trace is compiled out");
+
+	ring.drain(logPut);
+	assert(ring.isEmpty() && "drained");
+	assert((log_count == 1 + 4 + 5 + 5) && "record sizes");
+	assert((log_bytes[1] == stedos::log::SAMPLE) && (log_bytes[2] == 3) && "raw bytes");
+	assert((log_bytes[3] == 0xff) && (log_bytes[4] == 0x03) && "little endian");
+
+	const uint8_t* p   = log_bytes;
+	const uint8_t* end = log_bytes + log_count;
+	while (size_t used = stedos::logdecode::decode(p, end, log_output[log_lines]))
+	{
+		p += used;
+		log_lines += 1;
+	}
+	assert((log_lines == 4) && "decoded lines");
+	assert((log_output[0] == "boot") && "decode BOOT");
+	assert((log_output[1] == "adc ch=3 value=1023") && "decode SAMPLE");
+	assert((log_output[2] == "offset -5 (0xbeef)") && "decode OFFSET");
+	assert((log_output[3] == "total 99%") && "decode TOTAL");
+
+	/* a partial record is not decoded */
+	std::string line;
+	assert((stedos::logdecode::decode(log_bytes + 1, log_bytes + 3, line) == 0) && "partial record");
+
+	/* IDs from 128 use two bytes */
+	stedos::log::Args<uint8_t>::write(200, 7);
+	uint8_t b = 0;
+	assert(ring.read(b) && (b == 0xc8) && "two byte id low");
+	assert(ring.read(b) && (b == 0x01) && "two byte id high");
+	assert(ring.read(b) && (b == 7)    && "two byte id argument");
+	assert((ring.read(b) == false) && "empty");
+
+	/* a full ring drops whole records */
+	for (int i=0; i<20; ++i) STEDOS_LOG_INFO(SAMPLE, i, i);
+	assert((ring.droppedCount() == 4) && "dropped records");
+	log_count = 0;
+	ring.drain(logPut);
+	assert((log_count == 64) && "only whole records kept");
+}
+
+/* Records the last problem reported through Debug */
+struct TestDebug : public stedos::Debug
+{
+	uint8_t  reports = 0;
+	uint8_t  level   = 0xff;
+	uint8_t  code    = 0xff;
+	uint16_t value   = 0;
+
+	void report(const uint8_t& l, const uint8_t& c, const uint16_t& v)
+	{
+		reports += 1;
+		level = l;
+		code  = c;
+		value = v;
+	}
+};
+
+void idleHandler(uintptr_t data) {}
+
+/* Runs the stack monitor over a simulated
+   memory region and "uses" the stack by
+   writing to the top of it
+ */
+void test_stack_monitor(void)
+{
+	cout << "test_stack_monitor" << endl;
+	uint8_t ram[200];
+	stedos::StackMonitor stack(ram, ram + sizeof(ram));
+	stedos::EventProcessor<4> queue;
+	stedos::SimpleTimerImplementation<2> timer(&queue);
+	TestDebug debug;
+
+	stack.paint(ram + sizeof(ram));
+	assert((stack.size() == 200) && "size");
+	assert((stack.margin() == 200) && "all painted");
+
+	for (int i=150; i<200; ++i) ram[i] = 0;
+	assert((stack.margin() == 150) && "margin");
+	assert((stack.highWater() == 50) && "high water");
+
+	/* a painted value left on the stack doesn't hide the high water mark */
+	ram[120] = 0;
+	ram[121] = stedos::StackMonitor::PAINT;
+	assert((stack.highWater() == 80) && "deepest write");
+
+	assert(stack.start(&timer, 10, 100, &debug) && "started");
+	for (int i=0; i<10; ++i) timer.tick();
+	queue.process();
+	assert((debug.reports == 0) && "margin ok");
+
+	/* the stack grows past the threshold */
+	ram[60] = 0;
+	for (int i=0; i<10; ++i) timer.tick();
+	queue.process();
+	assert((debug.reports == 1) && "reported");
+	assert((debug.level == LEVEL_FATAL) && "fatal");
+	assert((debug.code  == stedos::DEBUG_STACK_LOW) && "code");
+	assert((debug.value == 60) && "margin reported");
+
+	/* the check keeps running */
+	for (int i=0; i<10; ++i) timer.tick();
+	queue.process();
+	assert((debug.reports == 2) && "periodic");
+
+	/* the checks stop, and say so, if the timer slots are taken
+	   before the check runs */
+	for (int i=0; i<10; ++i) timer.tick();
+	timer.add(50, stedos::Event(idleHandler));
+	timer.add(50, stedos::Event(idleHandler));
+	queue.process();
+	assert((debug.reports == 4) && (debug.code == stedos::DEBUG_TIMER_FULL) && "timer full reported");
+	assert((debug.value == 60) && "margin at the last check");
+
+	/* a full timer can't start the monitor */
+	stedos::SimpleTimerImplementation<1> busy(&queue);
+	busy.add(5, stedos::Event(idleHandler));
+	assert((stack.start(&busy, 10, 100, &debug) == false) && "no timer slot");
+}
+
+/* A fake free running clock that the
+   event handlers advance
+ */
+uint16_t test_clock = 0;
+struct TestClock { static uint16_t now() { return test_clock; } };
+
+uint32_t test_clock32 = 0;
+struct TestClock32 { static uint32_t now() { return test_clock32; } };
+
+void fastHandler(uintptr_t data) { test_clock += 10;  }
+void longHandler(uintptr_t data) { test_clock32 += 100000; }
+void slowHandler(uintptr_t data) { test_clock += 100; }
+void nullHandler1(uintptr_t data) {}
+void nullHandler2(uintptr_t data) {}
+void nullHandler3(uintptr_t data) {}
+void nullHandler4(uintptr_t data) {}
+
+std::string dump_output;
+void dumpPut(char c) { dump_output += c; }
+
+void test_profiler(void)
+{
+	cout << "test_profiler" << endl;
+	stedos::EventProcessor<8, stedos::Profiler<TestClock, 4> > queue;
+
+	queue.queueEvent(fastHandler);
+	queue.queueEvent(slowHandler);
+	queue.queueEvent(fastHandler);
+	queue.process();
+
+	/* idle time between rounds, across a clock wrap */
+	test_clock = 0xfff0;
+	queue.process();
+	queue.queueEvent(slowHandler, 0);
+	queue.process();
+
+	const stedos::ProfileEntry* fast = 0;
+	const stedos::ProfileEntry* slow = 0;
+	uint8_t functions = 0;
+	for (const stedos::ProfileEntry& e : queue.profiler)
+	{
+		functions += 1;
+		if (e.func == fastHandler) fast = &e;
+		if (e.func == slowHandler) slow = &e;
+	}
+	assert((functions == 2) && "two functions");
+	assert(fast && (fast->count == 2) && (fast->total == 20) && (fast->max == 10) && "fast");
+	assert(slow && (slow->count == 2) && (slow->total == 200) && (slow->max == 100) && "slow");
+
+	assert((queue.profiler.busyCycles() == 220) && "busy");
+	assert((queue.profiler.idleCycles() == 0xfff0 - 120) && "idle");
+	assert((queue.profiler.utilisation() == 0) && "mostly idle");
+
+	dump_output.clear();
+	queue.profiler.dump(dumpPut);
+	assert((dump_output.find(" 0002 000a 00000014\n") != std::string::npos) && "dump fast");
+	assert((dump_output.find("b 000000dc\n") != std::string::npos) && "dump busy");
+
+	/* more functions than table entries */
+	queue.profiler.reset();
+	queue.queueEvent(fastHandler);
+	queue.queueEvent(slowHandler);
+	queue.queueEvent(nullHandler1);
+	queue.queueEvent(nullHandler2);
+	queue.queueEvent(nullHandler3);
+	queue.queueEvent(nullHandler4);
+	test_clock = 0;
+	queue.profiler.reset();
+	queue.process();
+	uint32_t total = 0;
+	functions = 0;
+	for (const stedos::ProfileEntry& e : queue.profiler) { total += e.count; functions += 1; }
+	assert((functions == 4) && "table full");
+	assert((total == 6) && "every call counted");
+	assert((queue.profiler.utilisation() == 100) && "all busy");
+
+	/* a 32 bit clock measures handlers longer than 16 bits */
+	stedos::EventProcessor<8, stedos::Profiler<TestClock32, 4> > wide;
+	test_clock32 = 0x1fff0;
+	wide.profiler.reset();
+	test_clock32 += 70000;
+	wide.queueEvent(longHandler);
+	wide.queueEvent(fastHandler);
+	wide.process();
+	bool found = false;
+	for (const stedos::ProfileEntry& e : wide.profiler)
+	{
+		if (e.func == longHandler)
+		{
+			found = true;
+			assert((e.total == 100000) && "long handler total");
+			assert((e.max == 0xffff) && "max saturates");
+		}
+	}
+	assert(found && "long handler profiled");
+	assert((wide.profiler.idleCycles() == 70000) && "long idle time");
+	assert((wide.profiler.busyCycles() == 100000) && "busy time");
+}
+
+/* Records the test application while "ISRs" tick the timer,
+   sample the sensor and receive characters between the calls to
+   process(), then replays the stream and checks that the
+   handlers end in the same state
+ */
+std::vector<uint8_t> record_stream;
+bool recordPut(uint8_t b) { record_stream.push_back(b); return true; }
+
+const char record_text[] = "hello\nworld\n\nrecord and replay\n";
+uint8_t record_next = 0;
+uint8_t record_ticks = 0;
+
+void recordTickIsr(void)
+{
+	app::queue.profiler.tick();
+	record_ticks += 1;
+	if ((record_ticks % 5) == 0)
+	{
+		app::sensor = app::sensor * 7 + 3;
+		app::queue.queueEvent(app::sample);
+	}
+}
+
+void recordUartIsr(void)
+{
+	app::queue.queueEvent(app::received, (uint8_t) record_text[record_next++]);
+}
+
+/* A handler that is interrupted by a tick before it reads its input */
+stedos::EventProcessor<4, stedos::Recorder<64> > ticking;
+uint16_t ticking_live = 0;
+uint16_t ticking_sum  = 0;
+
+void tickingHandler(uintptr_t data)
+{
+	ticking.profiler.tick();
+	ticking_sum += ticking.profiler.input(1, ticking_live++);
+}
+
+const stedos::event_func_t ticking_handlers[] PROGMEM = { tickingHandler };
+
+void test_record(void)
+{
+	cout << "test_record" << endl;
+	sei();
+
+	app::queue.profiler.begin(app::handlers, app::handlerCount);
+	for (uint16_t t=0; t<400; ++t)
+	{
+		stedos::host::interrupt(recordTickIsr);
+		if (((t % 3) == 0) && (record_next < sizeof(record_text) - 1))
+		{
+			stedos::host::interrupt(recordUartIsr);
+		}
+		if ((t % 4) == 0) app::queue.process();
+		app::queue.profiler.drain(recordPut);
+	}
+	app::queue.process();
+	app::queue.profiler.drain(recordPut);
+
+	assert((app::lines == 4) && "lines received");
+	assert((app::samples == 80) && "samples taken");
+	assert((record_stream[0] == stedos::RECORD_TICKS) && "start record");
+	assert((record_stream[1] == stedos::RECORD_TICKS + 1) && "tick before the first event");
+	assert((record_stream[2] == stedos::RECORD_EVENT + 1) && (record_stream[3] == 'h') && "first event");
+
+	uint32_t hash    = app::hash;
+	uint16_t samples = app::samples;
+
+	/* the same handlers, fast forwarded through the stream */
+	stedos::replay::Replayer replayer(record_stream.data(), record_stream.size(), app::handlers, app::handlerCount);
+	app::setup(&replayer);
+	app::sensor = 0;
+	replayer.run();
+	app::queue.profiler.replay(0);
+
+	assert((app::hash == hash) && "replayed to the same state");
+	assert((app::samples == samples) && (app::lines == 4) && "replayed counts");
+	assert((replayer.eventCount() == 80 + sizeof(record_text) - 1 + 4) && "every event replayed");
+	/* the last 3 ticks had no event after them, so they are still pending */
+	assert((replayer.tickCount() == 397) && "every tick before the last event replayed");
+	assert((replayer.errorCount() == 0) && (replayer.lostCount() == 0) && (replayer.remaining() == 0) && "clean replay");
+
+	/* a tick while a handler runs is written before its input,
+	   and the replay steps over it to find the input.  Events
+	   with no data are recorded with 0 */
+	record_stream.clear();
+	ticking.profiler.begin(ticking_handlers, 1);
+	for (uint8_t i=0; i<3; ++i) ticking.queueEvent(tickingHandler);
+	ticking_live = 10;
+	ticking.process();
+	ticking.profiler.drain(recordPut);
+	assert((ticking_sum == 10 + 11 + 12) && "recorded inputs");
+	assert((record_stream[1] == stedos::RECORD_EVENT) && (record_stream[2] == 0) && "no data recorded as 0");
+	assert((record_stream[3] == stedos::RECORD_TICKS + 1) && (record_stream[4] == stedos::RECORD_INPUT + 1) && "tick before the input");
+
+	stedos::replay::Replayer ticked(record_stream.data(), record_stream.size(), ticking_handlers, 1);
+	ticking.profiler.replay(&ticked);
+	ticking_live = 100;
+	ticking_sum  = 0;
+	ticked.run();
+	ticking.profiler.replay(0);
+	assert((ticking_sum == 10 + 11 + 12) && "replayed inputs");
+	assert((ticked.errorCount() == 0) && (ticked.tickCount() == 3) && (ticked.eventCount() == 3) && "ticks inside handlers replayed");
+
+	/* a different order gives a different state: swap the first
+	   two characters that were received together */
+	size_t at = 0;
+	while ((record_stream[at] != stedos::RECORD_EVENT + 1) || (record_stream[at + 2] != stedos::RECORD_EVENT + 1)) at += 1;
+	std::swap(record_stream[at + 1], record_stream[at + 3]);
+	stedos::replay::Replayer reordered(record_stream.data(), record_stream.size(), app::handlers, app::handlerCount);
+	app::setup(&reordered);
+	reordered.run();
+	app::queue.profiler.replay(0);
+	assert((app::hash != hash) && "order matters");
+
+	/* a full ring loses records, and says so */
+	stedos::Recorder<16> small;
+	small.begin(app::handlers, app::handlerCount);
+	for (int i=0; i<20; ++i) small.enter(stedos::Event(app::received, 'x'));
+	for (int i=0; i<501; ++i) small.tick();
+	record_stream.clear();
+	small.drain(recordPut);
+	small.enter(stedos::Event(app::lineDone, 1));
+	small.drain(recordPut);
+	stedos::replay::Record r;
+	const uint8_t* p   = record_stream.data();
+	const uint8_t* end = p + record_stream.size();
+	uint16_t events = 0, lost = 0, ticks = 0;
+	while (size_t used = stedos::replay::decode(p, end, r))
+	{
+		if (r.tag == stedos::RECORD_EVENT) events += 1;
+		if (r.tag == stedos::RECORD_LOST)  lost += r.index;
+		if (r.tag == stedos::RECORD_TICKS) ticks += r.index;
+		p += used;
+	}
+	assert((events + lost == 21) && (lost > 0) && "lost records counted");
+	assert((ticks == 501) && "ticks kept while the ring was full");
+	assert((r.tag == stedos::RECORD_EVENT) && (r.index == 2) && (r.value == 1) && "recording again");
+}
+
+STEDOS_WATCHDOG_INIT();
+
+/* A handler that hangs.  The simulated watchdog expires
+   and its reset hook jumps back to a simulated power up
+ */
+jmp_buf reboot;
+void watchdogReset(void) { longjmp(reboot, 1); }
+void hangHandler(uintptr_t data) { stedos::host::watchdogElapse(5000); }
+void mediumHandler(uintptr_t data) { test_clock += 60; }
+
+uintptr_t overran = 0;
+void overrunWarning(uintptr_t data) { overran = data; }
+
+typedef stedos::EventProcessor<8, stedos::Supervisor<TestClock> > SupervisedQueue;
+
+void test_watchdog(void)
+{
+	cout << "test_watchdog" << endl;
+	stedos::host::watchdog_unit& wd = stedos::host::watchdog();
+	wd.reset = watchdogReset;
+	MCUSR = _BV(PORF);
+
+	if (setjmp(reboot) == 0)
+	{
+		/* power up */
+		TestDebug debug;
+		SupervisedQueue queue;
+		stedos::watchdogBoot();
+		queue.profiler.setBudget(50);
+		assert((queue.profiler.setBudget(slowHandler, 150)) && "own budget");
+		queue.profiler.begin(&queue, &debug, WDTO_1S, overrunWarning);
+
+		assert((debug.reports == 0) && "nothing to report at power up");
+		assert((MCUSR == 0) && "reset cause cleared");
+		assert((wd.enabled && (wd.timeout == 1024)) && "watchdog started");
+
+		/* each round feeds the watchdog */
+		for (int i=0; i<3; ++i)
+		{
+			queue.queueEvent(fastHandler);
+			queue.process();
+			assert((stedos::host::watchdogElapse(600) == false) && "fed");
+		}
+		assert((wd.feeds == 3) && "feeds");
+
+		/* within budget */
+		queue.queueEvent(slowHandler);
+		queue.queueEvent(fastHandler);
+		queue.process();
+		assert((debug.reports == 0) && "within budget");
+
+		/* over the default budget */
+		queue.queueEvent(mediumHandler);
+		queue.process();
+		assert((debug.reports == 1) && "overrun reported");
+		assert((debug.level == LEVEL_WARN) && "warning");
+		assert((debug.code  == stedos::DEBUG_HANDLER_OVERRUN) && "overrun code");
+		assert((debug.value == (uint16_t) (uintptr_t) mediumHandler) && "overrun handler");
+		assert((overran == (uintptr_t) mediumHandler) && "warning event");
+		assert((queue.profiler.overrunCount() == 1) && "overrun count");
+
+		/* the handler never returns, so the watchdog isn't fed */
+		queue.queueEvent(hangHandler);
+		queue.process();
+		assert(false && "the watchdog should have reset");
+	}
+
+	/* after the watchdog reset */
+	{
+		TestDebug debug;
+		SupervisedQueue queue;
+		assert((wd.resets == 1) && "one reset");
+		assert((MCUSR & _BV(WDRF)) && "watchdog reset cause");
+		stedos::watchdogBoot();
+		queue.profiler.begin(&queue, &debug, WDTO_1S, overrunWarning);
+
+		assert((debug.reports == 2) && "hang and overrun reported");
+		assert((queue.profiler.resetHandler() == hangHandler) && "hung handler");
+		assert((debug.code  == stedos::DEBUG_HANDLER_OVERRUN) && "last overrun reported");
+		assert((debug.value == (uint16_t) (uintptr_t) mediumHandler) && "last overrun handler");
+	}
+
+	/* and a normal reset after that reports nothing */
+	{
+		TestDebug debug;
+		SupervisedQueue queue;
+		MCUSR = _BV(EXTRF);
+		stedos::watchdogBoot();
+		queue.profiler.begin(&queue, &debug, WDTO_1S);
+		assert((debug.reports == 0) && "clean reset");
+		assert((queue.profiler.resetHandler() == 0) && "no hung handler");
+	}
+
+	wd.reset = 0;
+	wdt_disable();
+}
+
+/* Events with deadlines run earliest first, and the ones that
+   start late are counted and reported
+ */
+typedef stedos::EdfEventProcessor<8, stedos::SimpleTimerImplementation<2> > EdfQueue;
+
+std::vector<uintptr_t> edf_order;
+void edfHandler(uintptr_t data) { edf_order.push_back(data); }
+
+/* A simulation of a periodic workload, with a burst of extra
+   work that overloads the CPU for a while.  Each job has a cost
+   in ticks, which pass while it runs, and a deadline.  The same
+   workload is run through the FIFO EventProcessor and the
+   EdfEventProcessor */
+enum { SIM_CONTROL, SIM_TELEMETRY, SIM_LOGGING, SIM_BURST, SIM_TYPES };
+
+struct SimTask
+{
+	uint8_t  period;
+	uint8_t  cost;
+	uint8_t  deadline;  /* relative to the release */
+	uint16_t from;      /* released between these ticks */
+	uint16_t to;
+};
+
+const SimTask sim_tasks[SIM_TYPES] =
+{
+	{  5, 1,  8,   0, 1000 },   /* control loop update */
+	{ 25, 4, 25,   0, 1000 },   /* telemetry frame     */
+	{ 10, 2, 50,   0, 1000 },   /* logging             */
+	{  2, 2, 30, 300,  400 },   /* the overload        */
+};
+
+uint16_t sim_now = 0;
+uint16_t sim_released[SIM_TYPES];
+uint16_t sim_missed[SIM_TYPES];
+uint16_t sim_run;
+stedos::TimerImplementationInterface* sim_timer;
+void (*sim_submit)(const uintptr_t& job, const uint16_t& deadline);
+
+void simTick(void)
+{
+	sim_now += 1;
+	sim_timer->tick();
+	for (uint8_t type=0; type<SIM_TYPES; ++type)
+	{
+		const SimTask& t = sim_tasks[type];
+		if ((sim_now >= t.from) && (sim_now < t.to) && ((sim_now % t.period) == 0))
+		{
+			uint16_t deadline = sim_now + t.deadline;
+			sim_released[type] += 1;
+			sim_submit(type | ((uintptr_t) deadline << 8), deadline);
+		}
+	}
+}
+
+void simJob(uintptr_t job)
+{
+	uint8_t  type     = job & 0xff;
+	uint16_t deadline = job >> 8;
+	if ((int16_t) (deadline - sim_now) < 0) sim_missed[type] += 1;
+	sim_run += 1;
+	for (uint8_t c=0; c<sim_tasks[type].cost; ++c) simTick();
+}
+
+stedos::EventProcessor<64> sim_fifo;
+stedos::EdfEventProcessor<64, stedos::SimpleTimerImplementation<1> > sim_edf;
+
+void fifoSubmit(const uintptr_t& job, const uint16_t& deadline) { sim_fifo.queueEvent(simJob, job); }
+void edfSubmit(const uintptr_t& job, const uint16_t& deadline)  { sim_edf.queueDeadline(stedos::Event(simJob, job), deadline); }
+
+/* Runs the workload, returning the total misses */
+template <typename Q>
+uint16_t simulate(const char* name, Q& queue)
+{
+	sim_now = 0;
+	sim_run = 0;
+	for (uint8_t type=0; type<SIM_TYPES; ++type) sim_released[type] = sim_missed[type] = 0;
+
+	while ((sim_now < 1000) || !queue.isEmpty())
+	{
+		if (queue.isEmpty()) simTick();
+		else queue.process();
+	}
+
+	uint16_t total = 0;
+	cout << name;
+	for (uint8_t type=0; type<SIM_TYPES; ++type)
+	{
+		cout << " " << sim_missed[type] << "/" << sim_released[type];
+		total += sim_missed[type];
+	}
+	cout << " missed, " << sim_run << " run" << endl;
+	return total;
+}
+
+void test_edf(void)
+{
+	cout << "test_edf" << endl;
+	sei();
+
+	EdfQueue queue;
+	stedos::SimpleTimerImplementation<2> timer(&queue);
+	TestDebug debug;
+	queue.begin(&timer, &debug);
+
+	/* earliest deadline first, background work last, in order */
+	const uint16_t deadlines[] = { 9, 3, 7, 1, 8, 2, 5 };
+	for (uint8_t i=0; i<7; ++i) assert(queue.queueDeadline(stedos::Event(edfHandler, deadlines[i]), deadlines[i]) && "queued");
+	queue.queueEvent(edfHandler, 100);
+	queue.queueEvent(edfHandler, 101);
+	assert(queue.queueDeadline(stedos::Event(edfHandler, 4), 4) && "queued the last");
+	assert((queue.queueDeadline(stedos::Event(edfHandler, 6), 6) == false) && "full");
+	assert((queue.droppedCount() == 1) && "dropped");
+	assert((queue.pendingCount() == 8) && "pending");
+
+	queue.process();
+	const uintptr_t expected[] = { 1, 2, 3, 4, 5, 7, 8, 9, 100, 101 };
+	assert((edf_order == std::vector<uintptr_t>(expected, expected + 10)) && "dispatch order");
+	assert((queue.missedCount() == 0) && (debug.reports == 0) && "none late");
+	assert(queue.isEmpty() && "empty");
+
+	/* an event that starts after its deadline tick is a miss */
+	edf_order.clear();
+	for (uint8_t i=0; i<3; ++i) timer.tick();
+	assert((timer.now() == 3) && "tick count");
+	queue.queueDeadline(stedos::Event(edfHandler, 1), 2);
+	queue.queueWithin(stedos::Event(edfHandler, 2), 0);
+	queue.queueWithin(stedos::Event(edfHandler, 3), 5);
+	queue.process();
+	assert((edf_order.size() == 3) && "late events still run");
+	assert((queue.missedCount() == 1) && "one miss");
+	assert((debug.reports == 1) && (debug.level == LEVEL_WARN) && (debug.code == stedos::DEBUG_DEADLINE_MISSED) && "reported");
+	assert((debug.value == (uint16_t) (uintptr_t) edfHandler) && "handler reported");
+
+	/* 0xfff0 is before the tick count (3), across the wrap.  It is
+	   the earliest, and is late, so it is dropped */
+	edf_order.clear();
+	queue.queueDeadline(stedos::Event(edfHandler, 2), 0x0010);
+	queue.queueDeadline(stedos::Event(edfHandler, 1), 0xfff0);
+	queue.queueDeadline(stedos::Event(edfHandler, 3), 0x0020);
+	assert((queue.pendingCount() == 3) && "pending");
+	for (uint8_t i=0; i<3; ++i) queue.queueEvent(edfHandler, 0);
+	queue.begin(&timer, &debug, true);
+	queue.process();
+	const uintptr_t wrapped[] = { 2, 3, 0, 0, 0 };
+	assert((edf_order == std::vector<uintptr_t>(wrapped, wrapped + 5)) && "late event dropped");
+	assert((queue.missedCount() == 2) && (debug.reports == 2) && "dropped event missed");
+
+	/* the overload simulation: the same jobs through each queue */
+	stedos::SimpleTimerImplementation<1> fifoTimer(&sim_fifo);
+	sim_timer  = &fifoTimer;
+	sim_submit = fifoSubmit;
+	uint16_t fifoMissed    = simulate("fifo", sim_fifo);
+	assert((sim_run == 199 + 39 + 99 + 50) && "none overwritten in the FIFO");
+	uint16_t fifoControl   = sim_missed[SIM_CONTROL];
+
+	stedos::SimpleTimerImplementation<1> edfTimer(&sim_edf);
+	sim_edf.begin(&edfTimer);
+	sim_timer  = &edfTimer;
+	sim_submit = edfSubmit;
+	uint16_t edfMissed     = simulate("edf ", sim_edf);
+	uint16_t edfControl    = sim_missed[SIM_CONTROL];
+	assert((sim_edf.missedCount() == edfMissed) && "misses counted by the processor");
+	assert((sim_edf.droppedCount() == 0) && "none dropped");
+
+	/* dropping the late jobs leaves more time for the others.  The
+	   jobs that do run are all on time */
+	uint16_t before = sim_edf.missedCount();
+	stedos::SimpleTimerImplementation<1> dropTimer(&sim_edf);
+	sim_edf.begin(&dropTimer, 0, true);
+	sim_timer = &dropTimer;
+	assert((simulate("drop", sim_edf) == 0) && "no late jobs run");
+	uint16_t dropMissed = sim_edf.missedCount() - before;
+	uint16_t released   = 0;
+	for (uint8_t type=0; type<SIM_TYPES; ++type) released += sim_released[type];
+	assert((sim_run + dropMissed == released) && "late jobs not run");
+	cout << "drop " << dropMissed << " late jobs dropped" << endl;
+	assert((dropMissed < edfMissed) && "fewer misses when late jobs are dropped");
+
+	assert((edfControl < fifoControl) && "fewer control updates late");
+	assert((edfMissed < fifoMissed) && "fewer misses");
+}
+
+stedos::EventProcessor<8> uart_queue;
+uint8_t  uart_events = 0;
+uintptr_t uart_trigger = 0;
+
+void uartReceived(uintptr_t data) { uart_events += 1; uart_trigger = data; }
+
+stedos::Uart<0, 16, 8> uart(&uart_queue, uartReceived);
+
+ISR(USART_RX_vect)   { uart.rxInterrupt(); }
+ISR(USART_UDRE_vect) { uart.txInterrupt(); }
+
+void receive(const char* s)
+{
+	while (*s)
+	{
+		UDR0.value = *s++;
+		stedos::host::interrupt(USART_RX_vect);
+	}
+}
+
+/* Feeds bytes through the simulated USART and
+   checks that events are only queued on the
+   configured triggers
+ */
+void test_uart(void)
+{
+	cout << "test_uart" << endl;
+	sei();
+	uart.setTerminator('\n');
+	uart.setWatermark(8);
+	uart.setIdleTimeout(3);
+	uart.begin(1);
+
+	assert((UBRR0L.value == 1) && (UBRR0H.value == 0) && "baud rate");
+	assert((UCSR0A.value == _BV(U2X0)) && "double speed");
+	assert((UCSR0B.value == (_BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0))) && "enabled");
+
+	/* a line is one event, not one per byte */
+	receive("hi\n");
+	assert((uart.available() == 3) && "buffered");
+	uart_queue.process();
+	assert((uart_events == 1) && (uart_trigger == stedos::UART_TRIGGER_TERMINATOR) && "terminator");
+
+	uint8_t c = 0;
+	assert(uart.read(c) && (c == 'h') && "read");
+	assert(uart.read(c) && (c == 'i') && "read");
+	assert(uart.read(c) && (c == '\n') && "read");
+	assert((uart.read(c) == false) && "read empty");
+
+	/* the watermark fires once when it is reached */
+	receive("0123456789");
+	uart_queue.process();
+	assert((uart_events == 2) && (uart_trigger == stedos::UART_TRIGGER_WATERMARK) && "watermark");
+
+	/* then the line goes idle */
+	uart.tick();
+	uart.tick();
+	uart_queue.process();
+	assert((uart_events == 2) && "not idle yet");
+	uart.tick();
+	uart_queue.process();
+	assert((uart_events == 3) && (uart_trigger == stedos::UART_TRIGGER_IDLE) && "idle");
+	uart.tick();
+	uart_queue.process();
+	assert((uart_events == 3) && "idle only once");
+
+	/* overflow the receive buffer */
+	receive("abcdefghij");
+	assert((uart.available() == 15) && "buffer full");
+	assert((uart.errorCount() == 5) && "overruns counted");
+	while (uart.read(c)) {}
+
+	/* transmit goes straight from the FIFO to UDR */
+	uart_events = 0;
+	assert((uart.write("abcdefghij") == 7) && "write until full");
+	assert((UCSR0B.value & _BV(UDRIE0)) && "UDRE interrupt enabled");
+
+	std::string sent;
+	while (UCSR0B.value & _BV(UDRIE0))
+	{
+		stedos::host::interrupt(USART_UDRE_vect);
+		if (UCSR0B.value & _BV(UDRIE0)) sent += (char) UDR0.value;
+	}
+	assert((sent == "abcdefg") && "transmitted");
+	uart_queue.process();
+	assert((uart_events == 0) && "no transmit events");
+}
+
+template <int SIZE>
+std::string drain(stedos::FIFO<char, SIZE>& f)
+{
+	std::string s;
+	while (!f.isEmpty()) s += f.pop();
+	return s;
+}
+
+void test_print(void)
+{
+	cout << "test_print" << endl;
+	stedos::FIFO<char, 128> out;
+
+	assert(stedos::print(out, "a", 'b', (char*) "c") && (drain(out) == "abc") && "strings");
+
+	/* uint8_t is printed as a number, char as a character */
+	stedos::print(out, (uint8_t) 0, ' ', (uint8_t) 255, ' ', (int8_t) -128);
+	assert((drain(out) == "0 255 -128") && "8 bit");
+	stedos::print(out, (uint16_t) 10000, ' ', (int16_t) -32768, ' ', (int16_t) 9);
+	assert((drain(out) == "10000 -32768 9") && "16 bit");
+	stedos::print(out, (uint32_t) 4294967295UL, ' ', (int32_t) -2147483647 - 1, ' ', (uint32_t) 1000000000UL);
+	assert((drain(out) == "4294967295 -2147483648 1000000000") && "32 bit");
+	stedos::print(out, 18446744073709551615ULL, ' ', (int64_t) -1);
+	assert((drain(out) == "18446744073709551615 -1") && "64 bit");
+	stedos::print(out, true, ' ', false);
+	assert((drain(out) == "1 0") && "bool");
+
+	/* matches printf for a spread of values */
+	for (int32_t v=-70000; v<70000; v+=7)
+	{
+		char expected[16];
+		snprintf(expected, sizeof(expected), "%d", (int) v);
+		stedos::print(out, v);
+		assert((drain(out) == expected) && "decimal");
+	}
+
+	stedos::print(out, stedos::hex((uint8_t) 0x0a), ' ', stedos::hex((uint16_t) 0xbeef), ' ', stedos::hex((int16_t) -1));
+	assert((drain(out) == "0a beef ffff") && "hex");
+
+	/* 8.8 fixed point */
+	stedos::print(out, stedos::fixed<8, 2>((int16_t) 0x0180), ' ', stedos::fixed<8, 3>((int16_t) -0x0140));
+	assert((drain(out) == "1.50 -1.250") && "fixed");
+	stedos::print(out, stedos::fixed<8, 2>((uint16_t) 0x01ff), ' ', stedos::fixed<8, 0>((uint16_t) 0x0280));
+	assert((drain(out) == "2.00 3") && "fixed rounding carries");
+	stedos::print(out, stedos::fixed<16, 4>((int32_t) 0x00032b02), ' ', stedos::fixed<4, 1>((int8_t) -1));
+	assert((drain(out) == "3.1680 -0.1") && "fixed sizes");
+
+	static const char message[] PROGMEM = "from flash";
+	stedos::print(out, stedos::flash(message));
+	assert((drain(out) == "from flash") && "flash");
+
+	/* output stops when the FIFO is full */
+	stedos::FIFO<char, 8> small;
+	assert((stedos::print(small, "t=", 123456) == false) && "full");
+	assert((drain(small) == "t=12345") && "truncated");
+
+	/* straight into the UART transmit buffer */
+	uart.print("n=", 42, '\n');
+	assert((UCSR0B.value & _BV(UDRIE0)) && "UDRE interrupt enabled");
+	std::string sent;
+	while (UCSR0B.value & _BV(UDRIE0))
+	{
+		stedos::host::interrupt(USART_UDRE_vect);
+		if (UCSR0B.value & _BV(UDRIE0)) sent += (char) UDR0.value;
+	}
+	assert((sent == "n=42\n") && "uart");
+}
+
+stedos::EventProcessor<4> adc_queue;
+const uint16_t* adc_block = 0;
+uint8_t adc_blocks = 0;
+void adcBlock(uintptr_t data)
+{
+	adc_block = (const uint16_t*) data;
+	adc_blocks += 1;
+}
+
+stedos::AdcPipeline<4> adc(&adc_queue, adcBlock);
+ISR(ADC_vect) { adc.interrupt(); }
+
+/* The CIC output for the samples up to n, worked out directly
+   as the convolution of ORDER boxcars of length R */
+template <int R, int ORDER>
+uint16_t cic_reference(const std::vector<uint16_t>& x, int n)
+{
+	std::vector<uint32_t> h(1, 1);
+	for (int o=0; o<ORDER; ++o)
+	{
+		std::vector<uint32_t> next(h.size() + R - 1, 0);
+		for (size_t i=0; i<h.size(); ++i)
+			for (int j=0; j<R; ++j) next[i + j] += h[i];
+		h = next;
+	}
+
+	uint64_t sum = 0;
+	for (size_t k=0; k<h.size(); ++k)
+	{
+		if (n - (int) k >= 0) sum += (uint64_t) h[k] * x[n - k];
+	}
+	uint64_t gain = 1;
+	for (int o=0; o<ORDER; ++o) gain *= R;
+	return sum / gain;
+}
+
+void test_adc(void)
+{
+	cout << "test_adc" << endl;
+	sei();
+
+	ADCSRB.value = 0x40 | stedos::ADC_TIMER1_OVERFLOW;    /* ACME, the comparator multiplexer */
+	adc.begin(_BV(REFS0) | 2);
+	assert((ADMUX.value == (_BV(REFS0) | 2)) && "reference and channel");
+	assert(((ADCSRB.value & 0x07) == stedos::ADC_FREE_RUNNING) && "free running");
+	assert((ADCSRB.value & 0x40) && "ACME kept");
+	assert((ADCSRA.value & _BV(ADSC)) && "first conversion started");
+	assert((ADCSRA.value & _BV(ADIE)) && "interrupt enabled");
+
+	/* one event per block, not per sample */
+	for (uint16_t v=0; v<3; ++v) stedos::host::convert(0x300 + v, ADC_vect);
+	adc_queue.process();
+	assert((adc_blocks == 0) && "block not full");
+	stedos::host::convert(0x303, ADC_vect);
+	adc_queue.process();
+	assert((adc_blocks == 1) && "block event");
+	assert((adc_block[0] == 0x300) && (adc_block[3] == 0x303) && "block samples");
+	const uint16_t* first = adc_block;
+
+	/* the second block fills while the first is held,
+	   then there is nowhere to put the samples */
+	for (uint16_t v=0; v<6; ++v) stedos::host::convert(v, ADC_vect);
+	adc_queue.process();
+	assert((adc_blocks == 2) && (adc_block != first) && "second block");
+	assert((adc.droppedCount() == 2) && "dropped without a free block");
+
+	adc.release(first);
+	adc.release(adc_block);
+	for (uint16_t v=0; v<4; ++v) stedos::host::convert(v, ADC_vect);
+	adc_queue.process();
+	assert((adc_blocks == 3) && (adc_block == first) && "blocks reused");
+	adc.release(adc_block);
+
+	adc.stop();
+	assert((ADCSRA.value == 0) && "stopped");
+
+	/* a timer trigger's flag is cleared for each conversion, so
+	   the next edge can start one without a timer ISR */
+	stedos::host::timers().tifr1.value = _BV(TOV1) | _BV(OCF1A);
+	adc.begin(_BV(REFS0) | 2, stedos::ADC_TIMER1_OVERFLOW);
+	assert(((ADCSRB.value & 0x07) == stedos::ADC_TIMER1_OVERFLOW) && "timer triggered");
+	assert(((ADCSRA.value & _BV(ADSC)) == 0) && "waits for the timer");
+	assert((stedos::host::timers().tifr1.value == _BV(OCF1A)) && "stale trigger cleared");
+	stedos::host::timers().tifr1.value |= _BV(TOV1);
+	stedos::host::convert(0x100, ADC_vect);
+	assert((stedos::host::timers().tifr1.value == _BV(OCF1A)) && "trigger cleared, other flags kept");
+	adc.stop();
+
+	/* the decimators */
+	std::vector<uint16_t> x;
+	for (int n=0; n<256; ++n) x.push_back((n * 37 + (n * n) % 101) & 0x3ff);
+
+	stedos::AdcBoxcar<4> boxcar;
+	stedos::AdcCic<4, 1> cic1;
+	stedos::AdcCic<8, 3> cic3;
+	uint16_t out, out1;
+	int outputs = 0;
+	for (int n=0; n<256; ++n)
+	{
+		bool ready = boxcar.add(x[n], out);
+		assert((ready == cic1.add(x[n], out1)) && "same rate");
+		if (ready)
+		{
+			assert((out == (x[n] + x[n-1] + x[n-2] + x[n-3]) / 4) && "boxcar average");
+			assert((out1 == out) && "a first order CIC is a boxcar");
+			outputs += 1;
+		}
+		if (cic3.add(x[n], out))
+		{
+			assert((out == cic_reference<8, 3>(x, n)) && "CIC matches convolution");
+		}
+	}
+	assert((outputs == 64) && "decimated by 4");
+
+	/* a constant comes through unchanged, even after the integrators wrap */
+	stedos::AdcCic<256, 2> wide;
+	for (int n=0; n<256 * 40; ++n)
+	{
+		if (wide.add(1023, out) && (n > 512)) assert((out == 1023) && "CIC DC gain");
+	}
+
+	/* through the pipeline, a block of 4 holds 16 samples */
+	stedos::AdcPipeline<4, stedos::AdcBoxcar<4> > decimated(&adc_queue, adcBlock);
+	adc_blocks = 0;
+	for (int n=0; n<16; ++n)
+	{
+		ADCL.value = n * 4;
+		ADCH.value = 0;
+		decimated.interrupt();
+	}
+	adc_queue.process();
+	assert((adc_blocks == 1) && "16 samples in one decimated block");
+	assert((adc_block[0] == 6) && (adc_block[3] == 54) && "decimated samples");
+}
+
+stedos::EventProcessor<8> bus_queue;
+std::vector<stedos::BusTransaction*> bus_done;
+void busDone(uintptr_t data) { bus_done.push_back((stedos::BusTransaction*) data); }
+
+stedos::Spi<3, stedos::port_b> spi(&bus_queue);
+ISR(SPI_STC_vect) { spi.interrupt(); }
+
+stedos::Twi<4> twi(&bus_queue);
+ISR(TWI_vect) { twi.interrupt(); }
+
+/* Plays the SPI slave until the queue is empty.  The slave
+   replies with a count, and the chip selects are recorded */
+std::vector<uint8_t> spi_mosi;
+std::vector<uint8_t> spi_select;
+void spi_run(void)
+{
+	uint8_t reply = 0xa0;
+	while (!spi.isIdle())
+	{
+		spi_mosi.push_back(SPDR.value);
+		spi_select.push_back(PORTB.value);
+		SPDR.value = reply++;
+		stedos::host::interrupt(SPI_STC_vect);
+	}
+}
+
+/* Plays a TWI slave with a register pointer, like most sensors:
+   the first byte written sets the pointer, then bytes are
+   written or read from there.  Returns the number of stops */
+uint8_t twi_memory[16];
+int twi_run(const uint8_t& address)
+{
+	static uint8_t pointer = 0;
+	uint8_t status = 0;
+	bool first = false;
+	int stops = 0;
+
+	while (1)
+	{
+		uint8_t cr = TWCR.value;
+		uint8_t previous = status;
+
+		if (cr & _BV(TWSTO))
+		{
+			stops += 1;
+			if ((cr & _BV(TWSTA)) == 0) return stops;
+			status = 0x08;
+		}
+		else if (cr & _BV(TWSTA))
+		{
+			status = previous ? 0x10 : 0x08;
+		}
+		else if ((previous == 0x08) || (previous == 0x10))
+		{
+			bool read = TWDR.value & 1;
+			if ((TWDR.value >> 1) != address) status = read ? 0x48 : 0x20;
+			else                              status = read ? 0x40 : 0x18;
+			first = true;
+		}
+		else if ((previous == 0x18) || (previous == 0x28))
+		{
+			if (first) pointer = TWDR.value;
+			else       twi_memory[pointer++ & 0x0f] = TWDR.value;
+			first  = false;
+			status = 0x28;
+		}
+		else if ((previous == 0x40) || (previous == 0x50))
+		{
+			TWDR.value = twi_memory[pointer++ & 0x0f];
+			status = (cr & _BV(TWEA)) ? 0x50 : 0x58;
+		}
+
+		TWSR.value = status;
+		stedos::host::interrupt(TWI_vect);
+	}
+}
+
+void test_bus(void)
+{
+	cout << "test_bus" << endl;
+	sei();
+
+	/* SPI: two transactions on different chip selects, queued together */
+	PORTB.value = 0xff;
+	spi.begin(_BV(CPOL) | _BV(CPHA), true);
+	assert((SPCR.value == (_BV(SPIE) | _BV(SPE) | _BV(MSTR) | _BV(CPOL) | _BV(CPHA))) && "SPI mode 3");
+	assert((SPSR.value == _BV(SPI2X)) && "SPI double speed");
+
+	const uint8_t command[] = { 0x10, 0x20 };
+	uint8_t result[3] = { 0 };
+	stedos::BusTransaction read  = { _BV(2), command, 2, result, 3, stedos::Event(busDone) };
+	stedos::BusTransaction write = { _BV(1), command, 1, 0, 0, stedos::Event(busDone) };
+	stedos::BusTransaction empty = { _BV(1), 0, 0, 0, 0, stedos::Event(busDone) };
+	read.done.data  = (uintptr_t) &read;
+	write.done.data = (uintptr_t) &write;
+	empty.done.data = (uintptr_t) &empty;
+
+	assert(spi.queue(&read) && spi.queue(&empty) && spi.queue(&write) && "queued");
+	assert((spi.queue(&write) == false) && "queue full");
+	assert((SPDR.value == 0x10) && (PORTB.value == (uint8_t) ~_BV(2)) && "first transaction started");
+	assert((read.status == stedos::BUS_PENDING) && "pending");
+
+	spi_run();
+	const uint8_t mosi[] = { 0x10, 0x20, 0xff, 0xff, 0xff, 0x10 };
+	assert((spi_mosi == std::vector<uint8_t>(mosi, mosi + 6)) && "written then read");
+	assert((spi_select[4] == (uint8_t) ~_BV(2)) && (spi_select[5] == (uint8_t) ~_BV(1)) && "chip selects");
+	assert((PORTB.value == 0xff) && "deselected");
+	assert((result[0] == 0xa2) && (result[1] == 0xa3) && (result[2] == 0xa4) && "read");
+
+	/* one event per transaction, once it has finished */
+	assert(bus_done.empty() && "events not run yet");
+	bus_queue.process();
+	assert((bus_done.size() == 3) && (bus_done[0] == &read) && (bus_done[1] == &empty) && (bus_done[2] == &write) && "completion events");
+	assert((read.status == stedos::BUS_OK) && (write.status == stedos::BUS_OK) && "completed");
+
+	/* TWI: write some registers, read them back, then a slave that isn't there */
+	twi.begin(12);
+	assert((TWBR.value == 12) && (TWCR.value == _BV(TWEN)) && "TWI enabled");
+
+	const uint8_t registers[] = { 0x02, 0xaa, 0xbb, 0xcc };
+	uint8_t values[3] = { 0 };
+	uint8_t single = 0;
+	stedos::BusTransaction twi_write  = { 0x50, registers, 4, 0, 0, stedos::Event(busDone) };
+	stedos::BusTransaction twi_read   = { 0x50, registers, 1, values, 3, stedos::Event(busDone) };
+	stedos::BusTransaction twi_absent = { 0x51, registers, 1, values, 3, stedos::Event(busDone) };
+	stedos::BusTransaction twi_next   = { 0x50, 0, 0, &single, 1, stedos::Event(busDone) };
+	twi_write.done.data  = (uintptr_t) &twi_write;
+	twi_read.done.data   = (uintptr_t) &twi_read;
+	twi_absent.done.data = (uintptr_t) &twi_absent;
+	twi_next.done.data   = (uintptr_t) &twi_next;
+
+	twi_memory[5] = 0x55;
+	bus_done.clear();
+	assert(twi.queue(&twi_write) && twi.queue(&twi_read) && twi.queue(&twi_absent) && "queued");
+	assert((TWCR.value & _BV(TWSTA)) && "start sent");
+	assert((twi_run(0x50) == 3) && "back to back, with a stop each");
+	assert(twi.queue(&twi_next) && (twi_run(0x50) == 1) && "read without writing");
+	assert(twi.isIdle() && "idle");
+
+	assert((twi_memory[2] == 0xaa) && (twi_memory[4] == 0xcc) && "written");
+	assert((values[0] == 0xaa) && (values[1] == 0xbb) && (values[2] == 0xcc) && "read back");
+	assert((single == 0x55) && "read from the pointer");
+	assert((twi_write.status == stedos::BUS_OK) && (twi_read.status == stedos::BUS_OK) && "completed");
+	assert((twi_absent.status == stedos::BUS_NACK) && "no slave");
+
+	bus_queue.process();
+	assert((bus_done.size() == 4) && (bus_done[2] == &twi_absent) && (bus_done[3] == &twi_next) && "completion events");
+}
+
+stedos::EventProcessor<4> eeprom_queue;
+uint16_t eeprom_written = 0xffff;
+uint8_t eeprom_flushed = 0;
+void eepromWritten(uintptr_t address) { eeprom_written = address; }
+void eepromFlushed(uintptr_t data) { eeprom_flushed += 1; }
+
+typedef stedos::EepromCache<8, 2> eeprom_cache_t;
+eeprom_cache_t eeprom_cache(&eeprom_queue, eepromWritten);
+ISR(EE_READY_vect) { eeprom_cache.interrupt(); }
+
+/* Lets the simulated EEPROM finish all of its writes */
+void eeprom_run(void)
+{
+	while (stedos::host::eepromStep(EE_READY_vect)) {}
+}
+
+struct Settings
+{
+	uint32_t count;
+	uint8_t  mode;
+};
+
+void test_eeprom(void)
+{
+	cout << "test_eeprom" << endl;
+	sei();
+	stedos::host::eeprom_unit& sim = stedos::host::eeprom();
+	sim.reset();
+
+	/* writes go to the shadow, and are stored later */
+	assert(eeprom_cache.write(0x0e, "hello", 5) && "write");
+	assert((EECR.value & _BV(EERIE)) && "write back started");
+	assert((sim.memory[0x0e] == 0xff) && (sim.writes == 0) && "not stored yet");
+	assert((eeprom_cache.isClean() == false) && "dirty");
+
+	char text[6] = { 0 };
+	eeprom_cache.read(0x0e, text, 5);
+	assert((strcmp(text, "hello") == 0) && "read from the shadow");
+
+	/* the two blocks are in use, so a third can't be written */
+	assert((eeprom_cache.write(0x20, "x", 1) == false) && (eeprom_cache.rejectedCount() == 1) && "shadow full");
+
+	/* one byte per interrupt, 3.4 ms each */
+	stedos::host::eepromStep(EE_READY_vect);
+	assert((sim.writes == 0) && (EECR.value & _BV(EEPE)) && "one byte in progress");
+	eeprom_run();
+	assert((memcmp(&sim.memory[0x0e], "hello", 5) == 0) && "stored");
+	assert((sim.writes == 5) && (sim.elapsed == 5 * 3400) && "write time");
+	assert(((EECR.value & _BV(EERIE)) == 0) && eeprom_cache.isClean() && "idle");
+	eeprom_queue.process();
+	assert((eeprom_written == 0x10) && "block written event");
+
+	text[0] = 0;
+	eeprom_cache.read(0x0e, text, 5);
+	assert((strcmp(text, "hello") == 0) && "read from the EEPROM");
+
+	/* unchanged bytes aren't written again */
+	eeprom_cache.write(0x0e, "help", 4);
+	eeprom_run();
+	assert((sim.writes == 6) && (sim.wear[0x11] == 2) && (sim.wear[0x0e] == 1) && "only changed bytes");
+
+	/* a flush waits for everything written before it */
+	eeprom_cache.write(0x40, "abc", 3);
+	assert(eeprom_cache.flush(stedos::Event(eepromFlushed)) && "flush");
+	assert((eeprom_cache.flush(stedos::Event(eepromFlushed)) == false) && "one flush at a time");
+	stedos::host::eepromStep(EE_READY_vect);
+	eeprom_queue.process();
+	assert((eeprom_flushed == 0) && "not flushed yet");
+	eeprom_run();
+	eeprom_queue.process();
+	assert((eeprom_flushed == 1) && (memcmp(&sim.memory[0x40], "abc", 3) == 0) && "flushed");
+
+	/* a settings record written 160 times over 8 slots */
+	sim.reset();
+	stedos::EepromLog<Settings, eeprom_cache_t> log(eeprom_cache, 0x100, 8);
+	Settings s = Settings();
+	assert((log.begin() == false) && (log.read(s) == false) && "no record yet");
+
+	for (uint32_t n=1; n<=160; ++n)
+	{
+		s.count = n;
+		s.mode  = 3;
+		assert(log.write(s) && "log write");
+		eeprom_run();
+	}
+
+	uint32_t most = 0;
+	for (int idx=0; idx<stedos::host::eeprom_unit::SIZE; ++idx)
+	{
+		if (sim.wear[idx] > most) most = sim.wear[idx];
+	}
+	assert((most <= 160 / 8) && "wear spread over the slots");
+
+	/* after a reset, the newest record is found */
+	stedos::EepromLog<Settings, eeprom_cache_t> restarted(eeprom_cache, 0x100, 8);
+	Settings r = Settings();
+	assert(restarted.begin() && restarted.read(r) && (r.count == 160) && (r.mode == 3) && "newest record");
+
+	/* a write cut short fails the check, so the one before is used */
+	const uint16_t record = sizeof(Settings) + 2;
+	sim.memory[0x100 + 7 * record + record - 1] ^= 0x01;
+	stedos::EepromLog<Settings, eeprom_cache_t> torn(eeprom_cache, 0x100, 8);
+	assert(torn.begin() && torn.read(r) && (r.count == 159) && "torn write ignored");
+
+	/* and the log carries on from there */
+	s.count = 161;
+	torn.write(s);
+	eeprom_run();
+	assert(restarted.begin() && restarted.read(r) && (r.count == 161) && "carries on");
+}
+
+/* Checks the catalogue check value (the CRC of "123456789")
+   with each table size, and that adding the bytes one at a
+   time gives the same result */
+template <template <typename> class CRC>
+void check_crc(const char* name, const uint32_t& expected)
+{
+	const uint8_t* data = (const uint8_t*) "123456789";
+
+	assert((CRC<stedos::CrcFullTable>::compute(data, 9) == expected) && name);
+	assert((CRC<stedos::CrcNibbleTable>::compute(data, 9) == expected) && name);
+	assert((CRC<stedos::CrcBitwise>::compute(data, 9) == expected) && name);
+
+	CRC<stedos::CrcNibbleTable> crc;
+	for (int i=0; i<9; ++i) crc.update(data[i]);
+	assert((crc.value() == expected) && name);
+	crc.reset();
+	crc.update(data, 4).update(data + 4, 5);
+	assert((crc.value() == expected) && name);
+}
+
+template <typename TABLE> using Crc24 = stedos::Crc<0x864cfb, 24, false, 0xb704ce, 0, TABLE>;
+template <typename TABLE> using Crc32Bzip2 = stedos::Crc<0x04c11db7, 32, false, 0xffffffff, 0xffffffff, TABLE>;
+
+void test_crc(void)
+{
+	cout << "test_crc" << endl;
+
+	check_crc<stedos::Crc8>("CRC-8", 0xf4);
+	check_crc<stedos::Crc8Maxim>("CRC-8/MAXIM", 0xa1);
+	check_crc<stedos::Crc16Ccitt>("CRC-16/CCITT-FALSE", 0x29b1);
+	check_crc<stedos::Crc16Xmodem>("CRC-16/XMODEM", 0x31c3);
+	check_crc<stedos::Crc16Kermit>("CRC-16/KERMIT", 0x2189);
+	check_crc<stedos::Crc16Modbus>("CRC-16/MODBUS", 0x4b37);
+	check_crc<stedos::Crc32>("CRC-32", 0xcbf43926);
+	check_crc<stedos::Crc32c>("CRC-32C", 0xe3069283);
+	check_crc<Crc32Bzip2>("CRC-32/BZIP2", 0xfc891918);
+	check_crc<Crc24>("CRC-24/OPENPGP", 0x21cf02);
+
+	assert((sizeof(stedos::Crc16Ccitt<>::value_type) == 2) && "smallest type");
+
+	/* the framing CRC is the same CRC */
+	uint16_t framing = stedos::_internal::CRC16_INIT;
+	for (int i=0; i<9; ++i) framing = stedos::_internal::crc16_ccitt(framing, "123456789"[i]);
+	assert((framing == 0x29b1) && "framing CRC");
+
+	/* straight from a FIFO that has wrapped, a run at a time */
+	stedos::FIFO<uint8_t, 16> fifo;
+	for (int i=0; i<12; ++i) fifo.push(0);
+	for (int i=0; i<12; ++i) fifo.pop();
+	for (int i=0; i<9; ++i) fifo.push("123456789"[i]);
+
+	stedos::Crc32<> crc;
+	const uint8_t* run;
+	uint8_t count;
+	uint8_t runs = 0;
+	while ((count = fifo.contiguous(run)) > 0)
+	{
+		crc.update(run, count);
+		fifo.drop(count);
+		runs += 1;
+	}
+	assert((runs == 2) && fifo.isEmpty() && "two runs");
+	assert((crc.value() == 0xcbf43926) && "CRC of the FIFO");
+}
+
+/* A repeatable sequence of samples in -range..range */
+double noise(uint32_t& seed, const double& range)
+{
+	seed = seed * 1103515245 + 12345;
+	return range * ((double) ((seed >> 8) & 0xffff) / 32768.0 - 1.0);
+}
+
+void test_fixed(void)
+{
+	cout << "test_fixed" << endl;
+	typedef stedos::Fixed<1, 15> q15;
+	typedef stedos::Fixed<8, 8>  q8_8;
+	typedef stedos::Fixed<2, 14> coeff;
+	const double LSB = 1.0 / 32768;
+
+	/* conversions */
+	assert((q8_8(1.5).raw() == 0x0180) && (q8_8(-0.25).raw() == -0x40) && "from double");
+	assert((q15(1.0).raw() == q15::MAX) && (q15(-2.0).raw() == q15::MIN) && "from double saturates");
+	assert((q8_8::fromInt(-3).raw() == -0x300) && (q8_8::fromInt(1000).raw() == q8_8::MAX) && "from int");
+	assert((q8_8(-1.5).toInt() == -2) && (q8_8(2.75).toInt() == 2) && "to int rounds down");
+
+	/* saturating arithmetic */
+	assert(((q15(0.75) + q15(0.5)).raw() == q15::MAX) && "add saturates");
+	assert(((q15(-0.75) - q15(0.5)).raw() == q15::MIN) && "subtract saturates");
+	assert(((-q15::fromRaw(q15::MIN)).raw() == q15::MAX) && "negate saturates");
+	assert(((q15::fromRaw(q15::MIN) * q15::fromRaw(q15::MIN)).raw() == q15::MAX) && "-1 * -1 saturates");
+	assert(((q8_8(100.0) * q8_8(2.0)).raw() == q8_8::MAX) && "multiply saturates");
+	assert(((q8_8(1.5) * q8_8(-2.25)) == q8_8(-3.375)) && "multiply");
+
+	/* a multiply is within half an LSB of the exact result */
+	uint32_t seed = 1;
+	for (int n=0; n<10000; ++n)
+	{
+		q15 a = q15::fromRaw((int16_t) (noise(seed, 32767)));
+		q15 b = q15::fromRaw((int16_t) (noise(seed, 32767)));
+		double exact = a.toDouble() * b.toDouble();
+		assert((fabs((a * b).toDouble() - exact) <= 0.5 * LSB) && "multiply rounding");
+	}
+
+	stedos::FIFO<char, 32> text;
+	stedos::print(text, stedos::fixed<3>(q8_8(-1.25)));
+	std::string printed;
+	while (!text.isEmpty()) printed += text.pop();
+	assert((printed == "-1.250") && "print a Fixed");
+
+	/* a Butterworth low pass at fs / 20 against a double
+	   precision filter with the same (rounded) coefficients */
+	const double w  = 2 * M_PI / 20;
+	const double al = sin(w) / (2 * sqrt(0.5));
+	const double a0 = 1 + al;
+	coeff cb0((1 - cos(w)) / 2 / a0), cb1((1 - cos(w)) / a0), cb2((1 - cos(w)) / 2 / a0);
+	coeff ca1(-2 * cos(w) / a0), ca2((1 - al) / a0);
+	stedos::Biquad<q15, coeff> lowpass(cb0, cb1, cb2, ca1, ca2);
+
+	double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+	double worst = 0;
+	seed = 2;
+	for (int n=0; n<5000; ++n)
+	{
+		q15 in(noise(seed, 0.5) + ((n / 200) & 1 ? 0.3 : -0.3));
+		double x = in.toDouble();
+		double y = cb0.toDouble() * x + cb1.toDouble() * x1 + cb2.toDouble() * x2
+		         - ca1.toDouble() * y1 - ca2.toDouble() * y2;
+		x2 = x1; x1 = x; y2 = y1; y1 = y;
+
+		double error = fabs(lowpass.step(in).toDouble() - y);
+		if (error > worst) worst = error;
+	}
+	assert((worst < 8 * LSB) && "biquad accuracy");
+
+	/* a high pass with its poles near -1 has a gain of 380 at fs / 2,
+	   so a full scale input at fs / 2 must saturate the output, and
+	   not overflow the sum */
+	stedos::Biquad<q15, coeff> highpass(coeff(0.95), coeff(-1.9), coeff(0.95), coeff(1.8), coeff(0.81));
+	for (int n=0; n<200; ++n)
+	{
+		q15 in = q15::fromRaw((n & 1) ? 32767 : -32768);
+		int16_t out = highpass.step(in).raw();
+		if (n >= 4) assert((out == ((n & 1) ? 32767 : -32768)) && "biquad saturates");
+	}
+
+	/* the moving average and the smoothing */
+	stedos::MovingAverage<q15, 8> average;
+	stedos::ExpSmoothing<q15, 4> smooth;
+	double window[8] = { 0 };
+	double ys = 0;
+	double worstAverage = 0, worstSmooth = 0;
+	seed = 3;
+	for (int n=0; n<5000; ++n)
+	{
+		q15 in(noise(seed, 0.9));
+		window[n & 7] = in.toDouble();
+		double mean = 0;
+		for (int k=0; k<8; ++k) mean += window[k] / 8;
+		ys += (in.toDouble() - ys) / 16;
+
+		worstAverage = fmax(worstAverage, fabs(average.step(in).toDouble() - mean));
+		worstSmooth  = fmax(worstSmooth,  fabs(smooth.step(in).toDouble() - ys));
+	}
+	assert((worstAverage <= 0.5 * LSB) && "moving average accuracy");
+	assert((worstSmooth <= 1.0 * LSB) && "smoothing accuracy");
+
+	/* a block through FIFOs gives the same as one at a time */
+	stedos::MovingAverage<q15, 4> single, block;
+	stedos::FIFO<q15, 16> in;
+	stedos::FIFO<q15, 8> out;
+	for (int n=0; n<10; ++n) in.push(q15::fromRaw(n * 1000 - 3000));
+	for (int n=0; n<4; ++n) in.pop();
+	for (int n=0; n<8; ++n) in.push(q15::fromRaw(n * 1000 - 3000));
+
+	assert((block.process(in, out) == 7) && "until out is full");
+	assert((in.count() == 7) && "the rest are left");
+	std::vector<int16_t> expected;
+	for (int n=4; n<10; ++n) expected.push_back(single.step(q15::fromRaw(n * 1000 - 3000)).raw());
+	for (int n=0; n<8; ++n) expected.push_back(single.step(q15::fromRaw(n * 1000 - 3000)).raw());
+	for (int n=0; n<7; ++n) assert((out.pop().raw() == expected[n]) && "block matches");
+	assert((block.process(in, out) == 7) && in.isEmpty() && "the rest");
+	for (int n=7; n<14; ++n) assert((out.pop().raw() == expected[n]) && "block matches");
+
+	/* and in place */
+	q15 samples[4] = { q15(0.5), q15(0.5), q15(0.5), q15(0.5) };
+	stedos::MovingAverage<q15, 2> pair;
+	pair.process(samples, 4);
+	assert((samples[0] == q15(0.25)) && (samples[3] == q15(0.5)) && "in place");
+}
+
+std::vector<uint8_t> wire;
+void wirePut(uint8_t b) { wire.push_back(b); }
+
+const stedos::Frame<252>* received_frame = 0;
+uint8_t frames_received = 0;
+void frameReceived(uintptr_t data)
+{
+	received_frame = (const stedos::Frame<252>*) data;
+	frames_received += 1;
+}
+
+/* Encodes payloads, feeds the encoded bytes
+   back through the decoder and checks that
+   exactly one event arrives per good frame
+ */
+template <typename CODEC>
+void check_frames(const char* name)
+{
+	cout << "test_frames " << name << endl;
+	stedos::EventProcessor<4> queue;
+	stedos::FrameDecoder<CODEC, 252> decoder(&queue, frameReceived);
+	stedos::FrameEncoder<CODEC> encoder;
+
+	uint8_t payloads[4][252];
+	uint8_t lengths[4] = { 1, 9, 252, 200 };
+	for (int i=0; i<252; ++i)
+	{
+		payloads[0][i] = 0;
+		payloads[1][i] = (uint8_t) "1\xc0\x00\xdb" "56789"[i % 9];
+		payloads[2][i] = (uint8_t) (i + 1);		/* a long run without zeros */
+		payloads[3][i] = (uint8_t) (i * 7);
+	}
+
+	for (int f=0; f<4; ++f)
+	{
+		wire.clear();
+		frames_received = 0;
+		encoder.encode(payloads[f], lengths[f], wirePut);
+
+		for (uint8_t b : wire) decoder.push(b);
+		queue.process();
+		assert((frames_received == 1) && "one event per frame");
+		assert((received_frame->length == lengths[f]) && "frame length");
+		assert((memcmp(received_frame->data, payloads[f], lengths[f]) == 0) && "frame data");
+		decoder.release(received_frame);
+	}
+
+	/* a corrupt frame is dropped and counted */
+	wire.clear();
+	frames_received = 0;
+	encoder.encode(payloads[1], 9, wirePut);
+	wire[3] ^= 0x01;
+	for (uint8_t b : wire) decoder.push(b);
+	queue.process();
+	assert((frames_received == 0) && "bad CRC dropped");
+	assert((decoder.errorCount() == 1) && "bad CRC counted");
+
+	/* two frames through a FIFO, without releasing */
+	stedos::FIFO<uint8_t, 128> fifo;
+	wire.clear();
+	encoder.encode(payloads[1], 9, wirePut);
+	encoder.encode(payloads[1], 5, wirePut);
+	for (uint8_t b : wire) fifo.push(b);
+	decoder.push(fifo);
+	queue.process();
+	assert((frames_received == 2) && "both buffers used");
+
+	/* a third frame has nowhere to go until one is released */
+	wire.clear();
+	encoder.encode(payloads[1], 3, wirePut);
+	for (uint8_t b : wire) decoder.push(b);
+	queue.process();
+	assert((frames_received == 2) && "no free buffer");
+	assert((decoder.errorCount() == 2) && "dropped for no buffer");
+}
+
+void test_frames(void)
+{
+	/* CRC-16/CCITT-FALSE check value */
+	uint16_t crc = 0xffff;
+	for (const char* p = "123456789"; *p; ++p) crc = stedos::_internal::crc16_ccitt(crc, *p);
+	assert((crc == 0x29b1) && "CRC check value");
+
+	/* The payload "123456789" has no zeros, so COBS is one block:
+	   a code byte, the payload, the CRC and the delimiter */
+	stedos::FrameEncoder<stedos::Cobs> cobs;
+	wire.clear();
+	assert((cobs.encode((const uint8_t*) "123456789", 9, wirePut) == 13) && "COBS length");
+	assert((wire[0] == 12) && (wire[10] == 0x29) && (wire[11] == 0xb1) && (wire[12] == 0) && "COBS bytes");
+
+	/* SLIP escapes END and ESC */
+	stedos::FrameEncoder<stedos::Slip> slip;
+	wire.clear();
+	slip.encode((const uint8_t*) "\xc0\xdb", 2, wirePut);
+	assert((wire[0] == 0xdb) && (wire[1] == 0xdc) && (wire[2] == 0xdb) && (wire[3] == 0xdd) && "SLIP escapes");
+	assert((wire.back() == 0xc0) && "SLIP end");
+
+	check_frames<stedos::Cobs>("COBS");
+	check_frames<stedos::Slip>("SLIP");
+}
+
+/* Checks the simulated PIN register: it reads back
+   outputs and inputs, and writing to it toggles PORT
+ */
+void test_registers(void)
+{
+	cout << "test_registers" << endl;
+	stedos::IO<stedos::port_c, 0, 4> nibble;
+
+	nibble.setMode(stedos::PORT_MODE_OUTPUT);
+	stedos::host::drive(2, 0xf0);
+	nibble.set(0x5);
+	assert((PORTC.value == 0x05) && "PORTC");
+	assert((nibble.read() == 0x5) && "read back outputs");
+	assert((PINC == 0xf5) && "PINC mixes inputs and outputs");
+
+	nibble.toggle();
+	assert((PORTC.value == 0x0a) && "toggle through PINC");
+}
+
+/* The host backend counts register accesses and
+   critical sections.  These checks pin down the
+   cost of the stedos primitives so that any change
+   to them is noticed.
+ */
+void test_costs(void)
+{
+	cout << "test_costs" << endl;
+	stedos::IO<stedos::port_d, 2>    led;
+	stedos::IO<stedos::port_d, 4, 3> bus;
+	stedos::FIFO<char, 8> fifo;
+	stedos::EventProcessor<4> queue;
+	stedos::host::Counters& c = stedos::host::counters();
+
+	stedos::host::resetCounters();
+	led.set();
+	assert((c.reads == 1) && (c.writes == 1) && "IO::set()");
+
+	stedos::host::resetCounters();
+	led.toggle();
+	assert((c.reads == 0) && (c.writes == 1) && "IO::toggle()");
+
+	stedos::host::resetCounters();
+	bus.set(3);
+	assert((c.reads == 1) && (c.writes == 1) && "IO::set(v)");
+
+	stedos::host::resetCounters();
+	bus.read();
+	assert((c.reads == 1) && (c.writes == 0) && "IO::read()");
+
+	stedos::host::resetCounters();
+	fifo.push('a');
+	assert((c.critical == 1) && "FIFO::push()");
+	fifo.pop();
+	assert((c.critical == 2) && "FIFO::pop()");
+
+	/* queue one event, then process: isEmpty, pop, isEmpty */
+	stedos::host::resetCounters();
+	queue.queueEvent(timerCallback, 0);
+	assert((c.critical == 1) && "queueEvent()");
+	queue.process();
+	assert((c.critical == 4) && "process()");
+}
+
+uint8_t isr_calls = 0;
+ISR(TEST_vect) { isr_calls += 1; }
+
+/* Checks the interrupt flag model.  Interrupts that
+   arrive inside a critical section are held off until
+   the end of it, and only run once.
+ */
+void test_interrupts(void)
+{
+	cout << "test_interrupts" << endl;
+	sei();
+	stedos::host::interrupt(TEST_vect);
+	assert((isr_calls == 1) && "runs when enabled");
+	assert(stedos::host::interruptsEnabled() && "enabled after reti");
+
+	{
+		auto a = stedos::Atomic();
+		stedos::host::interrupt(TEST_vect);
+		stedos::host::interrupt(TEST_vect);
+		assert((isr_calls == 1) && "held off by Atomic");
+	}
+	assert((isr_calls == 2) && "runs once at the end of Atomic");
+}
+
 int main(void)
 {
 	test_multiple_add();
 	test_FIFO();
+	test_channel();
+	test_state_machine();
+	test_array();
+	test_static_map();
+	test_pool();
+	test_list();
+	test_log();
+	test_stack_monitor();
+	test_profiler();
+	test_record();
+	test_watchdog();
+	test_edf();
+	test_uart();
+	test_print();
+	test_fixed();
+	test_crc();
+	test_frames();
+	test_adc();
+	test_bus();
+	test_eeprom();
+	test_pin_change();
+	test_registers();
+	test_costs();
+	test_interrupts();
 }
\ No newline at end of file
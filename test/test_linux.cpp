@@ -0,0 +1,367 @@
+/* this file tests the stedos Linux backend */
+#include <stdint.h>
+#include "../stedos_linux.h"
+#include <fcntl.h>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+typedef stedos::posix::EventLoop<64> Loop;
+typedef stedos::posix::ParallelEventProcessor<4> Pool;
+
+Loop* loop;
+Pool* pool;
+
+void test_atomic(void)
+{
+	cout << "test_atomic" << endl;
+
+	assert((SREG == 0x80) && "unlocked");
+	{
+		auto a = stedos::Atomic();
+		assert((SREG == 0x00) && "locked");
+		{
+			auto b = stedos::Atomic();
+			assert((SREG == 0x00) && "nested");
+		}
+		assert((SREG == 0x00) && "still locked after the nested Atomic");
+	}
+	assert((SREG == 0x80) && "unlocked again");
+
+	/* The same FIFO used by several threads */
+	stedos::FIFO<uint8_t, 16> fifo;
+	uint32_t total = 0;
+	vector<thread> threads;
+	for (int t=0; t<4; t+=1)
+	{
+		threads.push_back(thread([&]() {
+			for (int idx=0; idx<100000; idx+=1)
+			{
+				auto a = stedos::Atomic();
+				fifo.push(1);
+				total += fifo.pop();
+			}
+		}));
+	}
+	for (auto& t : threads) t.join();
+
+	assert((total == 400000) && "atomic total");
+	assert((fifo.isEmpty()) && "fifo empty");
+}
+
+chrono::steady_clock::time_point expired;
+
+void timeout(uintptr_t data)
+{
+	expired = chrono::steady_clock::now();
+	loop->stop();
+}
+
+void test_timer(void)
+{
+	cout << "test_timer" << endl;
+
+	Loop l;
+	loop = &l;
+	stedos::SimpleTimerImplementation<4> timer(&l);
+
+	assert((l.begin()) && "begin");
+	assert((l.tick(&timer, 1000)) && "tick");
+
+	auto start = chrono::steady_clock::now();
+	timer.add(20, stedos::Event(timeout));
+	l.run();
+
+	auto ms = chrono::duration_cast<chrono::milliseconds>(expired - start).count();
+	cout << "timeout after " << ms << " ms" << endl;
+	assert((ms >= 19) && "timer fired early");
+	assert((ms < 1000) && "timer fired late");
+}
+
+int pipes[2];
+uint8_t received[4];
+uint8_t receivedCount = 0;
+
+void readable(uintptr_t fd)
+{
+	uint8_t c;
+	while (read((int) fd, &c, 1) == 1) received[receivedCount++] = c;
+	if (receivedCount == 4) loop->stop();
+}
+
+void test_watch(void)
+{
+	cout << "test_watch" << endl;
+
+	Loop l;
+	loop = &l;
+	assert((l.begin()) && "begin");
+	assert((pipe(pipes) == 0) && "pipe");
+	fcntl(pipes[0], F_SETFL, O_NONBLOCK);
+
+	assert((l.watch(pipes[0], EPOLLIN, stedos::Event(readable, pipes[0]))) && "watch");
+
+	thread writer([]() {
+		for (uint8_t c=1; c<=4; c+=1)
+		{
+			this_thread::sleep_for(chrono::milliseconds(2));
+			ssize_t r = write(pipes[1], &c, 1);
+			(void) r;
+		}
+	});
+	l.run();
+	writer.join();
+
+	assert((receivedCount == 4) && "received count");
+	assert((received[0] == 1) && (received[3] == 4) && "received order");
+
+	l.unwatch(pipes[0]);
+	close(pipes[0]);
+	close(pipes[1]);
+}
+
+/* Events are posted by other threads while the loop sleeps and
+   runs.  Each thread's events must arrive in order and none may
+   be lost */
+const int POSTERS = 3;
+const uint32_t POSTS = 20000;
+uint32_t expected[POSTERS];
+uint32_t processed = 0;
+
+void posted(uintptr_t data)
+{
+	uint32_t poster = data >> 24;
+	uint32_t seq    = data & 0xffffff;
+	assert((seq == expected[poster]) && "posted in order");
+	expected[poster] += 1;
+
+	processed += 1;
+	if (processed == POSTERS * POSTS) loop->stop();
+}
+
+void test_cross_thread(void)
+{
+	cout << "test_cross_thread" << endl;
+
+	Loop l;
+	loop = &l;
+	assert((l.begin()) && "begin");
+
+	vector<thread> threads;
+	for (uint32_t t=0; t<POSTERS; t+=1)
+	{
+		threads.push_back(thread([t]() {
+			for (uint32_t seq=0; seq<POSTS; seq+=1)
+			{
+				while (loop->post(stedos::Event(posted, (t << 24) | seq)) == false)
+				{
+					this_thread::yield();
+				}
+			}
+		}));
+	}
+	l.run();
+	for (auto& t : threads) t.join();
+
+	assert((processed == POSTERS * POSTS) && "all processed");
+	cout << "dropped (and retried) : " << l.droppedCount() << endl;
+}
+
+/* Work that fans out across the workers, so that they steal */
+std::atomic<uint32_t> leaves(0);
+
+void fan(uintptr_t depth)
+{
+	if (depth == 0) { leaves += 1; return; }
+	pool->queueEvent(fan, depth - 1);
+	pool->queueEvent(fan, depth - 1);
+}
+
+void test_parallel(void)
+{
+	cout << "test_parallel" << endl;
+
+	Pool p;
+	pool = &p;
+	assert((p.begin(4)) && "begin");
+
+	p.queueEvent(fan, 14);
+	p.process();
+	assert((leaves == (1 << 14)) && "all leaves ran");
+	assert((p.droppedCount() == 0) && "none dropped");
+	cout << "stolen : " << p.stolenCount() << endl;
+
+	p.stop();
+	assert((p.workerCount() == 0) && "stopped");
+}
+
+/* Keyed events are posted by several threads and by handlers,
+   mixed in with unkeyed work that the workers steal.  The events
+   for each key must run one at a time, and in the order that each
+   poster queued them */
+const int KEYS = 37;
+const int KEY_POSTERS = 4;
+const uint32_t KEY_POSTS = 50000;
+const uint32_t HANDLER = KEY_POSTERS;     /* poster id of the handlers */
+
+uint32_t keySeen[KEYS][KEY_POSTERS + 1];  /* next seq from each poster */
+uint32_t keyChained[KEYS];                /* handler posts, per key    */
+std::atomic<uint8_t>  keyBusy[KEYS];
+std::atomic<uint32_t> keyErrors(0);
+std::atomic<uint32_t> keyRuns(0);
+std::atomic<uint32_t> chained(0);
+std::atomic<uint32_t> noiseDropped(0);   /* the deque and injection queue were full */
+
+void noise(uintptr_t data) { leaves += 1; }
+
+uintptr_t keyData(const uint32_t& key, const uint32_t& poster, const uint32_t& seq)
+{
+	return (key << 24) | (poster << 20) | seq;
+}
+
+void keyed(uintptr_t data)
+{
+	uint32_t key    = (data >> 24) & 0xff;
+	uint32_t poster = (data >> 20) & 0xf;
+	uint32_t seq    = data & 0xfffff;
+
+	if (keyBusy[key].exchange(1) != 0) keyErrors += 1;     /* two at once  */
+	if (keySeen[key][poster] != seq)   keyErrors += 1;     /* out of order */
+	keySeen[key][poster] = seq + 1;
+
+	/* Every 8th event from poster 0 chains another on the same key.
+	   This worker owns the key, so the post can't fail (a retry
+	   would never succeed, as only this worker empties the queue) */
+	if ((poster == 0) && ((seq % 8) == 0))
+	{
+		if (pool->post(key, stedos::Event(keyed, keyData(key, HANDLER, keyChained[key]))) == false) keyErrors += 1;
+		keyChained[key] += 1;
+		chained += 1;
+	}
+	if (pool->post(stedos::Event(noise)) == false) noiseDropped += 1;
+
+	keyBusy[key].store(0);
+	keyRuns += 1;
+}
+
+void test_parallel_order(void)
+{
+	cout << "test_parallel_order" << endl;
+
+	Pool p;
+	pool = &p;
+	leaves = 0;
+	assert((p.begin(4)) && "begin");
+
+	vector<thread> threads;
+	for (uint32_t t=0; t<KEY_POSTERS; t+=1)
+	{
+		threads.push_back(thread([t]() {
+			uint32_t next[KEYS] = { 0 };
+			for (uint32_t idx=0; idx<KEY_POSTS; idx+=1)
+			{
+				uint32_t key = (idx * 7 + t * 3) % KEYS;
+				while (pool->post(key, stedos::Event(keyed, keyData(key, t, next[key]))) == false)
+				{
+					this_thread::yield();
+				}
+				next[key] += 1;
+			}
+		}));
+	}
+	for (auto& t : threads) t.join();
+	p.process();
+
+	cout << "runs : " << keyRuns << " chained : " << chained << " stolen : " << p.stolenCount() << endl;
+	assert((keyErrors == 0) && "keyed events ran in order, one at a time");
+	assert((keyRuns == KEY_POSTERS * KEY_POSTS + chained) && "all keyed events ran");
+	assert((leaves + noiseDropped == keyRuns) && "all unkeyed events ran");
+
+	uint32_t total = 0;
+	for (int key=0; key<KEYS; key+=1)
+	{
+		for (int t=0; t<KEY_POSTERS; t+=1) total += keySeen[key][t];
+		assert((keySeen[key][HANDLER] == keyChained[key]) && "chained in order");
+	}
+	assert((total == KEY_POSTERS * KEY_POSTS) && "posted in order");
+}
+
+/* A handler that queues more events on its own key than the
+   ordered queue holds */
+const uint32_t SPILLS = 3 * 256;
+uint32_t spillNext = 0;
+std::atomic<uint32_t> spillErrors(0);
+
+void spilled(uintptr_t seq)
+{
+	if (seq != spillNext) spillErrors += 1;
+	spillNext += 1;
+}
+
+void spiller(uintptr_t key)
+{
+	for (uint32_t seq=0; seq<SPILLS; seq+=1)
+	{
+		if (pool->post(key, stedos::Event(spilled, seq)) == false) spillErrors += 1;
+	}
+}
+
+void test_parallel_spill(void)
+{
+	cout << "test_parallel_spill" << endl;
+
+	Pool p;
+	pool = &p;
+	assert((p.begin(2)) && "begin");
+
+	p.post(5, stedos::Event(spiller, 5));
+	p.process();
+	assert((spillErrors == 0) && "posted and run in order");
+	assert((spillNext == SPILLS) && "all run");
+	assert((p.droppedCount() == 0) && "none dropped");
+}
+
+/* stop() waits for an event that a running handler posts to
+   another worker's ordered queue, after that worker ran out of
+   work */
+std::atomic<bool> lateRan(false);
+
+void late(uintptr_t data) { lateRan = true; }
+
+void slowPoster(uintptr_t data)
+{
+	this_thread::sleep_for(chrono::milliseconds(20));
+	if (pool->post(1, stedos::Event(late)) == false) keyErrors += 1;
+}
+
+void test_parallel_stop(void)
+{
+	cout << "test_parallel_stop" << endl;
+
+	Pool p;
+	pool = &p;
+	keyErrors = 0;
+	assert((p.begin(2)) && "begin");
+
+	p.post(0, stedos::Event(slowPoster));
+	this_thread::sleep_for(chrono::milliseconds(5));
+	p.stop();
+	assert((keyErrors == 0) && "posted while stopping");
+	assert(lateRan && "ran before the workers stopped");
+}
+
+int main(void)
+{
+	test_atomic();
+	test_timer();
+	test_watch();
+	test_cross_thread();
+	test_parallel();
+	test_parallel_order();
+	test_parallel_spill();
+	test_parallel_stop();
+}
@@ -0,0 +1,43 @@
+/*
+ * logdecode - prints a stedos binary log stream as text
+ *
+ * build : make MESSAGES=path/to/messages.def
+ * usage : logdecode [file]      (reads stdin if no file is given)
+ */
+
+#include <string.h>
+#include <vector>
+#include "logdecode.h"
+
+int main(int argc, char** argv)
+{
+    FILE* in = (argc > 1) ? fopen(argv[1], "rb") : stdin;
+    if (in == 0)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t buffer[256];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    {
+        data.insert(data.end(), buffer, buffer + n);
+    }
+
+    const uint8_t* p   = data.data();
+    const uint8_t* end = p + data.size();
+    std::string line;
+    while (size_t used = stedos::logdecode::decode(p, end, line))
+    {
+        printf("%s\n", line.c_str());
+        p += used;
+    }
+
+    if (p != end)
+    {
+        fprintf(stderr, "logdecode: %u trailing bytes\n", (unsigned) (end - p));
+    }
+    return 0;
+}
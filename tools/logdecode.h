@@ -0,0 +1,191 @@
+/*
+ * StedOS - log decoder
+ *
+ * Turns the binary stream written by the STEDOS_LOG macros back
+ * into text.  The string table is generated from the same message
+ * definition file that the target was built with, which must be
+ * named by STEDOS_MESSAGES before this file is included.
+ *
+ * (c) stedmeister
+ *
+ * Licesnse TBD
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+namespace stedos
+{
+    namespace logdecode
+    {
+        /* The most arguments that a message can have */
+        const uint8_t MAX_ARGS = 16;
+
+        /* The sizes and signedness of the arguments of a message */
+        template <typename... T>
+        struct arg_info
+        {
+            static_assert(sizeof...(T) <= MAX_ARGS, "a message can have at most 16 arguments");
+
+            static const uint8_t count = sizeof...(T);
+
+            static const uint8_t* sizes()
+            {
+                static const uint8_t s[] = { sizeof(T)..., 0 };
+                return s;
+            }
+
+            static const uint8_t* signs()
+            {
+                static const uint8_t s[] = { (T(0) > T(-1))..., 0 };
+                return s;
+            }
+        };
+
+        struct message
+        {
+            const char*    name;
+            const char*    format;
+            uint8_t        count;
+            const uint8_t* sizes;
+            const uint8_t* signs;
+        };
+
+        /* The string table, in message ID order */
+        inline const message* messages()
+        {
+            static const message table[] =
+            {
+                #define STEDOS_MESSAGE(name, format, ...) \
+                    { #name, format, arg_info<__VA_ARGS__>::count, arg_info<__VA_ARGS__>::sizes(), arg_info<__VA_ARGS__>::signs() },
+                #include STEDOS_MESSAGES
+                #undef STEDOS_MESSAGE
+            };
+            return table;
+        }
+
+        enum
+        {
+            MESSAGE_COUNT = 0
+            #define STEDOS_MESSAGE(name, format, ...) + 1
+            #include STEDOS_MESSAGES
+            #undef STEDOS_MESSAGE
+        };
+
+        /* Formats one argument with a printf conversion.  The
+           length modifiers are not used, as the argument sizes
+           come from the message definition */
+        inline std::string formatArg(const std::string& flags, const char& conversion,
+                                     const uint64_t& value, const uint8_t& size)
+        {
+            char out[64];
+            std::string spec = "%" + flags;
+            uint64_t mask = (size < 8) ? ((uint64_t) 1 << (8 * size)) - 1 : ~(uint64_t) 0;
+
+            switch (conversion)
+            {
+                case 'd':
+                case 'i':
+                    snprintf(out, sizeof(out), (spec + "lld").c_str(), (long long) value);
+                    break;
+
+                case 'u':
+                case 'x':
+                case 'X':
+                case 'o':
+                    snprintf(out, sizeof(out), (spec + "ll" + conversion).c_str(), (unsigned long long) (value & mask));
+                    break;
+
+                case 'c':
+                    snprintf(out, sizeof(out), (spec + "c").c_str(), (int) (value & 0xff));
+                    break;
+
+                default:
+                    return "<?>";
+            }
+            return out;
+        }
+
+        /* Decodes one record from [p, end) into line.
+           Returns the number of bytes used, or 0 if the
+           record is not complete yet */
+        inline size_t decode(const uint8_t* p, const uint8_t* end, std::string& line)
+        {
+            const uint8_t* start = p;
+            if (p == end) return 0;
+
+            uint16_t id = *p++;
+            if (id & 0x80)
+            {
+                if (p == end) return 0;
+                id = (id & 0x7f) | (uint16_t) (*p++ << 7);
+            }
+
+            if (id >= MESSAGE_COUNT)
+            {
+                char out[32];
+                snprintf(out, sizeof(out), "<unknown message %u>", id);
+                line = out;
+                return p - start;
+            }
+
+            /* Read the arguments, sign extending where needed */
+            const message& m = messages()[id];
+            uint64_t args[MAX_ARGS];
+            for (uint8_t idx=0; idx<m.count; idx+=1)
+            {
+                uint8_t size = m.sizes[idx];
+                if ((end - p) < size) return 0;
+
+                uint64_t v = 0;
+                for (uint8_t b=0; b<size; b+=1)
+                {
+                    v |= (uint64_t) p[b] << (8 * b);
+                }
+                if (m.signs[idx] && (size < 8) && (v >> (8 * size - 1)))
+                {
+                    v |= ~(uint64_t) 0 << (8 * size);
+                }
+                args[idx] = v;
+                p += size;
+            }
+
+            /* Expand the format string */
+            line.clear();
+            uint8_t arg = 0;
+            for (const char* f = m.format; *f; f += 1)
+            {
+                if (*f != '%')
+                {
+                    line += *f;
+                    continue;
+                }
+
+                f += 1;
+                if (*f == '%')
+                {
+                    line += '%';
+                    continue;
+                }
+
+                std::string flags;
+                while (*f && strchr("-+ #0123456789.", *f)) flags += *f++;
+                while (*f && strchr("hlLqjzt", *f)) f += 1;
+                if (*f == 0) break;
+
+                if (arg < m.count)
+                {
+                    line += formatArg(flags, *f, args[arg], m.sizes[arg]);
+                    arg += 1;
+                }
+                else
+                {
+                    line += "<?>";
+                }
+            }
+            return p - start;
+        }
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * replay - replays a stedos event recording on the PC
+ *
+ * The application's handlers are built in from the header named
+ * by STEDOS_REPLAY_APP, which must define, in namespace app:
+ *
+ *   const stedos::event_func_t handlers[];   the recorded table
+ *   const char* const names[];               their names
+ *   const uint8_t handlerCount;
+ *   void setup(stedos::ReplaySource* source); hooks up input()
+ *   void report();                           prints the end state
+ *
+ * build : make replay APP=path/to/app.h
+ * usage : replay [-d] [-r tick_us] [file]   (reads stdin if no file is given)
+ *
+ *    -d          prints the records instead of replaying them
+ *    -r tick_us  waits for the ticks in real time
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../stedos_linux.h"
+#include "replay.h"
+#include STEDOS_REPLAY_APP
+
+int main(int argc, char** argv)
+{
+    bool     dump   = false;
+    uint32_t period = 0;
+    int      arg    = 1;
+
+    for (; (arg < argc) && (argv[arg][0] == '-'); arg += 1)
+    {
+        if (strcmp(argv[arg], "-d") == 0) dump = true;
+        else if ((strcmp(argv[arg], "-r") == 0) && (arg + 1 < argc)) period = strtoul(argv[++arg], 0, 0);
+        else
+        {
+            fprintf(stderr, "usage: replay [-d] [-r tick_us] [file]\n");
+            return 1;
+        }
+    }
+
+    FILE* in = (arg < argc) ? fopen(argv[arg], "rb") : stdin;
+    if (in == 0)
+    {
+        perror(argv[arg]);
+        return 1;
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t buffer[256];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    {
+        data.insert(data.end(), buffer, buffer + n);
+    }
+
+    if (dump)
+    {
+        const uint8_t* p   = data.data();
+        const uint8_t* end = p + data.size();
+        stedos::replay::Record r;
+        while (size_t used = stedos::replay::decode(p, end, r))
+        {
+            printf("%s\n", stedos::replay::describe(r, app::names, app::handlerCount).c_str());
+            p += used;
+        }
+        return 0;
+    }
+
+    stedos::replay::Replayer replayer(data.data(), data.size(), app::handlers, app::handlerCount);
+    app::setup(&replayer);
+    replayer.run(period);
+    app::report();
+
+    printf("%u events, %u ticks, %u lost, %u errors\n",
+           replayer.eventCount(), replayer.tickCount(), replayer.lostCount(), replayer.errorCount());
+    if (replayer.remaining())
+    {
+        fprintf(stderr, "replay: %u trailing bytes\n", (unsigned) replayer.remaining());
+    }
+    return (replayer.errorCount() || replayer.lostCount()) ? 1 : 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * StedOS - event replay
+ *
+ * Replays a stream written by stedos::Recorder.  The events are
+ * dispatched to the same handlers, built for the PC, in the order
+ * that they ran on the target, and the recorded inputs are handed
+ * back to Recorder::input().  The handlers are found by their
+ * index in the same table that the target was recorded with.
+ *
+ * Idle time is skipped (fast forward) unless run() is given the
+ * tick period, in which case the ticks are waited for in real time.
+ *
+ * Include stedos.h (through a backend) before this file.
+ *
+ * (c) stedmeister
+ *
+ * Licesnse TBD
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+
+namespace stedos
+{
+    namespace replay
+    {
+        struct Record
+        {
+            uint8_t  tag;       /* one of the RECORD_ tags */
+            uint8_t  index;     /* count, handler index or channel */
+            uint64_t value;     /* data or input value */
+        };
+
+        /* Decodes the record at p.  Returns the number of bytes
+           used, or 0 if the stream ends part way through it */
+        inline size_t decode(const uint8_t* p, const uint8_t* end, Record& r)
+        {
+            if (p >= end) return 0;
+
+            r.tag   = *p & RECORD_MASK;
+            r.index = *p & ~RECORD_MASK;
+            r.value = 0;
+            size_t used = 1;
+
+            if ((r.tag == RECORD_EVENT) || (r.tag == RECORD_INPUT))
+            {
+                uint8_t shift = 0;
+                while (true)
+                {
+                    if (p + used >= end) return 0;
+                    uint8_t b = p[used++];
+                    r.value |= (uint64_t) (b & 0x7f) << shift;
+                    shift += 7;
+                    if ((b & 0x80) == 0) break;
+                    if (shift >= 64) return 0;
+                }
+            }
+            return used;
+        }
+
+        /* Describes a record, e.g. "event sample 12" */
+        inline std::string describe(const Record& r, const char* const* names=0, const uint8_t& count=0)
+        {
+            char text[80];
+            switch (r.tag)
+            {
+                case RECORD_TICKS:
+                    if (r.index == 0) snprintf(text, sizeof(text), "start");
+                    else              snprintf(text, sizeof(text), "ticks %u", r.index);
+                    break;
+
+                case RECORD_EVENT:
+                    if (names && (r.index < count)) snprintf(text, sizeof(text), "event %s %llu", names[r.index], (unsigned long long) r.value);
+                    else                            snprintf(text, sizeof(text), "event #%u %llu", r.index, (unsigned long long) r.value);
+                    break;
+
+                case RECORD_INPUT:
+                    snprintf(text, sizeof(text), "input %u %llu", r.index, (unsigned long long) r.value);
+                    break;
+
+                default:
+                    snprintf(text, sizeof(text), "lost %u", r.index);
+                    break;
+            }
+            return text;
+        }
+
+        class Replayer : public ReplaySource
+        {
+        public:
+            Replayer(const uint8_t* data, const size_t& size, const event_func_t* table, const uint8_t& n)
+                : p(data), end(data + size), handlers(table), count(n),
+                  ticks(0), events(0), lost(0), errors(0), tickUs(0) {};
+
+            /* Replays up to and including the next event.  Returns
+               false at the end of the stream */
+            bool step()
+            {
+                Record r;
+                while (size_t used = next(r))
+                {
+                    p += used;
+                    if (r.tag == RECORD_EVENT)
+                    {
+                        events += 1;
+                        if (r.index < count)
+                        {
+                            handlers[r.index]((uintptr_t) r.value);
+                        }
+                        else
+                        {
+                            fprintf(stderr, "replay: no handler %u\n", r.index);
+                            errors += 1;
+                        }
+                        return true;
+                    }
+
+                    fprintf(stderr, "replay: input %u not used by a handler\n", r.index);
+                    errors += 1;
+                }
+                return false;
+            }
+
+            /* Replays the whole stream.  If period isn't 0, the ticks
+               are waited for, at period microseconds each */
+            void run(const uint32_t& period=0)
+            {
+                tickUs = period;
+                while (step()) {}
+            }
+
+            /* Called by Recorder::input() in a handler.  The next
+               record, after any ticks that passed while the handler
+               ran, must be the input */
+            bool input(const uint8_t& channel, uint32_t& value)
+            {
+                Record r;
+                size_t used = next(r);
+                if ((used == 0) || (r.tag != RECORD_INPUT) || (r.index != channel))
+                {
+                    fprintf(stderr, "replay: expected input %u\n", channel);
+                    errors += 1;
+                    return false;
+                }
+                p += used;
+                value = (uint32_t) r.value;
+                return true;
+            }
+
+            /* Bytes of the stream that couldn't be decoded */
+            size_t   remaining()  const { return end - p; }
+
+            uint32_t tickCount()  const { return ticks;  }
+            uint32_t eventCount() const { return events; }
+            uint32_t lostCount()  const { return lost;   }
+            uint32_t errorCount() const { return errors; }
+
+        private:
+            const uint8_t*      p;
+            const uint8_t*      end;
+            const event_func_t* handlers;
+            uint8_t             count;
+            uint32_t            ticks;
+            uint32_t            events;
+            uint32_t            lost;
+            uint32_t            errors;
+            uint32_t            tickUs;
+
+            /* Replays the ticks and lost records, and decodes the
+               event or input after them into r.  Returns its size,
+               or 0 at the end of the stream */
+            size_t next(Record& r)
+            {
+                while (size_t used = decode(p, end, r))
+                {
+                    if (r.tag == RECORD_TICKS)
+                    {
+                        ticks += r.index;
+                        if (tickUs) wait(r.index);
+                    }
+                    else if (r.tag == RECORD_LOST)
+                    {
+                        lost += r.index;
+                    }
+                    else return used;
+                    p += used;
+                }
+                return 0;
+            }
+
+            void wait(const uint8_t& n)
+            {
+                uint64_t ns = (uint64_t) n * tickUs * 1000;
+                struct timespec t;
+                t.tv_sec  = ns / 1000000000;
+                t.tv_nsec = ns % 1000000000;
+                nanosleep(&t, 0);
+            }
+        };
+    }
+}